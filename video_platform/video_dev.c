@@ -2,39 +2,64 @@
  * @file    vcam_device.c
  * @author  dingyiqian
  * @brief   一个为V4L2虚拟摄像头创建平台设备(platform_device)的模块。
- * @details 该模块的唯一作用就是向内核注册一个平台设备。这个设备本身
+ * @details 该模块的唯一作用就是向内核注册平台设备(个数由num_cams参数指定)。这些设备本身
  * 没有任何功能，它只是作为一个“占位符”或“硬件描述”，
  * 等待一个与之同名的平台驱动(platform_driver)来匹配和驱动。
  */
 
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/platform_device.h>
 
 #define DRIVER_NAME "vcam_plat"
+#define VCAM_MAX_DEVICES 64
 
-static void vcam_plat_device_release(struct device *dev)
-{
-    pr_info("平台设备 %s 已释放\n", DRIVER_NAME);
-}
+/* 创建多少个虚拟摄像头, 每个都有自己的 /dev/videoX, 帧时钟和格式 */
+static unsigned int num_cams = 1;
+module_param(num_cams, uint, 0444);
+MODULE_PARM_DESC(num_cams, "虚拟摄像头个数 (1-64, 默认1)");
 
-static struct platform_device vcam_platform_device = {
-    .name = DRIVER_NAME, // 设备的名称
-    .id   = -1,          // -1 表示只有一个该类型的设备
-    .dev = {
-        .release = vcam_plat_device_release,
-    },
-};
+static struct platform_device *vcam_platform_devices[VCAM_MAX_DEVICES];
 
+static void vcam_device_unregister_all(void)
+{
+    int i;
+
+    for (i = VCAM_MAX_DEVICES - 1; i >= 0; i--) {
+        if (vcam_platform_devices[i]) {
+            platform_device_unregister(vcam_platform_devices[i]);
+            vcam_platform_devices[i] = NULL;
+        }
+    }
+}
 
 static int __init vcam_device_init(void)
 {
-    pr_info("注册虚拟摄像头平台设备 '%s'...\n", DRIVER_NAME);
-    return platform_device_register(&vcam_platform_device);
+    struct platform_device *pdev;
+    unsigned int i;
+
+    if (num_cams < 1 || num_cams > VCAM_MAX_DEVICES) {
+        pr_err("num_cams=%u 超出范围 1-%d\n", num_cams, VCAM_MAX_DEVICES);
+        return -EINVAL;
+    }
+
+    pr_info("注册 %u 个虚拟摄像头平台设备 '%s'...\n", num_cams, DRIVER_NAME);
+    for (i = 0; i < num_cams; i++) {
+        /* id = i, 设备名为 vcam_plat.i; 动态分配的设备由内核负责释放 */
+        pdev = platform_device_register_simple(DRIVER_NAME, i, NULL, 0);
+        if (IS_ERR(pdev)) {
+            pr_err("注册平台设备 %s.%u 失败\n", DRIVER_NAME, i);
+            vcam_device_unregister_all();
+            return PTR_ERR(pdev);
+        }
+        vcam_platform_devices[i] = pdev;
+    }
+    return 0;
 }
 static void __exit vcam_device_exit(void)
 {
     pr_info("注销虚拟摄像头平台设备 '%s'...\n", DRIVER_NAME);
-    platform_device_unregister(&vcam_platform_device);
+    vcam_device_unregister_all();
 }
 
 module_init(vcam_device_init);
@@ -42,4 +67,4 @@ module_exit(vcam_device_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("dingyiqian");
-MODULE_DESCRIPTION("为V4L2虚拟摄像头提供一个平台设备");
+MODULE_DESCRIPTION("为V4L2虚拟摄像头提供平台设备, 个数由num_cams指定");
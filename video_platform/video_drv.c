@@ -13,10 +13,12 @@
 #include <linux/platform_device.h>
 #include <linux/slab.h>
 #include <linux/list.h>
-#include <linux/timer.h>
-#include <linux/jiffies.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/atomic.h>
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-ioctl.h>
 #include <media/v4l2-ctrls.h>
@@ -25,10 +27,86 @@
 #include <media/videobuf2-v4l2.h>
 #include <media/videobuf2-vmalloc.h>
 
-#define IMAGE_WIDTH  800
-#define IMAGE_HEIGHT 600
-#define IMAGE_SIZE   (IMAGE_WIDTH * IMAGE_HEIGHT * 2) // YUYV格式
 #define DRIVER_NAME "vcam_plat"
+#define VCAM_COLORS  3 // 红绿蓝循环
+
+/* 分辨率范围, 最大到4K; 宽度取偶数以满足YUV422 */
+#define VCAM_MIN_WIDTH   32
+#define VCAM_MIN_HEIGHT  32
+#define VCAM_MAX_WIDTH   4096
+#define VCAM_MAX_HEIGHT  2160
+#define VCAM_DEF_WIDTH   800
+#define VCAM_DEF_HEIGHT  600
+#define VCAM_DEF_FPS     30
+#define VCAM_MAX_FPS     240
+#define VCAM_MAX_BPP     3
+
+/*
+ * 支持的像素格式, bpp为每像素字节数(半平面格式指Y平面)。
+ * chroma_ydiv非0表示Y平面之后紧跟一个UV交织平面, 行字节数与Y平面相同,
+ * 行数为高度除以chroma_ydiv: NV12为2(12bpp), NV16为1(16bpp)。
+ */
+struct vcam_format {
+    u32 fourcc;
+    const char *desc;
+    int bpp;
+    int chroma_ydiv;
+};
+
+static const struct vcam_format vcam_formats[] = {
+    { V4L2_PIX_FMT_YUYV,  "YUYV 4:2:2",      2, 0 },
+    { V4L2_PIX_FMT_UYVY,  "UYVY 4:2:2",      2, 0 },
+    { V4L2_PIX_FMT_RGB24, "24-bit RGB 8-8-8", 3, 0 },
+    { V4L2_PIX_FMT_GREY,  "8-bit Greyscale", 1, 0 },
+    { V4L2_PIX_FMT_NV12,  "Y/UV 4:2:0",      1, 2 },
+    { V4L2_PIX_FMT_NV16,  "Y/UV 4:2:2",      1, 1 },
+};
+
+/*
+ * multiplanar=1时设备走多平面API(V4L2_CAP_VIDEO_CAPTURE_MPLANE), 和ISP的输出方式一致;
+ * 所有格式都只用一个内存平面, NV12/NV16的UV平面紧跟在Y平面之后。
+ */
+static bool multiplanar;
+module_param(multiplanar, bool, 0444);
+MODULE_PARM_DESC(multiplanar, "使用多平面API (默认0)");
+
+/* V4L2_CID_TEST_PATTERN 菜单项, 除纯色外都在左上角嵌入帧标记 */
+enum {
+    VCAM_PATTERN_SOLID,     // 红绿蓝纯色, 每60帧切换
+    VCAM_PATTERN_BARS,      // 横向滚动的彩条
+    VCAM_PATTERN_GRADIENT,  // 横向滚动的灰度渐变
+    VCAM_PATTERN_COUNT
+};
+
+static const char * const vcam_pattern_names[] = {
+    "Solid Colors",
+    "Moving Color Bars",
+    "Moving Gradient",
+};
+
+/*
+ * 帧标记: 左上角16x8个8x8像素的黑白格子, 共128位, 行优先、高位在前:
+ * 魔数0x5643("VC") | sequence(32) | 时间戳ns(64, CLOCK_MONOTONIC) | 校验(16)
+ * 用户空间按格子中心的亮度是否过半解码, 见 video_qt_test/untitled/framestamp.cpp
+ */
+#define VCAM_STAMP_CELL   8
+#define VCAM_STAMP_COLS   16
+#define VCAM_STAMP_ROWS   8
+#define VCAM_STAMP_MAGIC  0x5643
+
+/* ENUM_FRAMEINTERVALS列出的帧率, S_PARM可以设置1~240之间的任意帧率 */
+static const unsigned int vcam_fps_list[] = { 240, 120, 90, 60, 50, 30, 25, 15, 10, 5 };
+
+/*
+ * 一种颜色的一行模板, 格式、宽度或亮度变化时才重新生成。
+ * 填帧时先拷贝一行, 再按已填好的部分成倍地memcpy, 只需log2(行数)次大块拷贝。
+ */
+struct vcam_template {
+    u32 fourcc;
+    int width;
+    int brightness; // 生成模板时的亮度, -1表示还没生成
+    unsigned char *row; // VCAM_MAX_WIDTH * VCAM_MAX_BPP 字节
+};
 
 struct vcam_device {
     struct v4l2_device v4l2_dev;
@@ -37,9 +115,28 @@ struct vcam_device {
     struct mutex lock;
     struct list_head queued_bufs;
     struct spinlock queued_lock;
-    struct timer_list timer;
-    int copy_cnt;
+    struct hrtimer frame_timer;     // 帧时钟, 绝对截止时间, 不累积误差
+    ktime_t frame_period;
+    struct workqueue_struct *wq;    // 生成帧的工作队列, 不在定时器软中断里填数据
+    struct work_struct frame_work;
+    struct vcam_template templates[VCAM_COLORS];
     int brightness;
+    struct v4l2_pix_format fmt;     // 当前格式, 流开启后不再改变; 多平面API时也用它保存
+    const struct vcam_format *vfmt;
+    struct v4l2_fract timeperframe;
+    int test_pattern;
+    unsigned char *pattern_row;     // 彩条/渐变每帧都要重新生成的一行
+
+    /*
+     * 每个帧时钟节拍占一个sequence, 没能生成的节拍在sequence里留下空洞,
+     * 用户空间据此可以精确统计丢帧。
+     */
+    atomic_t ticks;          // 已经过去的节拍数
+    atomic64_t tick_ns;      // 最近一个节拍的到期时刻(CLOCK_MONOTONIC), 先于ticks写入
+    u32 frames_done;         // 成功交付的帧数
+    atomic_t drop_late;      // 定时器回调被推迟超过一个周期而错过的节拍
+    atomic_t drop_busy;      // 上一帧还没生成完而合并掉的节拍
+    u32 drop_nobuf;          // 用户空间占着所有缓冲区而丢掉的帧
 };
 
 struct vcam_frame_buf {
@@ -48,40 +145,267 @@ struct vcam_frame_buf {
 };
 
 //前向声明
-static void vcam_timer_expire(struct timer_list *t);
+static enum hrtimer_restart vcam_timer_expire(struct hrtimer *t);
+static void vcam_frame_work(struct work_struct *work);
 static const struct v4l2_file_operations vcam_fops;
 static const struct v4l2_ioctl_ops vcam_ioctl_ops;
 static const struct vb2_ops vcam_vb2_ops;
 
 
+static const struct vcam_format *vcam_find_format(u32 fourcc)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(vcam_formats); i++)
+        if (vcam_formats[i].fourcc == fourcc)
+            return &vcam_formats[i];
+    return NULL;
+}
+
+static u32 vcam_sizeimage(const struct vcam_format *vfmt, u32 bytesperline, u32 height)
+{
+    u32 size = bytesperline * height;
+
+    if (vfmt->chroma_ydiv)
+        size += bytesperline * height / vfmt->chroma_ydiv;
+    return size;
+}
+
+/* RGB换算为BT.601全范围色度, 偶数像素取U, 奇数像素取V */
+static int vcam_rgb_to_chroma(int x, int r, int g, int b)
+{
+    if (x & 1)
+        return clamp(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128, 0, 255);
+    return clamp(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128, 0, 255);
+}
+
 /**
- * 动态生成YUYV格式的纯色图像，并应用亮度调节。
+ * 生成一行纯色模板，并应用亮度调节。半平面格式的UV行放在Y行之后(row + width)。
  */
-static void fill_yuyv_buffer(void *ptr, int color_type, int brightness)
+static void vcam_build_template(struct vcam_template *tpl, const struct vcam_format *vfmt,
+                                int width, int color_type, int brightness)
 {
-    unsigned char y, u, v;
-    unsigned char *buf = ptr;
+    unsigned char y, u, v, r, g, b;
+    unsigned char *row = tpl->row;
     int i;
     int y_final;
+    int delta;
 
     switch (color_type) {
-        case 0: y = 76; u = 84; v = 255; break;   // 红色
-        case 1: y = 149; u = 43; v = 21; break;  // 绿色
-        default: y = 29; u = 255; v = 107; break; // 蓝色
+        case 0: y = 76; u = 84; v = 255; r = 255; g = 0; b = 0; break;   // 红色
+        case 1: y = 149; u = 43; v = 21; r = 0; g = 255; b = 0; break;  // 绿色
+        default: y = 29; u = 255; v = 107; r = 0; g = 0; b = 255; break; // 蓝色
     }
 
     /*
      * 亮度只影响Y(亮度)分量。亮度值从[0, 255]映射到[-128, 127]的调整范围。
-     * 默认值128对应调整量0。
+     * 默认值128对应调整量0; RGB格式三个分量同时调整。
      */
-    y_final = clamp(y + brightness - 128, 0, 255);
+    delta = brightness - 128;
+    y_final = clamp(y + delta, 0, 255);
 
-    for (i = 0; i < IMAGE_SIZE; i += 4) {
-        buf[i]     = y_final; // 第一个像素的亮度
-        buf[i + 1] = u;
-        buf[i + 2] = y_final; // 第二个像素的亮度
-        buf[i + 3] = v;
+    switch (vfmt->fourcc) {
+    case V4L2_PIX_FMT_UYVY:
+        for (i = 0; i < width * 2; i += 4) {
+            row[i]     = u;
+            row[i + 1] = y_final;
+            row[i + 2] = v;
+            row[i + 3] = y_final;
+        }
+        break;
+    case V4L2_PIX_FMT_RGB24:
+        for (i = 0; i < width * 3; i += 3) {
+            row[i]     = clamp(r + delta, 0, 255);
+            row[i + 1] = clamp(g + delta, 0, 255);
+            row[i + 2] = clamp(b + delta, 0, 255);
+        }
+        break;
+    case V4L2_PIX_FMT_GREY:
+        memset(row, y_final, width);
+        break;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV16:
+        memset(row, y_final, width);
+        for (i = 0; i < width; i += 2) {
+            row[width + i]     = u;
+            row[width + i + 1] = v;
+        }
+        break;
+    default: // YUYV
+        for (i = 0; i < width * 2; i += 4) {
+            row[i]     = y_final; // 第一个像素的亮度
+            row[i + 1] = u;
+            row[i + 2] = y_final; // 第二个像素的亮度
+            row[i + 3] = v;
+        }
+        break;
     }
+    tpl->fourcc = vfmt->fourcc;
+    tpl->width = width;
+    tpl->brightness = brightness;
+}
+
+/**
+ * 把一行复制到一个平面: 先拷贝一行, 再按已填好的部分成倍地memcpy。
+ */
+static void vcam_replicate_row(unsigned char *buf, const unsigned char *row,
+                               size_t line, size_t stride, int rows)
+{
+    size_t size = stride * rows;
+    size_t done, n;
+    int i;
+
+    /* 行有填充字节时不能整块倍增, 逐行拷贝 */
+    if (stride != line) {
+        for (i = 0; i < rows; i++)
+            memcpy(buf + (size_t)i * stride, row, line);
+        return;
+    }
+
+    memcpy(buf, row, line);
+    for (done = line; done < size; done += n) {
+        n = min_t(size_t, done, size - done);
+        memcpy(buf + done, buf, n);
+    }
+}
+
+/* 用一行模板填满整帧, 半平面格式再用模板的UV行填UV平面 */
+static void vcam_replicate_frame(struct vcam_device *dev, unsigned char *buf, const unsigned char *row)
+{
+    const struct v4l2_pix_format *fmt = &dev->fmt;
+    size_t line = (size_t)fmt->width * dev->vfmt->bpp;
+
+    vcam_replicate_row(buf, row, line, fmt->bytesperline, fmt->height);
+    if (dev->vfmt->chroma_ydiv)
+        vcam_replicate_row(buf + (size_t)fmt->bytesperline * fmt->height, row + fmt->width,
+                           fmt->width, fmt->bytesperline, fmt->height / dev->vfmt->chroma_ydiv);
+}
+
+/**
+ * 按当前格式写一个RGB像素, YUV按BT.601全范围换算; YUV422时偶数像素带U, 奇数像素带V。
+ * 半平面格式的色度写到crow, crow为空时只写亮度。
+ */
+static void vcam_put_rgb(unsigned char *row, unsigned char *crow, u32 fourcc, int x, int r, int g, int b)
+{
+    int y = (77 * r + 150 * g + 29 * b + 128) >> 8;
+    int c;
+
+    switch (fourcc) {
+    case V4L2_PIX_FMT_RGB24:
+        row[x * 3]     = r;
+        row[x * 3 + 1] = g;
+        row[x * 3 + 2] = b;
+        break;
+    case V4L2_PIX_FMT_GREY:
+        row[x] = y;
+        break;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV16:
+        row[x] = y;
+        if (crow)
+            crow[x] = vcam_rgb_to_chroma(x, r, g, b);
+        break;
+    default:
+        c = vcam_rgb_to_chroma(x, r, g, b);
+        if (fourcc == V4L2_PIX_FMT_UYVY) {
+            row[x * 2]     = c;
+            row[x * 2 + 1] = y;
+        } else {
+            row[x * 2]     = y;
+            row[x * 2 + 1] = c;
+        }
+        break;
+    }
+}
+
+/**
+ * 生成彩条或渐变的一行, 随sequence横向滚动, 亮度调节作用于RGB三个分量。
+ */
+static void vcam_build_pattern_row(struct vcam_device *dev, int pattern, u32 seq, int brightness)
+{
+    static const unsigned char bars[8][3] = {
+        { 255, 255, 255 }, { 255, 255, 0 }, { 0, 255, 255 }, { 0, 255, 0 },
+        { 255, 0, 255 },   { 255, 0, 0 },   { 0, 0, 255 },   { 0, 0, 0 },
+    };
+    int width = dev->fmt.width;
+    int delta = brightness - 128;
+    int shift, x, pos, r, g, b;
+
+    shift = (int)(seq * (pattern == VCAM_PATTERN_BARS ? 4 : 2) % width);
+    for (x = 0; x < width; x++) {
+        pos = (x + shift) % width;
+        if (pattern == VCAM_PATTERN_BARS) {
+            const unsigned char *c = bars[pos * 8 / width];
+            r = c[0]; g = c[1]; b = c[2];
+        } else {
+            r = g = b = pos * 256 / width;
+        }
+        vcam_put_rgb(dev->pattern_row, dev->pattern_row + width, dev->fmt.pixelformat, x,
+                     clamp(r + delta, 0, 255), clamp(g + delta, 0, 255), clamp(b + delta, 0, 255));
+    }
+}
+
+/**
+ * 在左上角画帧标记, 画面太小放不下时不画。
+ */
+static void vcam_draw_stamp(struct vcam_device *dev, unsigned char *buf, u32 seq, u64 ts)
+{
+    const struct v4l2_pix_format *fmt = &dev->fmt;
+    unsigned char *chroma = NULL;
+    u16 words[8];
+    int bit, x, y, cx, cy, on;
+
+    if (fmt->width < VCAM_STAMP_COLS * VCAM_STAMP_CELL ||
+        fmt->height < VCAM_STAMP_ROWS * VCAM_STAMP_CELL)
+        return;
+    if (dev->vfmt->chroma_ydiv)
+        chroma = buf + (size_t)fmt->bytesperline * fmt->height;
+
+    words[0] = VCAM_STAMP_MAGIC;
+    words[1] = seq >> 16;
+    words[2] = seq;
+    words[3] = ts >> 48;
+    words[4] = ts >> 32;
+    words[5] = ts >> 16;
+    words[6] = ts;
+    words[7] = (words[1] ^ words[2] ^ words[3] ^ words[4] ^ words[5] ^ words[6]) ^ 0xA5A5;
+
+    for (bit = 0; bit < VCAM_STAMP_COLS * VCAM_STAMP_ROWS; bit++) {
+        on = (words[bit / 16] >> (15 - bit % 16)) & 1;
+        cx = (bit % VCAM_STAMP_COLS) * VCAM_STAMP_CELL;
+        cy = (bit / VCAM_STAMP_COLS) * VCAM_STAMP_CELL;
+        for (y = cy; y < cy + VCAM_STAMP_CELL; y++) {
+            unsigned char *row = buf + (size_t)y * fmt->bytesperline;
+            unsigned char *crow = chroma ?
+                chroma + (size_t)(y / dev->vfmt->chroma_ydiv) * fmt->bytesperline : NULL;
+            for (x = cx; x < cx + VCAM_STAMP_CELL; x++)
+                vcam_put_rgb(row, crow, fmt->pixelformat, x, on ? 255 : 0, on ? 255 : 0, on ? 255 : 0);
+        }
+    }
+}
+
+/**
+ * 按当前测试图案和格式填充整帧。
+ */
+static void vcam_fill_buffer(struct vcam_device *dev, void *ptr, u32 seq, u64 ts)
+{
+    const struct v4l2_pix_format *fmt = &dev->fmt;
+    int brightness = READ_ONCE(dev->brightness);
+    int pattern = READ_ONCE(dev->test_pattern);
+    int color_type = (seq % 180) / 60; // 颜色每60帧切换一次
+    struct vcam_template *tpl = &dev->templates[color_type];
+
+    if (pattern == VCAM_PATTERN_SOLID) {
+        if (tpl->brightness != brightness || tpl->fourcc != fmt->pixelformat ||
+            tpl->width != fmt->width)
+            vcam_build_template(tpl, dev->vfmt, fmt->width, color_type, brightness);
+        vcam_replicate_frame(dev, ptr, tpl->row);
+        return;
+    }
+
+    vcam_build_pattern_row(dev, pattern, seq, brightness);
+    vcam_replicate_frame(dev, ptr, dev->pattern_row);
+    vcam_draw_stamp(dev, ptr, seq, ts);
 }
 
 static struct vcam_frame_buf *vcam_get_next_buf(struct vcam_device *dev)
@@ -97,35 +421,94 @@ static struct vcam_frame_buf *vcam_get_next_buf(struct vcam_device *dev)
     return buf;
 }
 
-static void vcam_timer_expire(struct timer_list *t)
+/* 在工作队列(进程上下文)里生成一帧, 定时器只负责节拍 */
+static void vcam_frame_work(struct work_struct *work)
 {
-    struct vcam_device *dev = from_timer(dev, t, timer);
+    struct vcam_device *dev = container_of(work, struct vcam_device, frame_work);
     struct vcam_frame_buf *buf;
     void *ptr;
+    u32 seq, again;
+    u64 ts;
+
+    /*
+     * 取最新的节拍作为这一帧的序号, 之前被合并掉的节拍成为空洞;
+     * 采集时间用这个节拍的定时器到期时刻, 不受工作队列调度延迟影响。
+     * 读的过程中又来了节拍时重读, 保证序号和时间属于同一拍。
+     */
+    do {
+        again = (u32)atomic_read(&dev->ticks);
+        smp_rmb();
+        ts = (u64)atomic64_read(&dev->tick_ns);
+        smp_rmb();
+        seq = (u32)atomic_read(&dev->ticks);
+    } while (seq != again);
+    seq -= 1;
 
     buf = vcam_get_next_buf(dev);
-    if (buf) {
-        ptr = vb2_plane_vaddr(&buf->vb.vb2_buf, 0);
-        // 将当前亮度值传递给填充函数
-        fill_yuyv_buffer(ptr, dev->copy_cnt / 60, dev->brightness);
-
-        vb2_set_plane_payload(&buf->vb.vb2_buf, 0, IMAGE_SIZE);
-        buf->vb.vb2_buf.timestamp = ktime_get_ns();
-        vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_DONE);
+    if (!buf) {
+        dev->drop_nobuf++;
+        return;
     }
 
-    dev->copy_cnt = (dev->copy_cnt + 1) % 180;
-    mod_timer(&dev->timer, jiffies + HZ / 30);
+    /* 帧标记和vb2时间戳用同一个值 */
+    ptr = vb2_plane_vaddr(&buf->vb.vb2_buf, 0);
+    vcam_fill_buffer(dev, ptr, seq, ts);
+
+    vb2_set_plane_payload(&buf->vb.vb2_buf, 0, dev->fmt.sizeimage);
+    buf->vb.field = V4L2_FIELD_NONE;
+    buf->vb.sequence = seq;
+    buf->vb.vb2_buf.timestamp = ts;
+    vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_DONE);
+    dev->frames_done++;
+}
+
+static enum hrtimer_restart vcam_timer_expire(struct hrtimer *t)
+{
+    struct vcam_device *dev = container_of(t, struct vcam_device, frame_timer);
+    ktime_t period = READ_ONCE(dev->frame_period);
+    ktime_t expires = hrtimer_get_expires(t);
+    u64 overrun;
+
+    /* 截止时间按整周期往后推, 回调被推迟时overrun>1, 错过的节拍也要占sequence */
+    overrun = hrtimer_forward_now(t, period);
+    if (overrun == 0)
+        overrun = 1;
+    if (overrun > 1) {
+        atomic_add((int)(overrun - 1), &dev->drop_late);
+        /* 最新一拍是错过的节拍之后的那一个 */
+        expires = ktime_add_ns(expires, ktime_to_ns(period) * (overrun - 1));
+    }
+    atomic64_set(&dev->tick_ns, ktime_to_ns(expires));
+    smp_wmb();
+    atomic_add((int)overrun, &dev->ticks);
+
+    /* 上一帧还没生成完时queue_work直接返回, 这一拍合并到下一帧 */
+    if (!queue_work(dev->wq, &dev->frame_work))
+        atomic_inc(&dev->drop_busy);
+    return HRTIMER_RESTART;
 }
 
 static int vcam_queue_setup(struct vb2_queue *vq,
                             unsigned int *nbuffers, unsigned int *nplanes,
                             unsigned int sizes[], struct device *alloc_devs[])
 {
+    struct vcam_device *dev = vb2_get_drv_priv(vq);
+
+    /* 缓冲区大小按当前格式计算; CREATE_BUFS带来的大小不能小于一帧 */
     if (*nplanes)
-        return sizes[0] < IMAGE_SIZE ? -EINVAL : 0;
+        return sizes[0] < dev->fmt.sizeimage ? -EINVAL : 0;
     *nplanes = 1;
-    sizes[0] = IMAGE_SIZE;
+    sizes[0] = dev->fmt.sizeimage;
+    return 0;
+}
+
+/* USERPTR或CREATE_BUFS的缓冲区可能是按别的格式分配的, 入队前检查大小 */
+static int vcam_buf_prepare(struct vb2_buffer *vb)
+{
+    struct vcam_device *dev = vb2_get_drv_priv(vb->vb2_queue);
+
+    if (vb2_plane_size(vb, 0) < dev->fmt.sizeimage)
+        return -EINVAL;
     return 0;
 }
 
@@ -143,7 +526,15 @@ static void vcam_buf_queue(struct vb2_buffer *vb)
 static int vcam_start_streaming(struct vb2_queue *vq, unsigned int count)
 {
     struct vcam_device *dev = vb2_get_drv_priv(vq);
-    mod_timer(&dev->timer, jiffies + HZ / 30);
+
+    atomic_set(&dev->ticks, 0);
+    atomic64_set(&dev->tick_ns, 0);
+    atomic_set(&dev->drop_late, 0);
+    atomic_set(&dev->drop_busy, 0);
+    dev->frames_done = 0;
+    dev->drop_nobuf = 0;
+    hrtimer_start(&dev->frame_timer, ktime_add(ktime_get(), dev->frame_period),
+                  HRTIMER_MODE_ABS);
     return 0;
 }
 
@@ -151,7 +542,11 @@ static void vcam_stop_streaming(struct vb2_queue *vq)
 {
     struct vcam_device *dev = vb2_get_drv_priv(vq);
     unsigned long flags;
-    del_timer_sync(&dev->timer);
+    hrtimer_cancel(&dev->frame_timer);
+    cancel_work_sync(&dev->frame_work);
+    pr_info("%s: 共%d个节拍, 交付%u帧, 丢帧: 无空闲缓冲区%u, 生成来不及%d, 定时器延误%d\n",
+            video_device_node_name(&dev->vdev), atomic_read(&dev->ticks), dev->frames_done, dev->drop_nobuf,
+            atomic_read(&dev->drop_busy), atomic_read(&dev->drop_late));
     spin_lock_irqsave(&dev->queued_lock, flags);
     while (!list_empty(&dev->queued_bufs)) {
         struct vcam_frame_buf *buf;
@@ -164,51 +559,243 @@ static void vcam_stop_streaming(struct vb2_queue *vq)
 
 static const struct vb2_ops vcam_vb2_ops = {
     .queue_setup     = vcam_queue_setup,
+    .buf_prepare     = vcam_buf_prepare,
     .buf_queue       = vcam_buf_queue,
     .start_streaming = vcam_start_streaming,
     .stop_streaming  = vcam_stop_streaming,
+    /* 6.13起vb_queue.lock设置了时vb2自己释放/重新获取它, 这两个回调随后被移除 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
     .wait_prepare    = vb2_ops_wait_prepare,
     .wait_finish     = vb2_ops_wait_finish,
+#endif
 };
 
 static int vcam_querycap(struct file *file, void *priv, struct v4l2_capability *cap)
 {
+    struct vcam_device *dev = video_drvdata(file);
+
+    /* bus_info带上平台设备名(vcam_plat.N), 多个实例可以区分开 */
     strscpy(cap->driver, "V4L2 Virtual Cam", sizeof(cap->driver));
-    strscpy(cap->card, "V4L2 Virtual Cam", sizeof(cap->card));
-    snprintf(cap->bus_info, sizeof(cap->bus_info), "platform:%s", DRIVER_NAME);
-    cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING | V4L2_CAP_READWRITE;
+    snprintf(cap->card, sizeof(cap->card), "V4L2 Virtual Cam %s", dev_name(dev->v4l2_dev.dev));
+    snprintf(cap->bus_info, sizeof(cap->bus_info), "platform:%s", dev_name(dev->v4l2_dev.dev));
+    cap->device_caps = dev->vdev.device_caps;
     cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
     return 0;
 }
 
 static int vcam_enum_fmt_vid_cap(struct file *file, void *priv, struct v4l2_fmtdesc *f)
 {
-    if (f->index > 0) return -EINVAL;
-    strscpy(f->description, "YUYV 4:2:2", sizeof(f->description));
-    f->pixelformat = V4L2_PIX_FMT_YUYV;
+    if (f->index >= ARRAY_SIZE(vcam_formats)) return -EINVAL;
+    strscpy(f->description, vcam_formats[f->index].desc, sizeof(f->description));
+    f->pixelformat = vcam_formats[f->index].fourcc;
+    return 0;
+}
+
+/* 不支持的格式退回YUYV, 尺寸限制在范围内, 宽度取偶数, NV12高度也取偶数 */
+static void vcam_try_pix(struct v4l2_pix_format *pix)
+{
+    const struct vcam_format *vfmt = vcam_find_format(pix->pixelformat);
+
+    if (!vfmt)
+        vfmt = &vcam_formats[0];
+    pix->pixelformat  = vfmt->fourcc;
+    pix->width        = clamp_t(u32, pix->width, VCAM_MIN_WIDTH, VCAM_MAX_WIDTH) & ~1u;
+    pix->height       = clamp_t(u32, pix->height, VCAM_MIN_HEIGHT, VCAM_MAX_HEIGHT);
+    if (vfmt->chroma_ydiv == 2)
+        pix->height &= ~1u;
+    pix->field        = V4L2_FIELD_NONE;
+    pix->bytesperline = pix->width * vfmt->bpp;
+    pix->sizeimage    = vcam_sizeimage(vfmt, pix->bytesperline, pix->height);
+    pix->colorspace   = vfmt->fourcc == V4L2_PIX_FMT_RGB24 ? V4L2_COLORSPACE_SRGB
+                                                          : V4L2_COLORSPACE_SMPTE170M;
+    pix->priv         = 0;
+}
+
+static int vcam_set_pix(struct vcam_device *dev, struct v4l2_pix_format *pix)
+{
+    /* 已经申请了缓冲区就不能再改格式 */
+    if (vb2_is_busy(&dev->vb_queue))
+        return -EBUSY;
+    vcam_try_pix(pix);
+    dev->fmt = *pix;
+    dev->vfmt = vcam_find_format(dev->fmt.pixelformat);
     return 0;
 }
 
+/* 单平面API的格式ioctl, 设备工作在多平面模式时拒绝 */
 static int vcam_g_fmt_vid_cap(struct file *file, void *priv, struct v4l2_format *f)
 {
-    f->fmt.pix.width        = IMAGE_WIDTH;
-    f->fmt.pix.height       = IMAGE_HEIGHT;
-    f->fmt.pix.pixelformat  = V4L2_PIX_FMT_YUYV;
-    f->fmt.pix.field        = V4L2_FIELD_NONE;
-    f->fmt.pix.bytesperline = IMAGE_WIDTH * 2;
-    f->fmt.pix.sizeimage    = IMAGE_SIZE;
+    struct vcam_device *dev = video_drvdata(file);
+
+    if (dev->vb_queue.type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        return -EINVAL;
+    f->fmt.pix = dev->fmt;
+    return 0;
+}
+
+static int vcam_try_fmt_vid_cap(struct file *file, void *priv, struct v4l2_format *f)
+{
+    struct vcam_device *dev = video_drvdata(file);
+
+    if (dev->vb_queue.type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        return -EINVAL;
+    vcam_try_pix(&f->fmt.pix);
     return 0;
 }
 
 static int vcam_s_fmt_vid_cap(struct file *file, void *priv, struct v4l2_format *f)
 {
-    return vcam_g_fmt_vid_cap(file, priv, f);
+    struct vcam_device *dev = video_drvdata(file);
+
+    if (dev->vb_queue.type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        return -EINVAL;
+    return vcam_set_pix(dev, &f->fmt.pix);
 }
 
+/* 多平面API与单平面共用同一份格式, 只是换一种描述方式, num_planes固定为1 */
+static void vcam_pix_to_mp(const struct v4l2_pix_format *pix, struct v4l2_pix_format_mplane *mp)
+{
+    memset(mp, 0, sizeof(*mp));
+    mp->width        = pix->width;
+    mp->height       = pix->height;
+    mp->pixelformat  = pix->pixelformat;
+    mp->field        = pix->field;
+    mp->colorspace   = pix->colorspace;
+    mp->num_planes   = 1;
+    mp->plane_fmt[0].bytesperline = pix->bytesperline;
+    mp->plane_fmt[0].sizeimage    = pix->sizeimage;
+}
+
+static void vcam_mp_to_pix(const struct v4l2_pix_format_mplane *mp, struct v4l2_pix_format *pix)
+{
+    memset(pix, 0, sizeof(*pix));
+    pix->width       = mp->width;
+    pix->height      = mp->height;
+    pix->pixelformat = mp->pixelformat;
+}
+
+static int vcam_g_fmt_vid_cap_mplane(struct file *file, void *priv, struct v4l2_format *f)
+{
+    struct vcam_device *dev = video_drvdata(file);
+
+    if (dev->vb_queue.type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+        return -EINVAL;
+    vcam_pix_to_mp(&dev->fmt, &f->fmt.pix_mp);
+    return 0;
+}
+
+static int vcam_try_fmt_vid_cap_mplane(struct file *file, void *priv, struct v4l2_format *f)
+{
+    struct vcam_device *dev = video_drvdata(file);
+    struct v4l2_pix_format pix;
+
+    if (dev->vb_queue.type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+        return -EINVAL;
+    vcam_mp_to_pix(&f->fmt.pix_mp, &pix);
+    vcam_try_pix(&pix);
+    vcam_pix_to_mp(&pix, &f->fmt.pix_mp);
+    return 0;
+}
+
+static int vcam_s_fmt_vid_cap_mplane(struct file *file, void *priv, struct v4l2_format *f)
+{
+    struct vcam_device *dev = video_drvdata(file);
+    struct v4l2_pix_format pix;
+    int ret;
+
+    if (dev->vb_queue.type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+        return -EINVAL;
+    vcam_mp_to_pix(&f->fmt.pix_mp, &pix);
+    ret = vcam_set_pix(dev, &pix);
+    if (ret)
+        return ret;
+    vcam_pix_to_mp(&pix, &f->fmt.pix_mp);
+    return 0;
+}
+
+static int vcam_enum_framesizes(struct file *file, void *priv, struct v4l2_frmsizeenum *fsize)
+{
+    const struct vcam_format *vfmt = vcam_find_format(fsize->pixel_format);
+
+    if (fsize->index != 0 || !vfmt)
+        return -EINVAL;
+    fsize->type = V4L2_FRMSIZE_TYPE_STEPWISE;
+    fsize->stepwise.min_width   = VCAM_MIN_WIDTH;
+    fsize->stepwise.max_width   = VCAM_MAX_WIDTH;
+    fsize->stepwise.step_width  = 2;
+    fsize->stepwise.min_height  = VCAM_MIN_HEIGHT;
+    fsize->stepwise.max_height  = VCAM_MAX_HEIGHT;
+    /* 与vcam_try_pix一致: 4:2:0格式的高度会被取成偶数 */
+    fsize->stepwise.step_height = vfmt->chroma_ydiv == 2 ? 2 : 1;
+    return 0;
+}
+
+static int vcam_enum_frameintervals(struct file *file, void *priv, struct v4l2_frmivalenum *fival)
+{
+    if (fival->index >= ARRAY_SIZE(vcam_fps_list) || !vcam_find_format(fival->pixel_format))
+        return -EINVAL;
+    if (fival->width < VCAM_MIN_WIDTH || fival->width > VCAM_MAX_WIDTH ||
+        fival->height < VCAM_MIN_HEIGHT || fival->height > VCAM_MAX_HEIGHT)
+        return -EINVAL;
+    fival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+    fival->discrete.numerator = 1;
+    fival->discrete.denominator = vcam_fps_list[fival->index];
+    return 0;
+}
+
+static int vcam_g_parm(struct file *file, void *priv, struct v4l2_streamparm *parm)
+{
+    struct vcam_device *dev = video_drvdata(file);
+
+    if (parm->type != dev->vb_queue.type)
+        return -EINVAL;
+    memset(&parm->parm.capture, 0, sizeof(parm->parm.capture));
+    parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+    parm->parm.capture.timeperframe = dev->timeperframe;
+    parm->parm.capture.readbuffers = 2;
+    return 0;
+}
+
+/* 帧率限制在1~240, 流开启时也可以修改, 下一个节拍起生效 */
+static int vcam_s_parm(struct file *file, void *priv, struct v4l2_streamparm *parm)
+{
+    struct vcam_device *dev = video_drvdata(file);
+    struct v4l2_fract *tpf = &parm->parm.capture.timeperframe;
+    u64 period;
+
+    if (parm->type != dev->vb_queue.type)
+        return -EINVAL;
+    if (tpf->numerator == 0 || tpf->denominator == 0) {
+        tpf->numerator = 1;
+        tpf->denominator = VCAM_DEF_FPS;
+    }
+    if ((u64)tpf->denominator > (u64)tpf->numerator * VCAM_MAX_FPS) {
+        tpf->numerator = 1;
+        tpf->denominator = VCAM_MAX_FPS;
+    } else if (tpf->numerator > tpf->denominator) {
+        tpf->numerator = 1;
+        tpf->denominator = 1;
+    }
+    period = div_u64((u64)NSEC_PER_SEC * tpf->numerator, tpf->denominator);
+
+    dev->timeperframe = *tpf;
+    WRITE_ONCE(dev->frame_period, ns_to_ktime(period));
+    return vcam_g_parm(file, priv, parm);
+}
 
 static int vcam_queryctrl(struct file *file, void *priv, struct v4l2_queryctrl *qc)
 {
-    // 只支持亮度控制
+    // 支持亮度和测试图案两个控制项
+    if (qc->id == V4L2_CID_TEST_PATTERN) {
+        qc->type = V4L2_CTRL_TYPE_MENU;
+        strscpy(qc->name, "Test Pattern", sizeof(qc->name));
+        qc->minimum = 0;
+        qc->maximum = VCAM_PATTERN_COUNT - 1;
+        qc->step = 1;
+        qc->default_value = VCAM_PATTERN_SOLID;
+        qc->flags = 0;
+        return 0;
+    }
     if (qc->id == V4L2_CID_BRIGHTNESS) {
         qc->type = V4L2_CTRL_TYPE_INTEGER;
         strscpy(qc->name, "Brightness", sizeof(qc->name));
@@ -222,6 +809,14 @@ static int vcam_queryctrl(struct file *file, void *priv, struct v4l2_queryctrl *
     return -EINVAL;
 }
 
+static int vcam_querymenu(struct file *file, void *priv, struct v4l2_querymenu *qm)
+{
+    if (qm->id != V4L2_CID_TEST_PATTERN || qm->index >= VCAM_PATTERN_COUNT)
+        return -EINVAL;
+    strscpy(qm->name, vcam_pattern_names[qm->index], sizeof(qm->name));
+    return 0;
+}
+
 static int vcam_g_ctrl(struct file *file, void *priv, struct v4l2_control *ctrl)
 {
     // 获取与此文件实例关联的设备私有数据
@@ -231,6 +826,10 @@ static int vcam_g_ctrl(struct file *file, void *priv, struct v4l2_control *ctrl)
         ctrl->value = dev->brightness;
         return 0;
     }
+    if (ctrl->id == V4L2_CID_TEST_PATTERN) {
+        ctrl->value = dev->test_pattern;
+        return 0;
+    }
     return -EINVAL;
 }
 
@@ -239,7 +838,13 @@ static int vcam_s_ctrl(struct file *file, void *priv, struct v4l2_control *ctrl)
     struct vcam_device *dev = video_drvdata(file);
 
     if (ctrl->id == V4L2_CID_BRIGHTNESS) {
-        dev->brightness = clamp(ctrl->value, 0, 255);
+        WRITE_ONCE(dev->brightness, clamp(ctrl->value, 0, 255));
+        return 0;
+    }
+    if (ctrl->id == V4L2_CID_TEST_PATTERN) {
+        if (ctrl->value < 0 || ctrl->value >= VCAM_PATTERN_COUNT)
+            return -ERANGE;
+        WRITE_ONCE(dev->test_pattern, ctrl->value);
         return 0;
     }
     return -EINVAL;
@@ -251,15 +856,29 @@ static const struct v4l2_ioctl_ops vcam_ioctl_ops = {
     .vidioc_enum_fmt_vid_cap = vcam_enum_fmt_vid_cap,
     .vidioc_g_fmt_vid_cap = vcam_g_fmt_vid_cap,
     .vidioc_s_fmt_vid_cap = vcam_s_fmt_vid_cap,
-    .vidioc_try_fmt_vid_cap = vcam_s_fmt_vid_cap,
+    .vidioc_try_fmt_vid_cap = vcam_try_fmt_vid_cap,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
+    .vidioc_enum_fmt_vid_cap_mplane = vcam_enum_fmt_vid_cap,
+#endif
+    .vidioc_g_fmt_vid_cap_mplane = vcam_g_fmt_vid_cap_mplane,
+    .vidioc_s_fmt_vid_cap_mplane = vcam_s_fmt_vid_cap_mplane,
+    .vidioc_try_fmt_vid_cap_mplane = vcam_try_fmt_vid_cap_mplane,
+    .vidioc_enum_framesizes = vcam_enum_framesizes,
+    .vidioc_enum_frameintervals = vcam_enum_frameintervals,
+    .vidioc_g_parm        = vcam_g_parm,
+    .vidioc_s_parm        = vcam_s_parm,
 
     /* 将控制项相关的ioctl注册到“分机号列表”中 */
     .vidioc_queryctrl     = vcam_queryctrl,
+    .vidioc_querymenu     = vcam_querymenu,
     .vidioc_g_ctrl        = vcam_g_ctrl,
     .vidioc_s_ctrl        = vcam_s_ctrl,
 
     .vidioc_reqbufs       = vb2_ioctl_reqbufs,
+    .vidioc_create_bufs   = vb2_ioctl_create_bufs,    /*运行中追加缓冲区*/
     .vidioc_querybuf      = vb2_ioctl_querybuf,
+    .vidioc_expbuf        = vb2_ioctl_expbuf,         /*把MMAP缓冲区导出为dma-buf*/
+    .vidioc_prepare_buf   = vb2_ioctl_prepare_buf,
     .vidioc_qbuf          = vb2_ioctl_qbuf,
     .vidioc_dqbuf         = vb2_ioctl_dqbuf,
     .vidioc_streamon      = vb2_ioctl_streamon,
@@ -281,8 +900,9 @@ static int vcam_probe(struct platform_device *pdev)
     struct vcam_device *dev;
     struct video_device *vdev;
     int ret;
+    int i;
 
-    pr_info("vcam_probe: 发现平台设备 '%s'，开始初始化驱动...\n", pdev->name);
+    pr_info("vcam_probe: 发现平台设备 '%s'，开始初始化驱动...\n", dev_name(&pdev->dev));
 
     dev = kzalloc(sizeof(*dev), GFP_KERNEL);
     if (!dev) return -ENOMEM;
@@ -293,13 +913,53 @@ static int vcam_probe(struct platform_device *pdev)
     mutex_init(&dev->lock);
     spin_lock_init(&dev->queued_lock);
     INIT_LIST_HEAD(&dev->queued_bufs);
-    timer_setup(&dev->timer, vcam_timer_expire, 0);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(&dev->frame_timer, vcam_timer_expire, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+#else
+    hrtimer_init(&dev->frame_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    dev->frame_timer.function = vcam_timer_expire;
+#endif
+    dev->timeperframe.numerator = 1;
+    dev->timeperframe.denominator = VCAM_DEF_FPS;
+    dev->frame_period = ns_to_ktime(NSEC_PER_SEC / VCAM_DEF_FPS);
+    INIT_WORK(&dev->frame_work, vcam_frame_work);
+
+    /* 默认格式 800x600 YUYV */
+    dev->fmt.width = VCAM_DEF_WIDTH;
+    dev->fmt.height = VCAM_DEF_HEIGHT;
+    dev->fmt.pixelformat = V4L2_PIX_FMT_YUYV;
+    dev->vfmt = &vcam_formats[0];
+    dev->fmt.field = V4L2_FIELD_NONE;
+    dev->fmt.bytesperline = VCAM_DEF_WIDTH * dev->vfmt->bpp;
+    dev->fmt.sizeimage = vcam_sizeimage(dev->vfmt, dev->fmt.bytesperline, VCAM_DEF_HEIGHT);
+    dev->fmt.colorspace = V4L2_COLORSPACE_SMPTE170M;
+
+    dev->pattern_row = kmalloc(VCAM_MAX_WIDTH * VCAM_MAX_BPP, GFP_KERNEL);
+    if (!dev->pattern_row) {
+        ret = -ENOMEM;
+        goto free_templates;
+    }
+    for (i = 0; i < VCAM_COLORS; i++) {
+        dev->templates[i].brightness = -1;
+        dev->templates[i].row = kmalloc(VCAM_MAX_WIDTH * VCAM_MAX_BPP, GFP_KERNEL);
+        if (!dev->templates[i].row) {
+            ret = -ENOMEM;
+            goto free_templates;
+        }
+    }
+
+    /* 有序队列保证帧按顺序生成, WQ_HIGHPRI减少调度延迟 */
+    dev->wq = alloc_ordered_workqueue("vcam_frame.%s", WQ_HIGHPRI, dev_name(&pdev->dev));
+    if (!dev->wq) {
+        ret = -ENOMEM;
+        goto free_templates;
+    }
 
     ret = v4l2_device_register(&pdev->dev, &dev->v4l2_dev);
-    if (ret) goto free_dev;
+    if (ret) goto destroy_wq;
 
-    dev->vb_queue.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    dev->vb_queue.io_modes = VB2_MMAP | VB2_USERPTR | VB2_READ;
+    dev->vb_queue.type = multiplanar ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    dev->vb_queue.io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF | VB2_READ;
     dev->vb_queue.drv_priv = dev;
     dev->vb_queue.buf_struct_size = sizeof(struct vcam_frame_buf);
     dev->vb_queue.ops = &vcam_vb2_ops;
@@ -310,7 +970,7 @@ static int vcam_probe(struct platform_device *pdev)
     if (ret) goto unreg_v4l2_dev;
 
     vdev = &dev->vdev;
-    strscpy(vdev->name, "VirtualCam_Platform", sizeof(vdev->name));
+    snprintf(vdev->name, sizeof(vdev->name), "VirtualCam %s", dev_name(&pdev->dev));
     vdev->fops = &vcam_fops;
     vdev->ioctl_ops = &vcam_ioctl_ops;
     vdev->v4l2_dev = &dev->v4l2_dev;
@@ -319,7 +979,8 @@ static int vcam_probe(struct platform_device *pdev)
     vdev->release = video_device_release_empty;
     video_set_drvdata(vdev, dev);
     
-    vdev->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING | V4L2_CAP_READWRITE;
+    vdev->device_caps = (multiplanar ? V4L2_CAP_VIDEO_CAPTURE_MPLANE : V4L2_CAP_VIDEO_CAPTURE) |
+                        V4L2_CAP_STREAMING | V4L2_CAP_READWRITE;
 
     ret = video_register_device(vdev, VFL_TYPE_VIDEO, -1);
     if (ret) {
@@ -333,20 +994,38 @@ static int vcam_probe(struct platform_device *pdev)
 
 unreg_v4l2_dev:
     v4l2_device_unregister(&dev->v4l2_dev);
-free_dev:
+destroy_wq:
+    destroy_workqueue(dev->wq);
+free_templates:
+    for (i = 0; i < VCAM_COLORS; i++)
+        kfree(dev->templates[i].row);
+    kfree(dev->pattern_row);
     kfree(dev);
     pr_err("vcam_probe 失败\n");
     return ret;
 }
 
+/* 6.11起platform_driver的remove回调不再返回值 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+static void vcam_remove(struct platform_device *pdev)
+#else
 static int vcam_remove(struct platform_device *pdev)
+#endif
 {
     struct vcam_device *dev = platform_get_drvdata(pdev);
+    int i;
+
     pr_info("vcam_remove: 卸载设备 %s\n", video_device_node_name(&dev->vdev));
     video_unregister_device(&dev->vdev);
     v4l2_device_unregister(&dev->v4l2_dev);
+    destroy_workqueue(dev->wq);
+    for (i = 0; i < VCAM_COLORS; i++)
+        kfree(dev->templates[i].row);
+    kfree(dev->pattern_row);
     kfree(dev);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
     return 0;
+#endif
 }
 
 static struct platform_driver vcam_pdrv = {
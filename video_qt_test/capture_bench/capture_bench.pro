@@ -0,0 +1,53 @@
+QT += core gui
+QT -= widgets
+
+CONFIG += console c++17
+CONFIG -= app_bundle
+
+TARGET = capture_bench
+
+# 采集相关的代码直接用untitled里的, 不依赖界面
+UNTITLED = ../untitled
+INCLUDEPATH += $$UNTITLED
+DEPENDPATH += $$UNTITLED
+
+SOURCES += \
+    main.cpp \
+    $$UNTITLED/capturemanager.cpp \
+    $$UNTITLED/capturemode.cpp \
+    $$UNTITLED/framearena.cpp \
+    $$UNTITLED/framehandle.cpp \
+    $$UNTITLED/framepool.cpp \
+    $$UNTITLED/imagescale.cpp \
+    $$UNTITLED/jpegyuv.cpp \
+    $$UNTITLED/latencystats.cpp \
+    $$UNTITLED/mjpegdecoder.cpp \
+    $$UNTITLED/replaysource.cpp \
+    $$UNTITLED/stripepool.cpp \
+    $$UNTITLED/v4l2camera.cpp \
+    $$UNTITLED/v4l2source.cpp \
+    $$UNTITLED/yuvconvert.cpp
+
+HEADERS += \
+    $$UNTITLED/capturemanager.h \
+    $$UNTITLED/capturemode.h \
+    $$UNTITLED/framearena.h \
+    $$UNTITLED/framehandle.h \
+    $$UNTITLED/framepool.h \
+    $$UNTITLED/framesource.h \
+    $$UNTITLED/imagescale.h \
+    $$UNTITLED/jpegyuv.h \
+    $$UNTITLED/latencystats.h \
+    $$UNTITLED/mjpegdecoder.h \
+    $$UNTITLED/replaysource.h \
+    $$UNTITLED/stripepool.h \
+    $$UNTITLED/v4l2camera.h \
+    $$UNTITLED/v4l2source.h \
+    $$UNTITLED/yuvconvert.h
+
+# 编码阶段直接从YUV编码JPEG, 使用libjpeg-turbo
+LIBS += -ljpeg
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
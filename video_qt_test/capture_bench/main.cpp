@@ -0,0 +1,762 @@
+#include <QImage>
+#include <QString>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "capturemanager.h"
+#include "capturemode.h"
+#include "framehandle.h"
+#include "framepool.h"
+#include "imagescale.h"
+#include "jpegyuv.h"
+#include "latencystats.h"
+#include "mjpegdecoder.h"
+#include "replaysource.h"
+#include "stripepool.h"
+#include "v4l2source.h"
+
+/*
+ * 无界面的采集基准测试
+ * 从V4L2设备或回放文件(FrameSource)连续取N秒帧, 可以只出队, 也可以依次打开转换、缩放、编码各阶段,
+ * 全部在同一个线程里同步执行, 每帧的各阶段耗时、CPU时间和驱动时间戳算起的
+ * 端到端延迟记进直方图, 结束后输出JSON, 方便比较不同板子和不同编译选项。
+ * -m 同时采集多个设备, 全部由一个CaptureManager线程用epoll服务, 检查单线程能带几路。
+ */
+
+enum StageFlag {
+    StageConvert = 1,
+    StageScale   = 2,
+    StageEncode  = 4
+};
+
+struct Options {
+    const char *device = "/dev/video1";
+    int width = 640;
+    int height = 480;
+    double fps = 30.0;
+    double seconds = 10.0;
+    int warmup = 10;                /*开头丢掉不统计的帧数*/
+    int stages = StageConvert;
+    int scaleWidth = 0;             /*缩放目标, 0表示源尺寸的一半*/
+    int scaleHeight = 0;
+    int quality = 90;
+    V4L2Camera::IoMode io = V4L2Camera::IoMmap;
+    unsigned int buffers = 4;
+    const char *output = nullptr;   /*JSON输出文件, 为空时写到标准输出*/
+    const char *replay = nullptr;   /*不为空时回放录好的帧文件, 不打开设备*/
+    bool unpaced = false;           /*回放时不按帧率定时, 尽快出帧*/
+    unsigned int loops = 0;         /*回放几遍, 0为一直循环到测试时间结束*/
+    const char *multi = nullptr;    /*不为空时是逗号分隔的设备列表, 用CaptureManager同时采集*/
+};
+
+/*驱动sequence不连续时记下缺的序号, 太多时只保留前面一部分*/
+static const size_t MaxDroppedList = 256;
+
+struct BenchResult {
+    LatencyHistogram dequeue;       /*驱动时间戳 -> 出队*/
+    LatencyHistogram convert;
+    LatencyHistogram scale;
+    LatencyHistogram encode;
+    LatencyHistogram total;         /*驱动时间戳 -> 所有阶段完成*/
+    LatencyHistogram cpu;           /*每帧处理消耗的CPU时间, 含条带工作线程的部分*/
+    uint64_t frames = 0;
+    uint64_t encodeFailed = 0;
+    uint64_t droppedCount = 0;
+    std::vector<uint32_t> dropped;
+    int64_t firstNs = 0;
+    int64_t lastNs = 0;
+    int64_t cpuNs = 0;              /*统计区间内本线程加条带工作线程的CPU时间, 包括等帧的时间*/
+    int64_t stripeCpuNs = 0;        /*其中条带工作线程的部分*/
+    int64_t processCpuNs = 0;       /*统计区间内整个进程的CPU时间*/
+    FramePool::Stats scalePool;
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void onSignal(int)
+{
+    g_stop = 1;
+}
+
+/*
+ * 每帧的CPU时间是测试线程自己的加上它发起的条带任务在工作线程上执行的时间:
+ * 条带工作线程做完一帧后会先自旋一会儿再睡眠, 用进程CPU时间会把这段空转算进每一帧,
+ * 而且和帧里的实际工作量无关。进程CPU时间只用来算整体占用率(processCpuNow), 那里包含工作线程的自旋。
+ */
+static int64_t clockNs(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t cpuNow()
+{
+    return clockNs(CLOCK_THREAD_CPUTIME_ID) + StripePool::chargedCpuNs();
+}
+
+static int64_t processCpuNow()
+{
+    return clockNs(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "用法: %s [选项]\n"
+            "  -d, --device PATH       设备节点, 默认/dev/video1\n"
+            "  -s, --size WxH          需要的输出尺寸, 默认640x480\n"
+            "  -f, --fps N             需要的帧率, 默认30\n"
+            "  -t, --seconds N         测试时长(秒), 默认10\n"
+            "  -w, --warmup N          开头不统计的帧数, 默认10\n"
+            "  -S, --stages LIST       dequeue或convert,scale,encode的组合, 默认convert\n"
+            "      --scale-size WxH    缩放目标尺寸, 默认源尺寸的一半\n"
+            "  -q, --quality N         编码阶段的JPEG质量, 默认90\n"
+            "  -i, --io MODE           mmap/userptr/dmabuf, 默认mmap\n"
+            "  -b, --buffers N         驱动缓冲区个数, 默认4\n"
+            "  -o, --output FILE       JSON写到文件, 默认标准输出\n"
+            "  -r, --replay PATH       回放帧文件(目录、video_frame_%%04d.yuyv这样的格式或单个文件),\n"
+            "                          -s为文件里帧的尺寸, -f为回放帧率\n"
+            "  -u, --unpaced           回放时不按帧率定时, 尽快出帧\n"
+            "  -l, --loops N           回放几遍, 默认0(一直循环到测试时间结束)\n"
+            "  -m, --multi LIST        逗号分隔的多个设备, 由一个CaptureManager线程同时采集,\n"
+            "                          每路都用-s的尺寸, 只支持dequeue和convert阶段\n",
+            prog);
+}
+
+static bool parseSize(const char *text, int *width, int *height)
+{
+    return sscanf(text, "%dx%d", width, height) == 2 && *width > 0 && *height > 0;
+}
+
+static bool parseStages(const char *text, int *stages)
+{
+    *stages = 0;
+    std::string list(text);
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        std::string name = list.substr(pos, end - pos);
+        if (name == "convert") *stages |= StageConvert;
+        else if (name == "scale") *stages |= StageScale;
+        else if (name == "encode") *stages |= StageEncode;
+        else if (name != "dequeue" && !name.empty()) return false;
+        pos = end + 1;
+    }
+    /*缩放的输入是转换后的RGB图像*/
+    if (*stages & StageScale) *stages |= StageConvert;
+    return true;
+}
+
+static bool parseOptions(int argc, char *argv[], Options *opt)
+{
+    enum { OptScaleSize = 256 };
+    static const struct option longOptions[] = {
+        {"device",     required_argument, nullptr, 'd'},
+        {"size",       required_argument, nullptr, 's'},
+        {"fps",        required_argument, nullptr, 'f'},
+        {"seconds",    required_argument, nullptr, 't'},
+        {"warmup",     required_argument, nullptr, 'w'},
+        {"stages",     required_argument, nullptr, 'S'},
+        {"scale-size", required_argument, nullptr, OptScaleSize},
+        {"quality",    required_argument, nullptr, 'q'},
+        {"io",         required_argument, nullptr, 'i'},
+        {"buffers",    required_argument, nullptr, 'b'},
+        {"output",     required_argument, nullptr, 'o'},
+        {"replay",     required_argument, nullptr, 'r'},
+        {"unpaced",    no_argument,       nullptr, 'u'},
+        {"loops",      required_argument, nullptr, 'l'},
+        {"multi",      required_argument, nullptr, 'm'},
+        {"help",       no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "d:s:f:t:w:S:q:i:b:o:r:ul:m:h", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'd': opt->device = optarg; break;
+        case 's':
+            if (!parseSize(optarg, &opt->width, &opt->height)) return false;
+            break;
+        case 'f': opt->fps = atof(optarg); break;
+        case 't': opt->seconds = atof(optarg); break;
+        case 'w': opt->warmup = atoi(optarg); break;
+        case 'S':
+            if (!parseStages(optarg, &opt->stages)) return false;
+            break;
+        case OptScaleSize:
+            if (!parseSize(optarg, &opt->scaleWidth, &opt->scaleHeight)) return false;
+            break;
+        case 'q': opt->quality = atoi(optarg); break;
+        case 'i':
+            if (!strcmp(optarg, "mmap")) opt->io = V4L2Camera::IoMmap;
+            else if (!strcmp(optarg, "userptr")) opt->io = V4L2Camera::IoUserPtr;
+            else if (!strcmp(optarg, "dmabuf")) opt->io = V4L2Camera::IoDmabuf;
+            else return false;
+            break;
+        case 'b': opt->buffers = (unsigned int)atoi(optarg); break;
+        case 'o': opt->output = optarg; break;
+        case 'r': opt->replay = optarg; break;
+        case 'u': opt->unpaced = true; break;
+        case 'l': opt->loops = (unsigned int)atoi(optarg); break;
+        case 'm': opt->multi = optarg; break;
+        default: return false;
+        }
+    }
+    /*多路模式下帧在管理器线程的回调里处理, 回调要尽快返回, 不做缩放和编码*/
+    if (opt->multi && (opt->replay || (opt->stages & (StageScale | StageEncode))))
+        return false;
+    return optind == argc && opt->seconds > 0 && opt->fps > 0;
+}
+
+/*
+ * 编码一帧, 与SnapshotEncoder的做法一致: YUYV直接按YUV编码, MJPEG原样写出,
+ * 其它格式编码转换后的图像。输出写到/dev/null, 只计编码本身的耗时。
+ * 和CameraThread拍照一样, 转换过的帧转换失败(比如MJPEG解码出错)时不编码, 记为失败。
+ */
+static bool encodeFrame(const FrameHandle &frame, const QImage &image, bool converted, int quality, FILE *sink)
+{
+    if (converted && image.isNull()) return false;
+    if (!V4L2Camera::frameComplete(frame)) return false;
+    switch (frame.pixelFormat()) {
+    case V4L2_PIX_FMT_YUYV:
+        return writeYuyvJpeg(frame.data(), frame.bytesPerLine(), frame.width(), frame.height(),
+                             quality, sink);
+    case V4L2_PIX_FMT_MJPEG:
+        return fwrite(frame.data(), 1, frame.bytesUsed(), sink) == frame.bytesUsed();
+    default:
+        if (image.isNull()) return false;
+        return image.save(QString("/dev/null"), "JPEG", quality);
+    }
+}
+
+/*缩放输出单独用一个池, 和转换输出尺寸不同, 共用一个池会每帧重新分配*/
+static void processFrame(const Options &opt, FrameSource *source, FramePool *scalePool,
+                         const FrameHandle &frame, FILE *sink, bool measure, BenchResult *result)
+{
+    int64_t t = LatencyStats::now();
+    int64_t cpuStart = cpuNow();
+
+    QImage image;
+    if (opt.stages & StageConvert) {
+        image = V4L2Camera::frameToImage(frame, source->mjpegDecoder(), nullptr, source->framePool());
+        int64_t now = LatencyStats::now();
+        if (measure) result->convert.record(now - t);
+        t = now;
+    }
+
+    if ((opt.stages & StageScale) && !image.isNull()) {
+        QImage src = image;
+        if (src.format() != QImage::Format_RGB888)
+            src = src.convertToFormat(QImage::Format_RGB888);
+        int w = opt.scaleWidth ? opt.scaleWidth : src.width() / 2;
+        int h = opt.scaleHeight ? opt.scaleHeight : src.height() / 2;
+        QImage out = scalePool->acquire(w, h, QImage::Format_RGB32);
+        if (!out.isNull())
+            scaleRgb888ToRgb32(src.constBits(), (int)src.bytesPerLine(), src.width(), src.height(),
+                               (uint32_t *)out.bits(), (int)out.bytesPerLine(), out.width(), out.height(),
+                               StripePool::shared());
+        int64_t now = LatencyStats::now();
+        if (measure) result->scale.record(now - t);
+        t = now;
+    }
+
+    if (opt.stages & StageEncode) {
+        bool ok = encodeFrame(frame, image, opt.stages & StageConvert, opt.quality, sink);
+        int64_t now = LatencyStats::now();
+        if (measure) {
+            result->encode.record(now - t);
+            if (!ok) ++result->encodeFailed;
+        }
+        t = now;
+    }
+
+    if (!measure) return;
+    result->cpu.record(cpuNow() - cpuStart);
+    if (frame.timestampNs() > 0)
+        result->total.record(t - frame.timestampNs());
+}
+
+/*JSON字符串值, 路径等外部输入里的引号、反斜杠和控制字符都要转义*/
+static std::string jsonString(const char *text)
+{
+    std::string out = "\"";
+    for (const char *p = text ? text : ""; *p; ++p) {
+        unsigned char c = (unsigned char)*p;
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                out += esc;
+            } else {
+                out += (char)c;
+            }
+        }
+    }
+    return out + "\"";
+}
+
+/*按键依次拼一个JSON对象, 字符串只在这里用, 长度不受限制*/
+class JsonObject
+{
+public:
+    JsonObject &raw(const char *key, const std::string &json)
+    {
+        m_text += m_text.size() > 1 ? ",\"" : "\"";
+        m_text += key;
+        m_text += "\":";
+        m_text += json;
+        return *this;
+    }
+    JsonObject &text(const char *key, const char *value) { return raw(key, jsonString(value)); }
+    JsonObject &integer(const char *key, long long value) { return raw(key, std::to_string(value)); }
+    JsonObject &boolean(const char *key, bool value) { return raw(key, value ? "true" : "false"); }
+    JsonObject &number(const char *key, double value, int decimals)
+    {
+        int len = snprintf(nullptr, 0, "%.*f", decimals, value);
+        std::string out(len > 0 ? len : 0, '\0');
+        snprintf(&out[0], out.size() + 1, "%.*f", decimals, value);
+        return raw(key, out);
+    }
+    JsonObject &object(const char *key, const JsonObject &value) { return raw(key, value.str()); }
+    std::string str() const { return m_text + "}"; }
+
+private:
+    std::string m_text = "{";
+};
+
+static JsonObject histogramJson(const LatencyHistogram &h)
+{
+    JsonObject json;
+    json.integer("count", (long long)h.count())
+        .number("mean", h.mean() / 1e3, 1)
+        .number("p50", h.percentile(0.50) / 1e3, 1)
+        .number("p90", h.percentile(0.90) / 1e3, 1)
+        .number("p99", h.percentile(0.99) / 1e3, 1)
+        .number("p999", h.percentile(0.999) / 1e3, 1)
+        .number("max", h.max() / 1e3, 1);
+    return json;
+}
+
+static JsonObject poolJson(const FramePool::Stats &stats)
+{
+    JsonObject json;
+    json.integer("hits", (long long)stats.hits)
+        .integer("misses", (long long)stats.misses)
+        .integer("high_water", stats.highWater);
+    return json;
+}
+
+static const char *ioName(V4L2Camera::IoMode mode)
+{
+    switch (mode) {
+    case V4L2Camera::IoUserPtr: return "userptr";
+    case V4L2Camera::IoDmabuf: return "dmabuf";
+    default: return "mmap";
+    }
+}
+
+static std::string stagesJson(int stages)
+{
+    std::string json = "[\"dequeue\"";
+    if (stages & StageConvert) json += ",\"convert\"";
+    if (stages & StageScale) json += ",\"scale\"";
+    if (stages & StageEncode) json += ",\"encode\"";
+    return json + "]";
+}
+
+/*v4l2和replay只有一个不为空, 分别输出设备缓冲区和回放文件的信息*/
+static std::string resultJson(const Options &opt, FrameSource *source, V4L2Source *v4l2,
+                              ReplaySource *replay, const BenchResult &r)
+{
+    CaptureMode mode;
+    if (v4l2) {
+        mode = v4l2->camera()->captureMode();
+    } else {
+        mode.pixelFormat = replay->pixelFormat();
+        mode.width = replay->width();
+        mode.height = replay->height();
+        if (!opt.unpaced) {
+            mode.intervalNum = 1000;
+            mode.intervalDen = (uint32_t)(opt.fps * 1000 + 0.5);
+        }
+    }
+    FramePool::Stats pool = source->framePool()->stats();
+
+    double elapsed = (r.lastNs - r.firstNs) / 1e9;
+    /*帧率按首尾两帧之间的间隔计算, 不含等第一帧的时间*/
+    double fps = (r.frames > 1 && elapsed > 0) ? (r.frames - 1) / elapsed : 0.0;
+    double cpuPerFrame = r.frames ? r.cpuNs / 1e3 / r.frames : 0.0;
+    double stripeCpuPerFrame = r.frames ? r.stripeCpuNs / 1e3 / r.frames : 0.0;
+
+    JsonObject modeJson;
+    modeJson.text("format", captureFormatName(mode.pixelFormat))
+            .integer("width", mode.width)
+            .integer("height", mode.height)
+            .number("fps", mode.fps(), 2);
+    JsonObject requested;
+    requested.integer("width", opt.width)
+             .integer("height", opt.height)
+             .number("fps", opt.fps, 2);
+
+    JsonObject json;
+    json.text("source", v4l2 ? "v4l2" : "replay")
+        .text("path", v4l2 ? opt.device : opt.replay)
+        .text("io", v4l2 ? ioName(v4l2->camera()->ioMode()) : (opt.unpaced ? "unpaced" : "paced"))
+        .object("mode", modeJson)
+        .object("requested", requested)
+        .raw("stages", stagesJson(opt.stages))
+        .integer("stripe_threads", StripePool::shared()->threadCount())
+        .number("duration_s", elapsed, 3)
+        .integer("frames", (long long)r.frames)
+        .integer("encode_failed", (long long)r.encodeFailed)
+        .number("fps", fps, 2)
+        .text("unit", "us")
+        .number("cpu_per_frame", cpuPerFrame, 1)
+        .number("stripe_cpu_per_frame", stripeCpuPerFrame, 1)
+        .number("cpu_utilisation", elapsed > 0 ? r.cpuNs / 1e9 / elapsed : 0.0, 3)
+        .number("process_cpu_utilisation", elapsed > 0 ? r.processCpuNs / 1e9 / elapsed : 0.0, 3);
+
+    JsonObject latency;
+    latency.object("dequeue", histogramJson(r.dequeue));
+    if (opt.stages & StageConvert) latency.object("convert", histogramJson(r.convert));
+    if (opt.stages & StageScale) latency.object("scale", histogramJson(r.scale));
+    if (opt.stages & StageEncode) latency.object("encode", histogramJson(r.encode));
+    latency.object("total", histogramJson(r.total));
+    json.object("latency", latency).object("cpu", histogramJson(r.cpu));
+
+    std::string sequences = "[";
+    for (size_t i = 0; i < r.dropped.size(); ++i)
+        sequences += (i ? "," : "") + std::to_string(r.dropped[i]);
+    JsonObject dropped;
+    dropped.integer("count", (long long)r.droppedCount)
+           .raw("sequences", sequences + "]")
+           .boolean("truncated", r.droppedCount > r.dropped.size());
+    json.object("dropped", dropped);
+
+    if (v4l2) {
+        V4L2Camera::BufferStats buffers = v4l2->camera()->bufferStats();
+        JsonObject item;
+        item.integer("count", buffers.count)
+            .integer("max_held", buffers.maxHeld)
+            .integer("starved", (long long)buffers.starved)
+            .integer("sequence_gaps", (long long)buffers.sequenceGaps)
+            .integer("grown", buffers.grown);
+        json.object("buffers", item);
+    } else {
+        JsonObject item;
+        item.integer("files", replay->frameCount())
+            .integer("mapped_bytes", (long long)replay->mappedBytes())
+            .integer("skipped", (long long)replay->droppedFrames());
+        json.object("replay", item);
+    }
+
+    json.object("frame_pool", poolJson(pool)).object("scale_pool", poolJson(r.scalePool));
+    return json.str() + "\n";
+}
+
+static bool runBench(const Options &opt, FrameSource *source, BenchResult *result)
+{
+    FILE *sink = nullptr;
+    if (opt.stages & StageEncode) {
+        sink = fopen("/dev/null", "wb");
+        if (!sink) {
+            fprintf(stderr, "打开/dev/null失败: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    FramePool scalePool;
+    int skip = opt.warmup;
+    bool haveSeq = false;
+    uint32_t lastSeq = 0;
+    int64_t deadline = 0;
+    int64_t cpuStart = 0;
+    int64_t stripeCpuStart = 0;
+    int64_t processCpuStart = 0;
+
+    struct pollfd pfd;
+    pfd.fd = source->fileDescriptor();
+    pfd.events = POLLIN;
+
+    bool done = false;
+    while (!done && !g_stop) {
+        int ret = poll(&pfd, 1, 1000);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "poll失败: %s\n", strerror(errno));
+            break;
+        }
+        if (ret == 0) {
+            fprintf(stderr, "等待帧超时\n");
+            break;
+        }
+
+        /*和CameraThread一样取完所有就绪的帧再回到poll*/
+        for (;;) {
+            FrameHandle frame = source->dequeueFrame();
+            if (frame.isNull()) break;
+            int64_t now = LatencyStats::now();
+
+            bool measure = skip == 0;
+            if (measure) {
+                if (!deadline) {
+                    deadline = now + (int64_t)(opt.seconds * 1e9);
+                    result->firstNs = now;
+                    cpuStart = cpuNow();
+                    stripeCpuStart = StripePool::chargedCpuNs();
+                    processCpuStart = processCpuNow();
+                }
+                /*只统计预热之后的丢帧*/
+                if (haveSeq && frame.sequence() != lastSeq + 1) {
+                    uint32_t gap = frame.sequence() - lastSeq - 1;
+                    if (gap < 0x80000000u) {
+                        result->droppedCount += gap;
+                        for (uint32_t s = lastSeq + 1; s != frame.sequence()
+                             && result->dropped.size() < MaxDroppedList; ++s)
+                            result->dropped.push_back(s);
+                    }
+                }
+                if (frame.timestampNs() > 0)
+                    result->dequeue.record(now - frame.timestampNs());
+            }
+            haveSeq = true;
+            lastSeq = frame.sequence();
+
+            processFrame(opt, source, &scalePool, frame, sink, measure, result);
+            frame.reset();
+
+            if (!measure) {
+                --skip;
+                continue;
+            }
+            ++result->frames;
+            result->lastNs = LatencyStats::now();
+            if (result->lastNs >= deadline) {
+                done = true;
+                break;
+            }
+        }
+        /*回放放完指定的遍数*/
+        if (source->atEnd()) done = true;
+    }
+
+    if (cpuStart) {
+        result->cpuNs = cpuNow() - cpuStart;
+        result->stripeCpuNs = StripePool::chargedCpuNs() - stripeCpuStart;
+        result->processCpuNs = processCpuNow() - processCpuStart;
+    }
+    result->scalePool = scalePool.stats();
+    if (sink) fclose(sink);
+    return result->frames > 0;
+}
+
+/*多路模式里每一路的统计, 只在CaptureManager线程里写, 测试结束后读*/
+struct MultiCamera {
+    QString device;
+    int id = -1;
+    int skip = 0;
+    LatencyHistogram dequeue;
+    LatencyHistogram convert;
+    MjpegDecoder decoder;
+    FramePool pool;
+};
+
+static std::vector<QString> splitDevices(const char *list)
+{
+    std::vector<QString> devices;
+    std::string text(list);
+    size_t pos = 0;
+    while (pos <= text.size()) {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos) end = text.size();
+        if (end > pos)
+            devices.push_back(QString::fromLocal8Bit(text.substr(pos, end - pos).c_str()));
+        pos = end + 1;
+    }
+    return devices;
+}
+
+static std::string multiJson(const Options &opt, double elapsed,
+                             const std::vector<std::unique_ptr<MultiCamera>> &cameras,
+                             const std::vector<CaptureManager::CameraStats> &stats)
+{
+    std::string list = "[";
+    for (const CaptureManager::CameraStats &st : stats) {
+        const MultiCamera *cam = nullptr;
+        for (const auto &c : cameras)
+            if (c->id == st.id) cam = c.get();
+        if (!cam) continue;
+
+        JsonObject latency;
+        latency.object("dequeue", histogramJson(cam->dequeue));
+        if (opt.stages & StageConvert) latency.object("convert", histogramJson(cam->convert));
+        JsonObject buffers;
+        buffers.integer("count", st.buffers.count)
+               .integer("max_held", st.buffers.maxHeld)
+               .integer("starved", (long long)st.buffers.starved)
+               .integer("sequence_gaps", (long long)st.buffers.sequenceGaps)
+               .integer("grown", st.buffers.grown);
+        JsonObject item;
+        item.text("path", cam->device.toLocal8Bit().constData())
+            .integer("frames", (long long)st.frames)
+            .number("fps", elapsed > 0 ? st.frames / elapsed : 0.0, 2)
+            .integer("skipped", (long long)st.skipped)
+            .integer("dropped", (long long)st.dropped)
+            .object("latency", latency)
+            .object("buffers", buffers)
+            .object("frame_pool", poolJson(cam->pool.stats()));
+        list += (list.size() > 1 ? "," : "") + item.str();
+    }
+
+    JsonObject requested;
+    requested.integer("width", opt.width).integer("height", opt.height);
+    JsonObject json;
+    json.text("source", "multi")
+        .object("requested", requested)
+        .raw("stages", stagesJson(opt.stages))
+        .integer("stripe_threads", StripePool::shared()->threadCount())
+        .number("duration_s", elapsed, 3)
+        .text("unit", "us")
+        .raw("cameras", list + "]");
+    return json.str() + "\n";
+}
+
+/*
+ * 多路采集: 各设备都交给同一个CaptureManager线程, 回调里记录出队延迟, 需要时顺带转换。
+ * 帧数和丢帧以管理器的统计为准(只保留最新帧时跳过的计入skipped), 包括预热的帧。
+ */
+static bool runMulti(const Options &opt, std::string *json)
+{
+    std::vector<QString> devices = splitDevices(opt.multi);
+    if (devices.empty()) return false;
+
+    std::vector<std::unique_ptr<MultiCamera>> cameras;
+    CaptureManager manager;
+    for (const QString &device : devices) {
+        std::unique_ptr<MultiCamera> cam(new MultiCamera);
+        cam->device = device;
+        cam->skip = opt.warmup;
+        MultiCamera *c = cam.get();
+        const bool convert = opt.stages & StageConvert;
+        c->id = manager.addCamera(device, opt.width, opt.height,
+                                  [c, convert](int, const FrameHandle &frame) {
+            int64_t t = LatencyStats::now();
+            if (c->skip > 0) {
+                --c->skip;
+                return;
+            }
+            if (frame.timestampNs() > 0)
+                c->dequeue.record(t - frame.timestampNs());
+            if (convert) {
+                QImage image = V4L2Camera::frameToImage(frame, &c->decoder, nullptr, &c->pool);
+                c->convert.record(LatencyStats::now() - t);
+            }
+        });
+        if (c->id < 0) {
+            fprintf(stderr, "打开%s失败\n", device.toLocal8Bit().constData());
+            return false;
+        }
+        cameras.push_back(std::move(cam));
+    }
+
+    int64_t start = LatencyStats::now();
+    manager.start();
+    const int64_t deadline = start + (int64_t)(opt.seconds * 1e9);
+    while (!g_stop && LatencyStats::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    /*停止之前取统计, 停止时管理器会关闭并移除所有摄像头*/
+    std::vector<CaptureManager::CameraStats> stats = manager.stats();
+    double elapsed = (LatencyStats::now() - start) / 1e9;
+    manager.stop();
+
+    *json = multiJson(opt, elapsed, cameras, stats);
+    for (const CaptureManager::CameraStats &st : stats)
+        if (!st.frames) return false;
+    return true;
+}
+
+static bool writeOutput(const Options &opt, const std::string &json)
+{
+    if (!opt.output) {
+        fputs(json.c_str(), stdout);
+        return true;
+    }
+    FILE *fp = fopen(opt.output, "w");
+    if (!fp || fwrite(json.data(), 1, json.size(), fp) != json.size()) {
+        fprintf(stderr, "写入%s失败\n", opt.output);
+        if (fp) fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    if (!parseOptions(argc, argv, &opt)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    if (opt.multi) {
+        std::string json;
+        bool ok = runMulti(opt, &json);
+        if (!json.empty() && !writeOutput(opt, json))
+            return 1;
+        return ok ? 0 : 1;
+    }
+
+    std::unique_ptr<FrameSource> source;
+    V4L2Source *v4l2 = nullptr;
+    ReplaySource *replay = nullptr;
+    if (opt.replay) {
+        replay = new ReplaySource(QString::fromLocal8Bit(opt.replay));
+        replay->setFrameSize(opt.width, opt.height);
+        replay->setPaced(!opt.unpaced);
+        replay->setLoops(opt.loops);
+        source.reset(replay);
+    } else {
+        v4l2 = new V4L2Source();
+        v4l2->setDevice(QString::fromLocal8Bit(opt.device), opt.width, opt.height, opt.io);
+        V4L2Camera::BufferPolicy policy;
+        policy.count = opt.buffers;
+        v4l2->camera()->setBufferPolicy(policy);
+        source.reset(v4l2);
+    }
+    source->setFrameRate(opt.fps);
+    if (!source->open()) {
+        fprintf(stderr, "打开%s失败\n", opt.replay ? opt.replay : opt.device);
+        return 1;
+    }
+
+    BenchResult result;
+    bool ok = runBench(opt, source.get(), &result);
+    std::string json = resultJson(opt, source.get(), v4l2, replay, result);
+    source->close();
+
+    if (!writeOutput(opt, json))
+        return 1;
+    return ok ? 0 : 1;
+}
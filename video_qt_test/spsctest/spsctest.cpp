@@ -0,0 +1,238 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "spscqueue.h"
+
+/*
+ * SpscQueue的一致性和压力测试, 不依赖Qt
+ * 单线程部分按确定的顺序填满队列, 检查每种溢出策略丢的是哪一项、计数对不对;
+ * 双线程部分一个生产者一个消费者跑几十万项, 消费者时不时停一下逼出溢出,
+ * 检查先进先出、不丢不重、丢弃数和入队出队数对得上, 最后close()让pop()退出。
+ * 项用unique_ptr装着, 配合 make SANITIZE=1 可以查出被丢弃的项有没有析构,
+ * make SANITIZE=thread 检查数据竞争。
+ * 会阻塞的调用都放在另一个线程里限时等待, 卡死算失败而不是让测试挂住。
+ */
+
+typedef std::unique_ptr<unsigned int> Item;
+
+static const unsigned int StressItems = 300000;
+/*限时等待的上限, 卡住就是close()没能唤醒等待的线程*/
+static const int HangSeconds = 10;
+
+static unsigned int s_failures = 0;
+static unsigned int s_cases = 0;
+
+static const char *policyName(OverflowPolicy policy)
+{
+    switch (policy) {
+    case OverflowPolicy::DropOldest: return "DropOldest";
+    case OverflowPolicy::DropNewest: return "DropNewest";
+    case OverflowPolicy::Block:      return "Block";
+    }
+    return "?";
+}
+
+static void report(const char *what, OverflowPolicy policy, unsigned int capacity, const char *detail)
+{
+    ++s_failures;
+    fprintf(stderr, "失败: %s %s 容量%u: %s\n", what, policyName(policy), capacity, detail);
+}
+
+/*等future在限定时间内完成, 超时说明线程卡死, 没法再安全地继续, 直接退出*/
+template <class F>
+static void expectFinishes(std::future<F> &f, const char *what, OverflowPolicy policy, unsigned int capacity)
+{
+    if (f.wait_for(std::chrono::seconds(HangSeconds)) != std::future_status::ready) {
+        report(what, policy, capacity, "线程没有退出");
+        fprintf(stderr, "共%u项, 失败%u项\n", s_cases, s_failures);
+        std::_Exit(1);
+    }
+}
+
+/*单线程: 填满后再多入队一项, 看各策略丢的是哪一项*/
+static void testOverflow(OverflowPolicy policy, unsigned int capacity)
+{
+    ++s_cases;
+    SpscQueue<Item> queue(capacity, policy);
+    char detail[128];
+    for (unsigned int i = 0; i < capacity; ++i) {
+        if (!queue.push(Item(new unsigned int(i)))) {
+            snprintf(detail, sizeof(detail), "未满时第%u项入队失败", i);
+            report("溢出", policy, capacity, detail);
+            return;
+        }
+    }
+    if (queue.depth() != capacity) {
+        snprintf(detail, sizeof(detail), "深度%u", queue.depth());
+        report("溢出", policy, capacity, detail);
+        return;
+    }
+
+    /*Block策略没有消费者时push会一直等, 放到另一个线程里, close()后必须返回false*/
+    bool pushed;
+    if (policy == OverflowPolicy::Block) {
+        auto f = std::async(std::launch::async, [&] { return queue.push(Item(new unsigned int(capacity))); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        queue.close();
+        expectFinishes(f, "满时close", policy, capacity);
+        pushed = f.get();
+        if (pushed || queue.stats().blocked == 0) {
+            snprintf(detail, sizeof(detail), "push返回%d 等待%lu次", pushed, queue.stats().blocked);
+            report("满时close", policy, capacity, detail);
+        }
+    } else {
+        pushed = queue.push(Item(new unsigned int(capacity)));
+        if (pushed != (policy == OverflowPolicy::DropOldest) || queue.stats().dropped != 1) {
+            snprintf(detail, sizeof(detail), "push返回%d 丢弃%lu项", pushed, queue.stats().dropped);
+            report("溢出", policy, capacity, detail);
+        }
+    }
+
+    /*DropOldest丢掉了0, 其余两种保留0..capacity-1*/
+    unsigned int expect = policy == OverflowPolicy::DropOldest ? 1 : 0;
+    Item item;
+    while (queue.tryPop(&item)) {
+        if (!item || *item != expect) {
+            snprintf(detail, sizeof(detail), "期望%u 实际%d", expect, item ? (int)*item : -1);
+            report("溢出后顺序", policy, capacity, detail);
+            return;
+        }
+        ++expect;
+    }
+    unsigned int last = policy == OverflowPolicy::DropOldest ? capacity + 1 : capacity;
+    if (expect != last) {
+        snprintf(detail, sizeof(detail), "取到%u为止 期望到%u", expect, last);
+        report("溢出后顺序", policy, capacity, detail);
+    }
+}
+
+/*
+ * 双线程: 生产者依次入队1..StressItems并记下哪些入队成功, 消费者记下取到的序列。
+ * 取到的必须严格递增(先进先出、不重复); 丢弃数、入队数、出队数要和两边的记录对上。
+ */
+static void testStress(OverflowPolicy policy, unsigned int capacity)
+{
+    ++s_cases;
+    SpscQueue<Item> queue(capacity, policy);
+    std::vector<char> accepted(StressItems + 1, 0);
+    std::vector<unsigned int> received;
+    received.reserve(StressItems);
+
+    auto consumer = std::async(std::launch::async, [&] {
+        Item item;
+        unsigned int n = 0;
+        while (queue.pop(&item)) {
+            received.push_back(item ? *item : 0);
+            /*隔一阵停一下, 让队列满起来*/
+            if (++n % 4096 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        return true;
+    });
+    auto producer = std::async(std::launch::async, [&] {
+        for (unsigned int i = 1; i <= StressItems; ++i)
+            accepted[i] = queue.push(Item(new unsigned int(i)));
+        return true;
+    });
+    expectFinishes(producer, "压力入队", policy, capacity);
+
+    /*等消费者取空后再close, 之后pop()必须返回false让消费者退出*/
+    auto start = std::chrono::steady_clock::now();
+    while (!queue.empty() && std::chrono::steady_clock::now() - start < std::chrono::seconds(HangSeconds))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    queue.close();
+    expectFinishes(consumer, "close后pop", policy, capacity);
+
+    char detail[128];
+    unsigned long acceptedCount = 0;
+    for (unsigned int i = 1; i <= StressItems; ++i)
+        acceptedCount += accepted[i];
+
+    for (size_t i = 0; i < received.size(); ++i) {
+        unsigned int v = received[i];
+        if (v == 0 || v > StressItems || (i > 0 && v <= received[i - 1])) {
+            snprintf(detail, sizeof(detail), "第%zu项为%u, 前一项%u", i, v, i ? received[i - 1] : 0);
+            report("先进先出", policy, capacity, detail);
+            return;
+        }
+        /*取到的一定是入队成功过的*/
+        if (!accepted[v]) {
+            snprintf(detail, sizeof(detail), "取到了入队失败的%u", v);
+            report("不丢不重", policy, capacity, detail);
+            return;
+        }
+    }
+
+    QueueStats st = queue.stats();
+    unsigned long got = received.size();
+    bool ok = st.popped == got && st.pushed == acceptedCount && st.depth == 0;
+    switch (policy) {
+    case OverflowPolicy::Block:
+        /*不丢任何一项*/
+        ok = ok && acceptedCount == StressItems && got == StressItems && st.dropped == 0;
+        break;
+    case OverflowPolicy::DropNewest:
+        /*丢的就是入队失败的那些, 入队成功的全都取到*/
+        ok = ok && st.dropped == StressItems - acceptedCount && got == acceptedCount && st.blocked == 0;
+        break;
+    case OverflowPolicy::DropOldest:
+        /*入队总是成功, 丢的是已排队的旧项, 最新的一项一定留到最后*/
+        ok = ok && acceptedCount == StressItems && got + st.dropped == StressItems
+             && !received.empty() && received.back() == StressItems && st.blocked == 0;
+        break;
+    }
+    if (!ok) {
+        snprintf(detail, sizeof(detail), "入队成功%lu 取到%lu 统计: 入队%lu 出队%lu 丢弃%lu 深度%u",
+                 acceptedCount, got, st.pushed, st.popped, st.dropped, st.depth);
+        report("计数", policy, capacity, detail);
+    }
+}
+
+/*空队列上带超时的pop()要按时返回false, 一直等的pop()要被close()唤醒*/
+static void testClose(OverflowPolicy policy)
+{
+    ++s_cases;
+    SpscQueue<Item> queue(4, policy);
+    Item item;
+    if (queue.pop(&item, 10)) {
+        report("超时pop", policy, 4, "空队列返回了true");
+        return;
+    }
+    auto f = std::async(std::launch::async, [&] { return queue.pop(&item); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    queue.close();
+    expectFinishes(f, "空时close", policy, 4);
+    if (f.get())
+        report("空时close", policy, 4, "pop返回了true");
+    if (queue.push(Item(new unsigned int(1))))
+        report("close后push", policy, 4, "push返回了true");
+
+    /*reopen()之后恢复正常*/
+    queue.reopen();
+    if (!queue.push(Item(new unsigned int(7))) || !queue.tryPop(&item) || !item || *item != 7)
+        report("reopen", policy, 4, "重新启用后入队出队失败");
+}
+
+int main()
+{
+    const OverflowPolicy policies[] = { OverflowPolicy::DropOldest, OverflowPolicy::DropNewest,
+                                        OverflowPolicy::Block };
+    /*容量1时空闲和写满的序号最容易混淆, 其余覆盖很小、不是2的幂和流水线实际用的深度*/
+    const unsigned int capacities[] = { 1, 2, 3, 7, 64 };
+
+    for (OverflowPolicy policy : policies) {
+        unsigned int before = s_failures;
+        for (unsigned int capacity : capacities) {
+            testOverflow(policy, capacity);
+            testStress(policy, capacity);
+        }
+        testClose(policy);
+        printf("%-10s %s\n", policyName(policy), s_failures == before ? "通过" : "失败");
+    }
+    printf("共%u项, 失败%u项\n", s_cases, s_failures);
+    return s_failures ? 1 : 0;
+}
@@ -1,70 +1,339 @@
 #include "camerathread.h"
 #include <QDebug>
 #include <QDateTime>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
 
 CameraThread::CameraThread(QObject *parent) : QThread(parent)
 {
-    m_camera = new V4L2Camera();
+    m_v4l2 = new V4L2Source();
+    m_source = m_v4l2;
+    m_mailbox = new FrameMailbox(this);
+    m_encoder = new SnapshotEncoder();
     m_running = false;
-    m_capture_request = false;
+    m_capture_pending = 0;
     m_brightness_value = 128; /*默认值*/
     m_brightness_changed = false;
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_recordDir = ".";
+    m_convertQueue.reset(new SpscQueue<RawFrame>(m_pipeline.convertDepth, m_pipeline.convertPolicy));
+    m_recordQueue.reset(new SpscQueue<FrameHandle>(m_pipeline.recordDepth, m_pipeline.recordPolicy));
 }
 
 CameraThread::~CameraThread()
 {
     stop();
-    delete m_camera;
+    delete m_encoder;
+    m_customSource.reset();
+    delete m_v4l2;
+    if (m_wakeFd >= 0) close(m_wakeFd);
+}
+
+void CameraThread::start(Priority priority)
+{
+    m_running = true;
+    QThread::start(priority);
 }
 
 void CameraThread::stop()
 {
     m_running = false;
+    wakeUp();
     wait(); /*等待run()函数结束*/
 }
 
+void CameraThread::setDevice(const QString &device, int width, int height, V4L2Camera::IoMode mode)
+{
+    m_v4l2->setDevice(device, width, height, mode);
+    setFrameSource(nullptr);
+}
+
+void CameraThread::setFrameSource(FrameSource *source)
+{
+    if (isRunning()) {
+        qDebug() << "警告: 采集线程运行中, 不能更换帧来源";
+        delete source;
+        return;
+    }
+    m_customSource.reset(source);
+    m_source = source ? source : m_v4l2;
+    /*预览尺寸跟着换到新来源的解码器上*/
+    if (m_previewSize.isValid())
+        m_source->mjpegDecoder()->setTargetSize(m_previewSize.width(), m_previewSize.height());
+}
+
 void CameraThread::setBrightness(int value)
 {
     m_brightness_value = value;
     m_brightness_changed = true;
+    wakeUp();
+}
+
+void CameraThread::capturePicture(int count)
+{
+    m_capture_pending += count;
+    wakeUp();
+}
+
+void CameraThread::setPipelineConfig(const PipelineConfig &config)
+{
+    if (isRunning()) {
+        qDebug() << "警告: 采集线程运行中, 不能修改流水线配置";
+        return;
+    }
+    m_pipeline = config;
+    m_convertQueue.reset(new SpscQueue<RawFrame>(config.convertDepth, config.convertPolicy));
+    m_recordQueue.reset(new SpscQueue<FrameHandle>(config.recordDepth, config.recordPolicy));
+}
+
+CameraThread::PipelineStats CameraThread::pipelineStats() const
+{
+    PipelineStats stats;
+    stats.convert = m_convertQueue->stats();
+    stats.record = m_recordQueue->stats();
+    stats.recorded = m_recorded;
+    return stats;
+}
+
+void CameraThread::setPreviewSize(const QSize &size)
+{
+    /*解码器的目标尺寸是原子变量, 可以直接从GUI线程设置*/
+    m_previewSize = size;
+    m_source->mjpegDecoder()->setTargetSize(size.width(), size.height());
 }
 
-void CameraThread::capturePicture()
+void CameraThread::wakeUp()
 {
-    m_capture_request = true;
+    uint64_t one = 1;
+    if (m_wakeFd >= 0 && write(m_wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        qDebug() << "警告: 唤醒采集线程失败";
+    }
+}
+
+/*
+ * 从环境变量读取初始的画面调节: V4L2_CONTRAST、V4L2_GAMMA(浮点),
+ * V4L2_COLOR_MATRIX=601/709, V4L2_COLOR_RANGE=full/limited
+ */
+static void applyAdjustEnv(ImageAdjust *adjust)
+{
+    QByteArray contrast = qgetenv("V4L2_CONTRAST");
+    if (!contrast.isEmpty()) adjust->setContrast(contrast.toFloat());
+    QByteArray gamma = qgetenv("V4L2_GAMMA");
+    if (!gamma.isEmpty()) adjust->setGamma(gamma.toFloat());
+    QByteArray matrix = qgetenv("V4L2_COLOR_MATRIX");
+    if (!matrix.isEmpty())
+        adjust->setMatrix(matrix == "709" ? YuvMatrix::Bt709 : YuvMatrix::Bt601);
+    QByteArray range = qgetenv("V4L2_COLOR_RANGE");
+    if (!range.isEmpty())
+        adjust->setRange(range == "limited" ? YuvRange::Limited : YuvRange::Full);
 }
 
 void CameraThread::run()
 {
-    m_running = true;
     /*在线程启动时才打开设备*/
-    if (!m_camera->openDevice("/dev/video1", 640, 480)) {
-        qDebug() << "线程错误: 无法在线程中打开摄像头";
+    m_source->setFrameRate(m_fps);
+    if (!m_source->open()) {
+        qDebug() << "线程错误: 无法在线程中打开帧来源" << m_source->description();
         m_running = false;
         return;
     }
 
+    /*V4L2_TEST_PATTERN可选vcam的测试图案, 1彩条 2渐变时画面带帧标记*/
+    QByteArray pattern = qgetenv("V4L2_TEST_PATTERN");
+    if (!pattern.isEmpty())
+        m_source->setTestPattern(pattern.toInt());
+    applyAdjustEnv(&m_adjust);
+    m_soft_brightness = false;
+
+    /*转换和录像各自一个线程, 上一次运行关闭的队列在这里重新打开*/
+    m_convertQueue->reopen();
+    m_recordQueue->reopen();
+    m_convertThread = std::thread(&CameraThread::convertLoop, this);
+    m_recordThread = std::thread(&CameraThread::recordLoop, this);
+
+    /*阻塞在设备fd和eventfd上, 有帧就绪或收到命令时才醒来*/
+    struct pollfd fds[2];
+    fds[0].fd = m_source->fileDescriptor();
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wakeFd;
+    fds[1].events = POLLIN;
+
     while (m_running)
     {
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            qDebug() << "线程错误: poll 失败";
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            if (read(m_wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                qDebug() << "警告: 读取eventfd失败";
+            }
+        }
+        if (!m_running) break;
+
         if (m_brightness_changed) {
-            m_camera->setBrightness(m_brightness_value);
             m_brightness_changed = false;
+            /*设置控制失败时改用软件亮度, 之后不再尝试ioctl*/
+            if (m_soft_brightness || !m_source->setBrightness(m_brightness_value)) {
+                if (!m_soft_brightness)
+                    qDebug() << "摄像头不支持亮度控制, 改为在转换时调节";
+                m_soft_brightness = true;
+                m_adjust.setBrightness(m_brightness_value - 128);
+            }
+        }
+
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            qDebug() << "线程错误: 摄像头设备出错或已断开";
+            break;
+        }
+        if (!(fds[0].revents & POLLIN)) continue;
+
+        /*
+         * 采集级只出队、打时间戳, 然后交给转换级。转换跟不上时由队列按策略丢帧,
+         * 默认深度1、丢最旧的, 被挤掉的帧句柄一释放缓冲区就还给驱动。
+         */
+        for (;;) {
+            FrameHandle frame = m_source->dequeueFrame();
+            if (frame.isNull()) break;
+
+            RawFrame raw;
+            raw.dequeued = LatencyStats::now();
+            /*驱动没给单调时钟时间戳时, 以出队时刻作为这一帧的起点*/
+            raw.captured = frame.timestampNs() ? frame.timestampNs() : raw.dequeued;
+            stampFrame(frame, &raw.captured);
+            if (frame.timestampNs())
+                m_latency.record(LatencyStats::Dequeue, raw.dequeued - raw.captured);
+            raw.frame = std::move(frame);
+            m_convertQueue->push(std::move(raw));
+        }
+        /*回放之类的有限来源放完后停止采集*/
+        if (m_source->atEnd()) {
+            qDebug() << "帧来源已结束";
+            break;
+        }
+    }
+
+    /*先停下游再关设备, 队列里剩下的帧句柄在这之前全部释放*/
+    m_convertQueue->close();
+    m_convertThread.join();
+    m_recordQueue->close();
+    m_recordThread.join();
+    m_source->close();
+}
+
+/*画面里有帧标记时以标记为准, 同时统计重复帧和丢帧*/
+void CameraThread::stampFrame(const FrameHandle &frame, qint64 *captured)
+{
+    FrameStamp stamp;
+    if (!decodeFrameStamp(frame, &stamp)) return;
+
+    *captured = stamp.timestampNs;
+    ++m_stampFrames;
+    if (m_haveStamp) {
+        uint32_t diff = stamp.sequence - m_lastStampSeq;
+        if (diff == 0)
+            ++m_stampDuplicates;
+        else if (diff < 0x80000000u)
+            m_stampGaps += diff - 1;
+    }
+    m_haveStamp = true;
+    m_lastStampSeq = stamp.sequence;
+}
+
+/*转换级: 转成QImage后分发给拍照、录像和显示*/
+void CameraThread::convertLoop()
+{
+    RawFrame raw;
+    while (m_convertQueue->pop(&raw)) {
+        if (!m_running) {
+            raw.frame.reset();
+            continue;
         }
 
-        QImage frame = m_camera->getFrame();
+        const YuvTables &tables = m_adjust.tables();
+        QImage frame = V4L2Camera::frameToImage(raw.frame, m_source->mjpegDecoder(), &tables,
+                                                m_source->framePool());
+        m_latency.record(LatencyStats::Convert, LatencyStats::now() - raw.dequeued);
+        if (m_capture_pending > 0) {
+            takeSnapshot(raw.frame, frame, !tables.identity);
+        }
+        /*写盘可能很慢, 录像的帧拷贝一份, 不占着驱动的缓冲区*/
+        if (m_recording) {
+            FrameHandle copy = raw.frame.isZeroCopy()
+                    ? FrameHandle::copyOf(raw.frame.data(), raw.frame.info()) : raw.frame;
+            m_recordQueue->push(std::move(copy));
+        }
+        raw.frame.reset();
         if (!frame.isNull()) {
-            emit newFrame(frame);
+            m_mailbox->post(frame, raw.captured);
+        }
+    }
+}
 
-            if (m_capture_request) {
-                QString fileName = QString("capture_%1.jpg").arg(QDateTime::currentMSecsSinceEpoch());
-                frame.save(fileName);
-                qDebug() << "图片已保存为:" << fileName;
-                    m_capture_request = false;
-            }
+static const char *recordSuffix(uint32_t pixelFormat)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_YUYV: return "yuyv";
+    case V4L2_PIX_FMT_NV12: return "nv12";
+    case V4L2_PIX_FMT_NV16: return "nv16";
+    case V4L2_PIX_FMT_MJPEG: return "jpg";
+    default: return "raw";
+    }
+}
+
+/*录像级: 原始帧逐帧写成video_frame_NNNN.<格式>*/
+void CameraThread::recordLoop()
+{
+    FrameHandle frame;
+    while (m_recordQueue->pop(&frame)) {
+        char name[64];
+        snprintf(name, sizeof(name), "video_frame_%04lu.%s",
+                 m_recordIndex++, recordSuffix(frame.pixelFormat()));
+        QString path = m_recordDir + "/" + QString::fromLatin1(name);
+
+        FILE *fp = fopen(path.toLocal8Bit().constData(), "wb");
+        bool ok = false;
+        if (fp) {
+            ok = fwrite(frame.data(), 1, frame.bytesUsed(), fp) == frame.bytesUsed();
+            ok = fclose(fp) == 0 && ok;
+        }
+        frame.reset();
+        if (ok) {
+            ++m_recorded;
+        } else {
+            qDebug() << "警告: 录像写盘失败" << path;
         }
-        /*短暂休眠，避免CPU占用过高*/
-        msleep(30);
     }
+}
 
-    m_camera->closeDevice();
+/*把当前帧交给后台编码池, 队列满或帧不完整时留到下一帧再试*/
+void CameraThread::takeSnapshot(const FrameHandle &raw, const QImage &frame, bool adjusted)
+{
+    /*有软件调节时要用调节后的图像, 没有时YUYV直接按YUV编码、MJPEG原样写盘*/
+    bool useRaw = !adjusted && (raw.pixelFormat() == V4L2_PIX_FMT_YUYV
+                                || raw.pixelFormat() == V4L2_PIX_FMT_MJPEG);
+    /*
+     * 截断的帧或解码失败的MJPEG不拍, 也不算队列满, 悄悄等下一帧;
+     * 原样写盘的MJPEG也要解码成功过, 标记齐全不代表中间的数据没坏
+     */
+    if (frame.isNull() || (useRaw && !V4L2Camera::frameComplete(raw)))
+        return;
+
+    QString fileName = QString("capture_%1_%2.jpg")
+            .arg(QDateTime::currentMSecsSinceEpoch()).arg(raw.sequence());
+    bool queued = useRaw ? m_encoder->submit(raw, fileName) : m_encoder->submit(frame, fileName);
+
+    if (queued) {
+        --m_capture_pending;
+    } else if (m_encoder->queueDepth() >= m_encoder->queueLimit()) {
+        qDebug() << "警告: 拍照队列已满, 当前深度" << m_encoder->queueDepth();
+    }
 }
@@ -3,31 +3,142 @@
 
 #include <QThread>
 #include <QImage>
-#include "v4l2camera.h"
+#include "framesource.h"
+#include "v4l2source.h"
+#include "framemailbox.h"
+#include "snapshotencoder.h"
+#include "latencystats.h"
+#include "framestamp.h"
+#include "imageadjust.h"
+#include "spscqueue.h"
+#include <atomic>
+#include <memory>
+#include <thread>
 
+/*
+ * 采集流水线: 采集(本线程) -> 转换 -> 分发(显示信箱/录像/拍照)
+ * 各级之间用有界SPSC队列连接, 每个队列有自己的溢出策略和计数,
+ * 某一级变慢只会让它前面的队列丢帧或等待, 不会拖住其它级。
+ */
 class CameraThread : public QThread
 {
     Q_OBJECT
 public:
+    /*各级队列的深度和溢出策略, 需在start()之前设置*/
+    struct PipelineConfig {
+        /*采集->转换, 只保留最新的帧; 深度越大持有的驱动缓冲区越多*/
+        unsigned int convertDepth = 1;
+        OverflowPolicy convertPolicy = OverflowPolicy::DropOldest;
+        /*转换->录像, 帧已拷贝出来, 满了丢新帧以保证已排队的帧连续写盘*/
+        unsigned int recordDepth = 8;
+        OverflowPolicy recordPolicy = OverflowPolicy::DropNewest;
+    };
+
+    struct PipelineStats {
+        QueueStats convert;
+        QueueStats record;
+        unsigned long recorded = 0;     /*已写盘的帧数*/
+    };
+
     explicit CameraThread(QObject *parent = nullptr);
     ~CameraThread();
 
+    /*隐藏QThread::start(), 在线程启动前置位运行标志, 紧接着的stop()不会被run()覆盖*/
+    void start(Priority priority = InheritPriority);
     void stop();
+    /*设置要打开的设备并改回从V4L2设备取帧, 需在start()之前调用; 默认/dev/video1 640x480 MMAP*/
+    void setDevice(const QString &device, int width, int height,
+                   V4L2Camera::IoMode mode = V4L2Camera::IoMmap);
+    /*改用其它帧来源(如ReplaySource), 接管其所有权; 为空时改回V4L2设备; 需在start()之前调用*/
+    void setFrameSource(FrameSource *source);
+    FrameSource *frameSource() const { return m_source; }
+    /*需要的帧率, 需在start()之前调用; 采集模式按输出尺寸和帧率选代价最低的*/
+    void setFrameRate(double fps) { m_fps = fps; }
     void setBrightness(int value);
-    void capturePicture();
+    /*拍照, count>1时为连拍, 连续count帧交给后台编码*/
+    void capturePicture(int count = 1);
+    /*预览区域大小, MJPEG据此选择解码缩放比例*/
+    void setPreviewSize(const QSize &size);
+
+    /*转换来不及处理而被丢掉的帧*/
+    unsigned long skippedFrames() const { return m_convertQueue->stats().dropped; }
+    void setPipelineConfig(const PipelineConfig &config);
+    PipelineConfig pipelineConfig() const { return m_pipeline; }
+    PipelineStats pipelineStats() const;
+    /*录像文件的目录, 需在start()之前设置; 默认当前目录*/
+    void setRecordDirectory(const QString &dir) { m_recordDir = dir; }
+    /*开始/停止把原始帧逐帧写成video_frame_NNNN.<格式>*/
+    void setRecording(bool enable) { m_recording = enable; }
+    bool isRecording() const { return m_recording; }
+    /*缓冲区个数策略, 需在start()之前设置*/
+    void setBufferPolicy(const V4L2Camera::BufferPolicy &policy) { m_v4l2->camera()->setBufferPolicy(policy); }
+    /*驱动队列与用户空间各持有多少缓冲区, 不是从V4L2设备取帧时全为0*/
+    V4L2Camera::BufferStats bufferStats() const { return m_v4l2->camera()->bufferStats(); }
+    /*转换输出图像池的命中率和峰值占用*/
+    FramePool::Stats framePoolStats() const { return m_source->framePool()->stats(); }
+
+    /*最新帧信箱, 显示端在frameAvailable()通知后从这里取帧*/
+    FrameMailbox *mailbox() const { return m_mailbox; }
+    /*后台编码池, 可查询排队深度*/
+    SnapshotEncoder *encoder() const { return m_encoder; }
+    /*测试图案里帧标记的统计: 解码成功的帧数、重复帧、按标记sequence算出的丢帧*/
+    unsigned long stampedFrames() const { return m_stampFrames; }
+    unsigned long stampDuplicates() const { return m_stampDuplicates; }
+    unsigned long stampGaps() const { return m_stampGaps; }
 
-signals:
-    void newFrame(const QImage &frame);
+    /*软件画面调节, 在YUV转RGB的同时完成; 可在任意线程修改, MJPEG不受影响*/
+    ImageAdjust *imageAdjust() { return &m_adjust; }
+
+    /*各阶段延迟统计, 缩放和显示阶段也记到这里*/
+    LatencyStats *latency() { return &m_latency; }
 
 protected:
     void run() override;
 
 private:
-    V4L2Camera *m_camera;
-    volatile bool m_running;
-    volatile bool m_capture_request;
+    /*出队后、转换前的一帧, 带着采集和出队时刻*/
+    struct RawFrame {
+        FrameHandle frame;
+        qint64 captured = 0;
+        qint64 dequeued = 0;
+    };
+
+    void wakeUp();
+    void stampFrame(const FrameHandle &frame, qint64 *captured);
+    void convertLoop();
+    void recordLoop();
+    void takeSnapshot(const FrameHandle &raw, const QImage &frame, bool adjusted);
+
+    V4L2Source *m_v4l2;                             /*默认的帧来源*/
+    std::unique_ptr<FrameSource> m_customSource;    /*setFrameSource()设置的帧来源*/
+    FrameSource *m_source;                          /*当前使用的帧来源*/
+    double m_fps = 30.0;
+    QSize m_previewSize;                            /*只在GUI线程里读写*/
+    FrameMailbox *m_mailbox;
+    SnapshotEncoder *m_encoder;
+    LatencyStats m_latency;
+    ImageAdjust m_adjust;
+    PipelineConfig m_pipeline;
+    std::unique_ptr<SpscQueue<RawFrame>> m_convertQueue;
+    std::unique_ptr<SpscQueue<FrameHandle>> m_recordQueue;
+    std::thread m_convertThread;
+    std::thread m_recordThread;
+    QString m_recordDir;
+    std::atomic<bool> m_recording{false};
+    std::atomic<unsigned long> m_recorded{0};
+    /*录像文件编号, 每次尝试写盘都加一, 写失败的编号也不复用; 只在录像线程里访问*/
+    unsigned long m_recordIndex = 0;
+    std::atomic<unsigned long> m_stampFrames{0};
+    std::atomic<unsigned long> m_stampDuplicates{0};
+    std::atomic<unsigned long> m_stampGaps{0};
+    bool m_haveStamp = false;
+    uint32_t m_lastStampSeq = 0;
+    int m_wakeFd;           /*eventfd, 用于停止和控制命令唤醒采集线程*/
+    std::atomic<bool> m_running;
+    std::atomic<int> m_capture_pending;    /*还需要拍的张数*/
     int m_brightness_value;
     volatile bool m_brightness_changed;
+    bool m_soft_brightness = false;     /*设备没有亮度控制, 改用软件调节*/
 };
 
 #endif
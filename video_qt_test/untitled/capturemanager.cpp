@@ -0,0 +1,255 @@
+#include "capturemanager.h"
+#include <QDebug>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+
+static const uint64_t WAKE_TAG = ~0ull;
+
+struct CaptureManager::Entry {
+    int id = -1;
+    QString device;
+    V4L2Camera camera;
+    FrameConsumer consumer;
+    bool polled = false;
+
+    std::atomic<quint64> frames{0};
+    std::atomic<quint64> skipped{0};
+    std::atomic<quint64> dropped{0};
+    std::atomic<double> fps{0};
+
+    /*以下只在管理器线程里访问*/
+    bool haveSeq = false;
+    uint32_t lastSeq = 0;
+    quint64 windowFrames = 0;
+};
+
+static qint64 monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+CaptureManager::CaptureManager(QObject *parent)
+    : QThread(parent)
+    , m_running(false)
+    , m_nextId(0)
+{
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+CaptureManager::~CaptureManager()
+{
+    stop();
+    if (m_wakeFd >= 0) close(m_wakeFd);
+}
+
+int CaptureManager::addCamera(const QString &device, int width, int height, FrameConsumer consumer)
+{
+    auto entry = std::make_shared<Entry>();
+    if (!entry->camera.openDevice(device.toLocal8Bit().constData(), width, height)) {
+        qDebug() << "错误: 无法打开摄像头" << device;
+        return -1;
+    }
+    entry->device = device;
+    entry->consumer = std::move(consumer);
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        entry->id = m_nextId++;
+        m_entries[entry->id] = entry;
+        m_toAdd.push_back(entry);
+    }
+    wakeUp();
+    return entry->id;
+}
+
+void CaptureManager::removeCamera(int id)
+{
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_toRemove.push_back(id);
+    }
+    wakeUp();
+}
+
+void CaptureManager::start(Priority priority)
+{
+    m_running = true;
+    QThread::start(priority);
+}
+
+void CaptureManager::stop()
+{
+    m_running = false;
+    wakeUp();
+    wait();
+}
+
+void CaptureManager::wakeUp()
+{
+    uint64_t one = 1;
+    if (m_wakeFd >= 0 && write(m_wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        qDebug() << "警告: 唤醒采集管理线程失败";
+    }
+}
+
+std::vector<CaptureManager::CameraStats> CaptureManager::stats() const
+{
+    std::vector<CameraStats> result;
+    std::lock_guard<std::mutex> locker(m_mutex);
+    for (const auto &it : m_entries) {
+        const Entry *e = it.second.get();
+        CameraStats st;
+        st.id = e->id;
+        st.device = e->device;
+        st.fps = e->fps.load();
+        st.frames = e->frames.load();
+        st.skipped = e->skipped.load();
+        st.dropped = e->dropped.load();
+        st.buffers = e->camera.bufferStats();
+        result.push_back(st);
+    }
+    return result;
+}
+
+/*在管理器线程里处理增删请求, epoll集合只由这个线程修改*/
+void CaptureManager::applyPending(int epfd)
+{
+    std::vector<std::shared_ptr<Entry>> toAdd;
+    std::vector<int> toRemove;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        toAdd.swap(m_toAdd);
+        toRemove.swap(m_toRemove);
+    }
+
+    for (const auto &entry : toAdd) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = (uint64_t)entry->id;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, entry->camera.fileDescriptor(), &ev) < 0) {
+            qDebug() << "错误: epoll_ctl 添加" << entry->device << "失败";
+            continue;
+        }
+        entry->polled = true;
+    }
+
+    for (int id : toRemove) {
+        std::shared_ptr<Entry> entry;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            auto it = m_entries.find(id);
+            if (it == m_entries.end()) continue;
+            entry = it->second;
+            m_entries.erase(it);
+        }
+        if (entry->polled)
+            epoll_ctl(epfd, EPOLL_CTL_DEL, entry->camera.fileDescriptor(), nullptr);
+        entry->camera.closeDevice();
+    }
+}
+
+void CaptureManager::service(Entry *entry)
+{
+    unsigned int skipped = 0;
+    FrameHandle frame = entry->camera.dequeueLatestFrame(&skipped);
+    if (frame.isNull()) return;
+
+    /*sequence不连续说明驱动那边丢了帧(包括被跳过的帧)*/
+    uint32_t seq = frame.sequence();
+    if (entry->haveSeq && seq != entry->lastSeq + 1) {
+        uint32_t gap = seq - entry->lastSeq - 1;
+        if (gap > skipped && gap < 0x80000000u)
+            entry->dropped += gap - skipped;
+    }
+    entry->haveSeq = true;
+    entry->lastSeq = seq;
+    entry->skipped += skipped;
+    ++entry->frames;
+    ++entry->windowFrames;
+
+    if (entry->consumer)
+        entry->consumer(entry->id, frame);
+}
+
+void CaptureManager::updateRates(qint64 elapsedNs)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    for (auto &it : m_entries) {
+        Entry *e = it.second.get();
+        e->fps = e->windowFrames * 1e9 / elapsedNs;
+        e->windowFrames = 0;
+    }
+}
+
+void CaptureManager::run()
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        qDebug() << "线程错误: epoll_create1 失败";
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = WAKE_TAG;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, m_wakeFd, &ev);
+
+    /*run()开始前加入的摄像头*/
+    applyPending(epfd);
+
+    qint64 windowStart = monotonicNs();
+    struct epoll_event events[16];
+    while (m_running) {
+        int n = epoll_wait(epfd, events, 16, 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            qDebug() << "线程错误: epoll_wait 失败";
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.u64 == WAKE_TAG) {
+                uint64_t count;
+                if (read(m_wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    qDebug() << "警告: 读取eventfd失败";
+                }
+                applyPending(epfd);
+                continue;
+            }
+
+            int id = (int)events[i].data.u64;
+            std::shared_ptr<Entry> entry;
+            {
+                std::lock_guard<std::mutex> locker(m_mutex);
+                auto it = m_entries.find(id);
+                if (it != m_entries.end()) entry = it->second;
+            }
+            if (!entry) continue;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                qDebug() << "错误: 摄像头" << entry->device << "出错或已断开, 停止采集";
+                removeCamera(id);
+                continue;
+            }
+            service(entry.get());
+        }
+
+        qint64 now = monotonicNs();
+        if (now - windowStart >= 1000000000LL) {
+            updateRates(now - windowStart);
+            windowStart = now;
+        }
+    }
+
+    /*退出时关闭所有摄像头*/
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        for (int id = 0; id < m_nextId; ++id)
+            m_toRemove.push_back(id);
+    }
+    applyPending(epfd);
+    close(epfd);
+}
@@ -0,0 +1,74 @@
+#ifndef CAPTUREMANAGER_H
+#define CAPTUREMANAGER_H
+
+#include <QThread>
+#include <QString>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "v4l2camera.h"
+
+/*
+ * 多摄像头采集管理器
+ * 一个线程用epoll同时服务任意数量的V4L2Camera, 每个摄像头只占一个fd,
+ * 不再需要每路一个线程。帧在管理器线程里以零拷贝句柄的形式交给各路
+ * 的消费者回调, 回调要尽快返回(比如放进信箱或队列)。
+ */
+class CaptureManager : public QThread
+{
+    Q_OBJECT
+public:
+    /*cameraId为addCamera()的返回值*/
+    typedef std::function<void(int cameraId, const FrameHandle &frame)> FrameConsumer;
+
+    struct CameraStats {
+        int id = -1;
+        QString device;
+        double fps = 0;
+        quint64 frames = 0;     /*交给消费者的帧数*/
+        quint64 skipped = 0;    /*来不及处理、只保留最新帧时跳过的帧数*/
+        quint64 dropped = 0;    /*按驱动sequence计算的丢帧数*/
+        V4L2Camera::BufferStats buffers;
+    };
+
+    explicit CaptureManager(QObject *parent = nullptr);
+    ~CaptureManager();
+
+    /*
+     * 打开设备并加入epoll, 可在运行中调用; 失败返回-1
+     * 打开、协商格式和申请缓冲区都在调用者的线程里同步完成(可能要几百毫秒),
+     * 这样失败能直接返回; 这期间设备还没加入epoll, 管理器线程不会碰它, 已有的各路照常采集。
+     */
+    int addCamera(const QString &device, int width, int height, FrameConsumer consumer);
+    void removeCamera(int id);
+    /*隐藏QThread::start(), 在线程启动前置位运行标志, 紧接着的stop()不会被run()覆盖*/
+    void start(Priority priority = InheritPriority);
+    void stop();
+
+    std::vector<CameraStats> stats() const;
+
+protected:
+    void run() override;
+
+private:
+    struct Entry;
+
+    void wakeUp();
+    void applyPending(int epfd);
+    void service(Entry *entry);
+    void updateRates(qint64 nowNs);
+
+    int m_wakeFd;
+    std::atomic<bool> m_running;
+
+    mutable std::mutex m_mutex;
+    std::map<int, std::shared_ptr<Entry>> m_entries;    /*stats()读取用*/
+    std::vector<std::shared_ptr<Entry>> m_toAdd;
+    std::vector<int> m_toRemove;
+    int m_nextId;
+};
+
+#endif
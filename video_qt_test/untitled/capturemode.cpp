@@ -0,0 +1,178 @@
+#include "capturemode.h"
+#include <linux/videodev2.h>
+#include <algorithm>
+#include <cstdio>
+
+/*各项代价系数, 以SIMD转换一个像素为1*/
+static const double ReadCost = 0.25;        /*每读入一个字节*/
+static const double ConvertCost = 1.0;      /*YUV转RGB888, 每像素*/
+static const double EntropyCost = 1.5;      /*MJPEG熵解码, 按原尺寸每像素*/
+static const double IdctCost = 3.0;         /*MJPEG IDCT和色彩转换, 按缩小后每像素*/
+static const double ScaleCost = 0.5;        /*缩放, 每输出像素*/
+static const double MjpegBytesPerPixel = 0.3;
+
+bool captureFormatSupported(uint32_t pixelFormat)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV16:
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_MJPEG:
+        return true;
+    default:
+        return false;
+    }
+}
+
+const char *captureFormatName(uint32_t pixelFormat)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_NV12:  return "NV12";
+    case V4L2_PIX_FMT_NV16:  return "NV16";
+    case V4L2_PIX_FMT_YUYV:  return "YUYV";
+    case V4L2_PIX_FMT_MJPEG: return "MJPEG";
+    default:                 return "?";
+    }
+}
+
+int captureLineBytes(uint32_t pixelFormat, int width)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_YUYV: return width * 2;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV16: return width;
+    default:                return 0;
+    }
+}
+
+size_t captureFrameBytes(uint32_t pixelFormat, int bytesPerLine, int height)
+{
+    const size_t plane = (size_t)bytesPerLine * height;
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_YUYV: return plane;
+    case V4L2_PIX_FMT_NV12: return plane + (size_t)bytesPerLine * ((height + 1) / 2);
+    case V4L2_PIX_FMT_NV16: return plane * 2;
+    default:                return 0;
+    }
+}
+
+std::string captureModeName(const CaptureMode &mode)
+{
+    char text[64];
+    if (mode.fps() > 0)
+        snprintf(text, sizeof(text), "%s %dx%d@%.4gfps", captureFormatName(mode.pixelFormat),
+                 mode.width, mode.height, mode.fps());
+    else
+        snprintf(text, sizeof(text), "%s %dx%d", captureFormatName(mode.pixelFormat),
+                 mode.width, mode.height);
+    return text;
+}
+
+double captureModeCost(const CaptureMode &mode, int outWidth, int outHeight)
+{
+    const double pixels = (double)mode.width * mode.height;
+    double cost;
+    int decodedWidth = mode.width;
+    int decodedHeight = mode.height;
+
+    switch (mode.pixelFormat) {
+    case V4L2_PIX_FMT_NV12:
+        cost = pixels * (1.5 * ReadCost + ConvertCost);
+        break;
+    case V4L2_PIX_FMT_NV16:
+    case V4L2_PIX_FMT_YUYV:
+        cost = pixels * (2.0 * ReadCost + ConvertCost);
+        break;
+    case V4L2_PIX_FMT_MJPEG: {
+        /*和MjpegDecoder一样取最大的缩放分母, 缩小后仍不小于输出尺寸*/
+        int denom = 1;
+        while (denom < 8 && mode.width / (denom * 2) >= outWidth
+               && mode.height / (denom * 2) >= outHeight)
+            denom *= 2;
+        decodedWidth = mode.width / denom;
+        decodedHeight = mode.height / denom;
+        cost = pixels * (MjpegBytesPerPixel * ReadCost + EntropyCost)
+             + (double)decodedWidth * decodedHeight * IdctCost;
+        break;
+    }
+    default:
+        return 1e30;
+    }
+    if (decodedWidth != outWidth || decodedHeight != outHeight)
+        cost += (double)outWidth * outHeight * ScaleCost;
+    return cost;
+}
+
+/*尺寸/帧率是否满足请求, 决定候选的优先级, 数值越小越优先*/
+static int modeTier(const CaptureMode &mode, int width, int height, double fps)
+{
+    bool covers = mode.width >= width && mode.height >= height;
+    bool fast = mode.fps() <= 0 || fps <= 0 || mode.fps() >= fps * 0.99;
+    return (covers ? 0 : 2) + (fast ? 0 : 1);
+}
+
+namespace {
+struct Candidate {
+    const CaptureMode *mode;
+    double cost;
+    int tier;
+};
+}
+
+/*同一优先级里: 尺寸不够的先比面积, 帧率不够的先比帧率, 最后比代价*/
+static bool betterCandidate(const Candidate &a, const Candidate &b)
+{
+    if (a.tier != b.tier) return a.tier < b.tier;
+    if (a.tier >= 2) {
+        long areaA = (long)a.mode->width * a.mode->height;
+        long areaB = (long)b.mode->width * b.mode->height;
+        if (areaA != areaB) return areaA > areaB;
+    }
+    if ((a.tier & 1) && a.mode->fps() != b.mode->fps())
+        return a.mode->fps() > b.mode->fps();
+    return a.cost < b.cost;
+}
+
+ModeChoice chooseCaptureMode(const std::vector<CaptureMode> &modes, int width, int height, double fps)
+{
+    std::vector<Candidate> candidates;
+    for (const CaptureMode &mode : modes) {
+        if (!captureFormatSupported(mode.pixelFormat)) continue;
+        /*驱动按模式本身的帧率出帧, 下游每一帧都要处理, 所以按模式的帧率算每秒代价*/
+        double rate = mode.fps() > 0 ? mode.fps() : (fps > 0 ? fps : 30.0);
+        candidates.push_back({ &mode, captureModeCost(mode, width, height) * rate,
+                               modeTier(mode, width, height, fps) });
+    }
+
+    ModeChoice choice;
+    if (candidates.empty()) {
+        choice.reason = "设备没有可用的NV12/NV16/YUYV/MJPEG模式";
+        return choice;
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), betterCandidate);
+    const Candidate &best = candidates[0];
+    choice.mode = *best.mode;
+    choice.cost = best.cost;
+
+    static const char *const why[] = {
+        "满足请求尺寸和帧率的模式中代价最低",
+        "没有达到请求帧率的模式, 选帧率最高的",
+        "没有不小于请求尺寸的模式, 选面积最大的",
+        "尺寸和帧率都达不到请求, 选面积最大、帧率最高的"
+    };
+    char text[256];
+    snprintf(text, sizeof(text), "请求%dx%d@%.4gfps, %s (每秒约%.1fM单位)",
+             width, height, fps, why[best.tier], best.cost / 1e6);
+    choice.reason = text;
+
+    /*次优的换一种格式来比, 同格式只是帧率不同的没有参考意义*/
+    for (size_t i = 1; i < candidates.size(); ++i) {
+        const Candidate &c = candidates[i];
+        if (c.tier != best.tier || c.mode->pixelFormat == best.mode->pixelFormat) continue;
+        snprintf(text, sizeof(text), ", 次优为%s (%.1fM)",
+                 captureModeName(*c.mode).c_str(), c.cost / 1e6);
+        choice.reason += text;
+        break;
+    }
+    return choice;
+}
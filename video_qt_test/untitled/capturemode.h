@@ -0,0 +1,56 @@
+#ifndef CAPTUREMODE_H
+#define CAPTUREMODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*设备支持的一种采集模式: 格式 + 尺寸 + 帧间隔*/
+struct CaptureMode {
+    uint32_t pixelFormat = 0;
+    int width = 0;
+    int height = 0;
+    uint32_t intervalNum = 0;   /*帧间隔num/den秒, 为0表示驱动没有报告*/
+    uint32_t intervalDen = 0;
+
+    double fps() const { return intervalNum ? (double)intervalDen / intervalNum : 0.0; }
+};
+
+/*选模式的结果, reason说明为什么选它*/
+struct ModeChoice {
+    CaptureMode mode;
+    double cost = 0.0;          /*每秒处理代价, 单位见captureModeCost()*/
+    std::string reason;
+
+    bool isValid() const { return mode.pixelFormat != 0; }
+};
+
+/*
+ * 每帧处理代价的估算, 以"SIMD转换一个像素"为1个单位:
+ * 读入的字节数(带宽)、YUV转换或MJPEG熵解码+IDCT(按DCT域缩小后的像素数)、
+ * 缩放到输出尺寸。只用于同一台机器上各模式之间的比较。
+ */
+double captureModeCost(const CaptureMode &mode, int outWidth, int outHeight);
+
+/*
+ * 按请求的输出尺寸和帧率挑代价最低的模式:
+ * 先在尺寸不小于请求、帧率不低于请求的模式里选每秒代价最低的;
+ * 没有时依次放宽帧率、尺寸, 选最接近请求的。
+ */
+ModeChoice chooseCaptureMode(const std::vector<CaptureMode> &modes,
+                             int width, int height, double fps);
+
+/*支持的格式按处理代价从低到高排列, 不在其中的格式不参与选择*/
+bool captureFormatSupported(uint32_t pixelFormat);
+const char *captureFormatName(uint32_t pixelFormat);
+/*原始格式每行的最少字节数(YUYV为宽度*2, NV12/NV16的Y平面为宽度), 压缩格式返回0*/
+int captureLineBytes(uint32_t pixelFormat, int width);
+/*
+ * 原始格式一帧至少要有的字节数: YUYV为bytesPerLine*height, NV12/NV16再加上UV平面;
+ * 驱动给的bytesused或回放文件比这小时不能按这个尺寸读。MJPEG等压缩格式返回0。
+ */
+size_t captureFrameBytes(uint32_t pixelFormat, int bytesPerLine, int height);
+std::string captureModeName(const CaptureMode &mode);
+
+#endif
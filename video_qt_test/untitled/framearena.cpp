@@ -0,0 +1,85 @@
+#include "framearena.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <QDebug>
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static size_t alignUp(size_t value, size_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+FrameArena::FrameArena()
+    : m_base(nullptr)
+    , m_slotSize(0)
+    , m_count(0)
+    , m_mapped(0)
+    , m_hugeTlb(false)
+    , m_locked(false)
+{
+}
+
+FrameArena::~FrameArena()
+{
+    release();
+}
+
+bool FrameArena::allocate(size_t slotSize, unsigned int count, int flags)
+{
+    release();
+    if (slotSize == 0 || count == 0) return false;
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t slot = alignUp(slotSize, page);
+    size_t total = slot * count;
+    void *p = MAP_FAILED;
+
+    if (flags & HugePages) {
+        /*MAP_HUGETLB要求长度是大页的整数倍, 需要系统预留了大页(vm.nr_hugepages)*/
+        size_t hugeTotal = alignUp(total, HUGE_PAGE_SIZE);
+        p = mmap(nullptr, hugeTotal, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            total = hugeTotal;
+            m_hugeTlb = true;
+        }
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(nullptr, total, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            qDebug() << "错误: 帧内存池申请失败," << total << "字节";
+            return false;
+        }
+        /*退而求其次, 交给透明大页*/
+        if (flags & HugePages)
+            madvise(p, total, MADV_HUGEPAGE);
+    }
+
+    if (flags & Locked) {
+        if (mlock(p, total) == 0)
+            m_locked = true;
+        else
+            qDebug() << "警告: 帧内存池 mlock 失败, 检查 RLIMIT_MEMLOCK";
+    }
+
+    m_base = (uint8_t *)p;
+    m_slotSize = slot;
+    m_count = count;
+    m_mapped = total;
+    return true;
+}
+
+void FrameArena::release()
+{
+    if (!m_base) return;
+    if (m_locked) munlock(m_base, m_mapped);
+    munmap(m_base, m_mapped);
+    m_base = nullptr;
+    m_slotSize = 0;
+    m_count = 0;
+    m_mapped = 0;
+    m_hugeTlb = false;
+    m_locked = false;
+}
@@ -0,0 +1,49 @@
+#ifndef FRAMEARENA_H
+#define FRAMEARENA_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * 帧缓冲区内存池
+ * 一次性申请一整块按页对齐的匿名内存, 切成等长的槽位, 用作USERPTR采集缓冲区。
+ * 优先使用MAP_HUGETLB大页, 系统没有预留大页时退回普通页并madvise(MADV_HUGEPAGE),
+ * 可选mlock避免换出。
+ */
+class FrameArena
+{
+public:
+    enum Flag {
+        HugePages = 0x1,    /*尽量使用大页*/
+        Locked    = 0x2     /*mlock常驻内存*/
+    };
+
+    FrameArena();
+    ~FrameArena();
+
+    /*slotSize会向上取整到页大小, 失败返回false*/
+    bool allocate(size_t slotSize, unsigned int count, int flags = HugePages);
+    void release();
+
+    bool isNull() const { return !m_base; }
+    uint8_t *slot(unsigned int index) const { return m_base + index * m_slotSize; }
+    size_t slotSize() const { return m_slotSize; }
+    unsigned int slotCount() const { return m_count; }
+    size_t mappedSize() const { return m_mapped; }
+
+    bool usesHugeTlb() const { return m_hugeTlb; }   /*MAP_HUGETLB是否成功*/
+    bool isLocked() const { return m_locked; }
+
+private:
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    uint8_t *m_base;
+    size_t m_slotSize;
+    unsigned int m_count;
+    size_t m_mapped;
+    bool m_hugeTlb;
+    bool m_locked;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#include "framehandle.h"
+#include <cstring>
+
+FrameHandle::FrameHandle(const uint8_t *data, const Info &info, std::function<void()> release)
+{
+    auto p = std::make_shared<Private>();
+    p->data = data;
+    p->info = info;
+    p->release = std::move(release);
+    d = std::move(p);
+}
+
+FrameHandle FrameHandle::copyOf(const uint8_t *data, const Info &info)
+{
+    auto p = std::make_shared<Private>();
+    p->owned.reset(new uint8_t[info.bytesUsed]);
+    memcpy(p->owned.get(), data, info.bytesUsed);
+    p->data = p->owned.get();
+    p->info = info;
+    p->info.index = -1;
+    p->info.dmabufFd = -1;
+    FrameHandle frame;
+    frame.d = std::move(p);
+    return frame;
+}
+
+const FrameHandle::Info &FrameHandle::info() const
+{
+    static const Info empty;
+    return d ? d->info : empty;
+}
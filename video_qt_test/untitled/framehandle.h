@@ -0,0 +1,66 @@
+#ifndef FRAMEHANDLE_H
+#define FRAMEHANDLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+/*
+ * 引用计数的帧句柄
+ * 直接指向驱动mmap出来的缓冲区, 不做拷贝; 最后一个持有者释放时
+ * 调用release回调(对V4L2来说就是VIDIOC_QBUF把缓冲区还给驱动)。
+ * 句柄本身可以随意拷贝并跨线程传递, 数据只读。
+ */
+class FrameHandle
+{
+public:
+    struct Info {
+        uint32_t pixelFormat = 0;
+        int width = 0;
+        int height = 0;
+        int bytesPerLine = 0;
+        size_t bytesUsed = 0;
+        uint32_t sequence = 0;
+        int index = -1;          /*驱动缓冲区序号, 拷贝出来的帧为-1*/
+        int64_t timestampNs = 0; /*驱动打的CLOCK_MONOTONIC时间戳, 0表示驱动没有提供*/
+        int dmabufFd = -1;       /*对应的dma-buf fd, 句柄存活期间有效, 可交给编码器或其他进程*/
+    };
+
+    FrameHandle() = default;
+    FrameHandle(const uint8_t *data, const Info &info, std::function<void()> release);
+
+    /*把数据拷贝到堆上得到一个与驱动缓冲区无关的帧*/
+    static FrameHandle copyOf(const uint8_t *data, const Info &info);
+
+    bool isNull() const { return !d; }
+    bool isZeroCopy() const { return d && !d->owned; }
+    const uint8_t *data() const { return d ? d->data : nullptr; }
+    const Info &info() const;
+
+    uint32_t pixelFormat() const { return info().pixelFormat; }
+    int width() const { return info().width; }
+    int height() const { return info().height; }
+    int bytesPerLine() const { return info().bytesPerLine; }
+    size_t bytesUsed() const { return info().bytesUsed; }
+    uint32_t sequence() const { return info().sequence; }
+    int64_t timestampNs() const { return info().timestampNs; }
+    int dmabufFd() const { return info().dmabufFd; }
+
+    /*当前有多少个句柄共享这一帧*/
+    long useCount() const { return d.use_count(); }
+    /*提前放弃自己持有的引用*/
+    void reset() { d.reset(); }
+
+private:
+    struct Private {
+        const uint8_t *data = nullptr;
+        Info info;
+        std::function<void()> release;
+        std::unique_ptr<uint8_t[]> owned;   /*copyOf()生成的帧持有自己的数据*/
+        ~Private() { if (release) release(); }
+    };
+    std::shared_ptr<const Private> d;
+};
+
+#endif
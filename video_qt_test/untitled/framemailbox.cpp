@@ -0,0 +1,39 @@
+#include "framemailbox.h"
+
+FrameMailbox::FrameMailbox(QObject *parent) : QObject(parent)
+{
+}
+
+void FrameMailbox::post(const QImage &frame, qint64 captureNs)
+{
+    /*QImage是隐式共享的, 这里只拷贝句柄不拷贝像素*/
+    Slot &slot = m_slots[m_back];
+    slot.image = frame;
+    slot.captureNs = captureNs;
+    int old = m_middle.exchange(m_back | Fresh, std::memory_order_acq_rel);
+    m_back = old & IndexMask;
+    m_posted.fetch_add(1, std::memory_order_relaxed);
+    if (old & Fresh) {
+        /*被覆盖的帧马上放掉, 不占着帧池里的缓冲区*/
+        m_slots[m_back].image = QImage();
+        m_superseded.fetch_add(1, std::memory_order_relaxed);
+    }
+    /*上一次通知还没被消费者处理, 就不再重复发*/
+    if (!m_notified.exchange(true, std::memory_order_acq_rel))
+        emit frameAvailable();
+}
+
+bool FrameMailbox::take(QImage *frame, qint64 *captureNs)
+{
+    /*先清通知标志再取帧, 之后post进来的帧一定会再发一次通知*/
+    m_notified.store(false, std::memory_order_release);
+    if (!(m_middle.load(std::memory_order_acquire) & Fresh))
+        return false;
+    /*只有消费者会清掉Fresh, 检查之后换出来的一定是新帧*/
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & IndexMask;
+    Slot &latest = m_slots[m_front];
+    /*移走而不是拷贝, 槽里不留引用, 消费者用完帧池就能回收*/
+    *frame = std::move(latest.image);
+    if (captureNs) *captureNs = latest.captureNs;
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef FRAMEMAILBOX_H
+#define FRAMEMAILBOX_H
+
+#include <QObject>
+#include <QImage>
+#include <atomic>
+
+/*
+ * "最新帧"信箱(三缓冲)
+ * 生产者post()总是覆盖尚未取走的旧帧, 消费者take()取走最新的一帧。
+ * 三个槽预先分配, 生产者和消费者各占一个, 中间槽的下标用一次原子exchange交换,
+ * 每帧没有内存分配也没有锁; 只支持一个生产者线程和一个消费者线程。
+ * frameAvailable()信号做了合并, 消费者取走之前最多只发一次,
+ * 所以GUI线程再忙也不会堆积排队的帧事件。
+ */
+class FrameMailbox : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FrameMailbox(QObject *parent = nullptr);
+
+    /*生产者线程调用, captureNs为这一帧的采集时间(LatencyStats::now()时钟), 随帧一起传递*/
+    void post(const QImage &frame, qint64 captureNs = 0);
+    /*消费者线程调用, 没有新帧时返回false*/
+    bool take(QImage *frame, qint64 *captureNs = nullptr);
+
+    quint64 postedFrames() const { return m_posted.load(std::memory_order_relaxed); }
+    /*还没被取走就被新帧覆盖掉的帧数*/
+    quint64 supersededFrames() const { return m_superseded.load(std::memory_order_relaxed); }
+
+signals:
+    void frameAvailable();
+
+private:
+    struct Slot {
+        QImage image;
+        qint64 captureNs = 0;
+    };
+    /*m_middle低位是中间槽的下标, Fresh表示里面是还没取走的新帧*/
+    static const int Fresh = 4;
+    static const int IndexMask = 3;
+
+    Slot m_slots[3];
+    int m_back = 0;                 /*生产者独占*/
+    int m_front = 1;                /*消费者独占*/
+    std::atomic<int> m_middle{2};
+    std::atomic<bool> m_notified{false};
+    std::atomic<quint64> m_posted{0};
+    std::atomic<quint64> m_superseded{0};
+};
+
+#endif
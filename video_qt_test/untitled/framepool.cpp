@@ -0,0 +1,121 @@
+#include "framepool.h"
+#include <QDebug>
+#include <cstdlib>
+
+/*空闲链表和统计放在独立的共享对象里, 池销毁后还在外面的缓冲区仍能安全归还*/
+struct FramePool::Core {
+    std::mutex mutex;
+    std::vector<Buffer *> free;
+    unsigned int maxFree = 8;
+    bool closed = false;
+    size_t currentSize = 0;     /*最近一次申请的尺寸, 其它尺寸的缓冲区归还时直接释放*/
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    unsigned int outstanding = 0;
+    unsigned int highWater = 0;
+    size_t allocatedBytes = 0;
+
+    void destroy(Buffer *buffer) {
+        allocatedBytes -= buffer->size;
+        ::free(buffer->data);
+        delete buffer;
+    }
+};
+
+FramePool::FramePool(unsigned int maxFree)
+    : m_core(std::make_shared<Core>())
+{
+    m_core->maxFree = maxFree;
+}
+
+FramePool::~FramePool()
+{
+    /*还在外面的缓冲区归还时发现池已关闭, 会自己释放*/
+    std::lock_guard<std::mutex> locker(m_core->mutex);
+    m_core->closed = true;
+    for (Buffer *buffer : m_core->free)
+        m_core->destroy(buffer);
+    m_core->free.clear();
+}
+
+int FramePool::alignedStride(int width, QImage::Format format)
+{
+    int bytes = format == QImage::Format_RGB888 ? width * 3 : width * 4;
+    return (int)(((size_t)bytes + LineAlign - 1) & ~(LineAlign - 1));
+}
+
+QImage FramePool::acquire(int width, int height, QImage::Format format)
+{
+    if (width <= 0 || height <= 0) return QImage();
+    const int stride = alignedStride(width, format);
+    const size_t size = ((size_t)stride * height + PageAlign - 1) & ~(PageAlign - 1);
+
+    Buffer *buffer = nullptr;
+    std::vector<Buffer *> stale;
+    {
+        std::lock_guard<std::mutex> locker(m_core->mutex);
+        std::vector<Buffer *> &free = m_core->free;
+        for (size_t i = free.size(); i-- > 0; ) {
+            if (free[i]->size == size) {
+                buffer = free[i];
+                free.erase(free.begin() + i);
+                break;
+            }
+        }
+        m_core->currentSize = size;
+        if (buffer) {
+            ++m_core->hits;
+        } else {
+            ++m_core->misses;
+            /*尺寸变了, 旧尺寸的空闲缓冲区不会再用到*/
+            stale.swap(free);
+        }
+        for (Buffer *b : stale)
+            m_core->destroy(b);
+        if (++m_core->outstanding > m_core->highWater)
+            m_core->highWater = m_core->outstanding;
+    }
+
+    if (!buffer) {
+        void *data = nullptr;
+        if (posix_memalign(&data, PageAlign, size) != 0) {
+            qDebug() << "错误: 分配图像缓冲区失败" << size << "字节";
+            std::lock_guard<std::mutex> locker(m_core->mutex);
+            --m_core->outstanding;
+            return QImage();
+        }
+        buffer = new Buffer;
+        buffer->core = m_core;
+        buffer->data = (uint8_t *)data;
+        buffer->size = size;
+        std::lock_guard<std::mutex> locker(m_core->mutex);
+        m_core->allocatedBytes += size;
+    }
+    return QImage(buffer->data, width, height, stride, format, &FramePool::recycle, buffer);
+}
+
+/*QImage的数据最后一个引用释放时调用, 可能在任意线程*/
+void FramePool::recycle(void *info)
+{
+    Buffer *buffer = (Buffer *)info;
+    std::shared_ptr<Core> core = buffer->core;
+    std::lock_guard<std::mutex> locker(core->mutex);
+    --core->outstanding;
+    if (!core->closed && buffer->size == core->currentSize && core->free.size() < core->maxFree)
+        core->free.push_back(buffer);
+    else
+        core->destroy(buffer);
+}
+
+FramePool::Stats FramePool::stats() const
+{
+    std::lock_guard<std::mutex> locker(m_core->mutex);
+    Stats st;
+    st.hits = m_core->hits;
+    st.misses = m_core->misses;
+    st.outstanding = m_core->outstanding;
+    st.highWater = m_core->highWater;
+    st.free = (unsigned int)m_core->free.size();
+    st.allocatedBytes = m_core->allocatedBytes;
+    return st;
+}
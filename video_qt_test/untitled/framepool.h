@@ -0,0 +1,60 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <QImage>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * 输出图像缓冲区池
+ * 缓冲区按页对齐分配, 每行按缓存行对齐, 包成QImage交给下游; 最后一个
+ * QImage副本析构时通过cleanup回调把缓冲区还回池里, 而不是free掉。
+ * 稳定运行时每帧只是从空闲链表里取一块, 不再分配几MB的堆内存。
+ * 分辨率变化后旧尺寸的空闲缓冲区会被释放。池可以先于图像销毁,
+ * 之后归还的缓冲区直接释放。取和还可以在不同线程。
+ */
+class FramePool
+{
+public:
+    struct Stats {
+        unsigned long hits = 0;         /*直接从空闲链表取到*/
+        unsigned long misses = 0;       /*需要新分配*/
+        unsigned int outstanding = 0;   /*正被QImage持有的缓冲区数*/
+        unsigned int highWater = 0;     /*outstanding的历史最大值*/
+        unsigned int free = 0;
+        size_t allocatedBytes = 0;      /*池里和外面的缓冲区总字节数*/
+    };
+
+    /*maxFree为最多保留的空闲缓冲区数, 多出来的归还时直接释放*/
+    explicit FramePool(unsigned int maxFree = 8);
+    ~FramePool();
+
+    /*取一张width x height的图像, 内容未初始化*/
+    QImage acquire(int width, int height, QImage::Format format);
+    Stats stats() const;
+
+    /*每行字节数按缓存行对齐*/
+    static int alignedStride(int width, QImage::Format format);
+
+    static const size_t LineAlign = 64;
+    static const size_t PageAlign = 4096;
+
+private:
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    struct Core;
+    struct Buffer {
+        std::shared_ptr<Core> core;
+        uint8_t *data = nullptr;
+        size_t size = 0;
+    };
+    static void recycle(void *info);
+
+    std::shared_ptr<Core> m_core;
+};
+
+#endif
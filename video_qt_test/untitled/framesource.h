@@ -0,0 +1,46 @@
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include <QString>
+#include "framehandle.h"
+
+class FramePool;
+class MjpegDecoder;
+
+/*
+ * 帧来源接口
+ * CameraThread和capture_bench只通过它取帧, 不关心帧来自V4L2设备还是录好的文件。
+ * 用法与V4L2设备相同: poll fileDescriptor()可读后反复dequeueFrame()直到返回空句柄。
+ * open/close/dequeueFrame只在采集线程里调用。
+ */
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    /*打开并开始出帧, 配置在具体实现里设置*/
+    virtual bool open() = 0;
+    virtual void close() = 0;
+
+    /*有帧就绪时可读的fd, 打开后才有效*/
+    virtual int fileDescriptor() const = 0;
+    /*不阻塞, 没有就绪的帧时返回空句柄*/
+    virtual FrameHandle dequeueFrame() = 0;
+    /*帧已经出完(例如回放到头), 之后不会再有新帧*/
+    virtual bool atEnd() const { return false; }
+
+    /*需要的帧率, 在open之前设置*/
+    virtual void setFrameRate(double fps) = 0;
+    /*不支持的控制返回false, 调用方改用软件处理*/
+    virtual bool setBrightness(int value) { (void)value; return false; }
+    virtual bool setTestPattern(int pattern) { (void)pattern; return false; }
+
+    /*MJPEG解码器和转换输出图像池, 解码器只能在采集线程里使用*/
+    virtual MjpegDecoder *mjpegDecoder() = 0;
+    virtual FramePool *framePool() = 0;
+
+    /*日志和基准测试输出里用的简短描述*/
+    virtual QString description() const = 0;
+};
+
+#endif
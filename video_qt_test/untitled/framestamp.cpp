@@ -0,0 +1,61 @@
+#include "framestamp.h"
+#include "framehandle.h"
+#include <linux/videodev2.h>
+
+static const int STAMP_CELL = 8;
+static const int STAMP_COLS = 16;
+static const int STAMP_ROWS = 8;
+static const uint16_t STAMP_MAGIC = 0x5643;
+
+/*取一个像素的亮度(0~255)*/
+static int sampleLuma(const uint8_t *data, int stride, int x, int y, uint32_t pixelFormat)
+{
+    const uint8_t *row = data + (size_t)y * stride;
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_YUYV:  return row[x * 2];
+    case V4L2_PIX_FMT_UYVY:  return row[x * 2 + 1];
+    case V4L2_PIX_FMT_GREY:
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV16:  return row[x];
+    case V4L2_PIX_FMT_RGB24: return (row[x * 3] + 2 * row[x * 3 + 1] + row[x * 3 + 2]) / 4;
+    case V4L2_PIX_FMT_BGR32: return (row[x * 4 + 2] + 2 * row[x * 4 + 1] + row[x * 4]) / 4;
+    default:                 return -1;
+    }
+}
+
+bool decodeFrameStamp(const uint8_t *data, int stride, int width, int height,
+                      uint32_t pixelFormat, FrameStamp *stamp, double scale)
+{
+    if (!data || scale <= 0) return false;
+    if (width < STAMP_COLS * STAMP_CELL * scale || height < STAMP_ROWS * STAMP_CELL * scale)
+        return false;
+
+    /*采样每个格子的中心, 亮度过半为1*/
+    uint16_t words[8] = {0};
+    for (int bit = 0; bit < STAMP_COLS * STAMP_ROWS; ++bit) {
+        int x = (int)(((bit % STAMP_COLS) * STAMP_CELL + STAMP_CELL / 2) * scale);
+        int y = (int)(((bit / STAMP_COLS) * STAMP_CELL + STAMP_CELL / 2) * scale);
+        int luma = sampleLuma(data, stride, x, y, pixelFormat);
+        if (luma < 0) return false;
+        if (luma >= 128)
+            words[bit / 16] |= (uint16_t)(1u << (15 - bit % 16));
+    }
+
+    if (words[0] != STAMP_MAGIC) return false;
+    uint16_t check = words[1] ^ words[2] ^ words[3] ^ words[4] ^ words[5] ^ words[6] ^ 0xA5A5;
+    if (words[7] != check) return false;
+
+    if (stamp) {
+        stamp->sequence = ((uint32_t)words[1] << 16) | words[2];
+        stamp->timestampNs = (int64_t)(((uint64_t)words[3] << 48) | ((uint64_t)words[4] << 32)
+                                     | ((uint64_t)words[5] << 16) | words[6]);
+    }
+    return true;
+}
+
+bool decodeFrameStamp(const FrameHandle &frame, FrameStamp *stamp)
+{
+    if (frame.isNull()) return false;
+    return decodeFrameStamp(frame.data(), frame.bytesPerLine(), frame.width(), frame.height(),
+                            frame.pixelFormat(), stamp);
+}
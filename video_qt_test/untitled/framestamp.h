@@ -0,0 +1,27 @@
+#ifndef FRAMESTAMP_H
+#define FRAMESTAMP_H
+
+#include <cstdint>
+
+class FrameHandle;
+
+/*
+ * vcam驱动嵌入在画面左上角的帧标记(测试图案为彩条或渐变时)
+ * 16x8个8x8像素的黑白格子, 128位: 魔数0x5643 | sequence | 时间戳ns | 校验,
+ * 与驱动 video_platform/video_drv.c 中的 vcam_draw_stamp() 对应。
+ */
+struct FrameStamp {
+    uint32_t sequence = 0;
+    int64_t timestampNs = 0;    /*驱动生成这一帧时的CLOCK_MONOTONIC时间*/
+};
+
+/*
+ * 从原始帧解码, pixelFormat支持YUYV、UYVY、GREY、NV12/NV16(只看Y平面)、RGB24和BGR32(即QImage::Format_RGB32);
+ * scale为画面相对驱动原始尺寸的缩放比例, 用于解码缩放后的预览图像。
+ * 没有标记或校验失败返回false。
+ */
+bool decodeFrameStamp(const uint8_t *data, int stride, int width, int height,
+                      uint32_t pixelFormat, FrameStamp *stamp, double scale = 1.0);
+bool decodeFrameStamp(const FrameHandle &frame, FrameStamp *stamp);
+
+#endif
@@ -0,0 +1,68 @@
+#include "imageadjust.h"
+#include <algorithm>
+
+ImageAdjust::ImageAdjust()
+{
+    buildYuvTables(m_params, &m_tables);
+    m_built = m_version;
+}
+
+template <class F>
+void ImageAdjust::update(F &&change)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    change(m_params);
+    m_version.fetch_add(1, std::memory_order_release);
+}
+
+void ImageAdjust::setBrightness(int value)
+{
+    update([=](YuvAdjust &p) { p.brightness = std::max(-255, std::min(255, value)); });
+}
+
+void ImageAdjust::setContrast(float value)
+{
+    update([=](YuvAdjust &p) { p.contrast = std::max(0.0f, std::min(4.0f, value)); });
+}
+
+void ImageAdjust::setGamma(float value)
+{
+    update([=](YuvAdjust &p) { p.gamma = std::max(0.1f, std::min(10.0f, value)); });
+}
+
+void ImageAdjust::setMatrix(YuvMatrix matrix)
+{
+    update([=](YuvAdjust &p) { p.matrix = matrix; });
+}
+
+void ImageAdjust::setRange(YuvRange range)
+{
+    update([=](YuvAdjust &p) { p.range = range; });
+}
+
+void ImageAdjust::setParams(const YuvAdjust &params)
+{
+    setBrightness(params.brightness);
+    setContrast(params.contrast);
+    setGamma(params.gamma);
+    setMatrix(params.matrix);
+    setRange(params.range);
+}
+
+YuvAdjust ImageAdjust::params() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_params;
+}
+
+const YuvTables &ImageAdjust::tables()
+{
+    unsigned int version = m_version.load(std::memory_order_acquire);
+    if (version != m_built) {
+        /*先记下版本再取参数, 重建期间又改了参数的话下一帧会再建一次*/
+        YuvAdjust params = this->params();
+        buildYuvTables(params, &m_tables);
+        m_built = version;
+    }
+    return m_tables;
+}
@@ -0,0 +1,40 @@
+#ifndef IMAGEADJUST_H
+#define IMAGEADJUST_H
+
+#include <atomic>
+#include <mutex>
+#include "yuvconvert.h"
+
+/*
+ * 软件画面调节(亮度/对比度/gamma/色彩矩阵/范围)
+ * 参数可以在任意线程修改, 只记下版本号; 转换线程取查找表时发现版本变了
+ * 才重建一次, 参数不动时每帧没有额外开销。
+ */
+class ImageAdjust
+{
+public:
+    ImageAdjust();
+
+    void setBrightness(int value);      /*-255~255*/
+    void setContrast(float value);      /*0~4*/
+    void setGamma(float value);         /*0.1~10*/
+    void setMatrix(YuvMatrix matrix);
+    void setRange(YuvRange range);
+    void setParams(const YuvAdjust &params);
+    YuvAdjust params() const;
+    bool isIdentity() const { return params().isIdentity(); }
+
+    /*只能在一个线程(转换线程)里调用, 返回的表在下次调用前有效*/
+    const YuvTables &tables();
+
+private:
+    template <class F> void update(F &&change);
+
+    mutable std::mutex m_mutex;
+    YuvAdjust m_params;
+    std::atomic<unsigned int> m_version{1};
+    unsigned int m_built = 0;
+    YuvTables m_tables;
+};
+
+#endif
@@ -0,0 +1,226 @@
+#include "imagescale.h"
+#include "stripepool.h"
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCALE_HAVE_NEON 1
+#endif
+
+/*插值权重为6位定点数, 两个权重之和为64*/
+enum { W_BITS = 6, W_ONE = 1 << W_BITS };
+
+/*out[i] = (a[i] * (64 - w) + b[i] * w) >> 6*/
+static void blendRows(const uint8_t *a, const uint8_t *b, uint8_t *out, int n, int w)
+{
+    int i = 0;
+    if (w == 0) {
+        for (; i < n; ++i) out[i] = a[i];
+        return;
+    }
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wa = _mm_set1_epi16((short)(W_ONE - w));
+    const __m128i wb = _mm_set1_epi16((short)w);
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+        _mm_storeu_si128((__m128i *)(out + i),
+                         _mm_packus_epi16(_mm_srli_epi16(lo, W_BITS), _mm_srli_epi16(hi, W_BITS)));
+    }
+#elif defined(SCALE_HAVE_NEON)
+    const uint8x8_t wa = vdup_n_u8((uint8_t)(W_ONE - w));
+    const uint8x8_t wb = vdup_n_u8((uint8_t)w);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t va = vld1q_u8(a + i);
+        uint8x16_t vb = vld1q_u8(b + i);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(va), wa), vget_low_u8(vb), wb);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(va), wa), vget_high_u8(vb), wb);
+        vst1q_u8(out + i, vcombine_u8(vshrn_n_u16(lo, W_BITS), vshrn_n_u16(hi, W_BITS)));
+    }
+#endif
+    for (; i < n; ++i)
+        out[i] = (uint8_t)((a[i] * (W_ONE - w) + b[i] * w) >> W_BITS);
+}
+
+/*像素中心对齐的源坐标表: 整数部分和6位小数权重*/
+static void buildAxis(int srcLen, int dstLen, std::vector<int> &index, std::vector<int> &weight)
+{
+    index.resize(dstLen);
+    weight.resize(dstLen);
+    const int64_t step = ((int64_t)srcLen << 16) / dstLen;
+    int64_t pos = step / 2 - (1 << 15);
+    for (int i = 0; i < dstLen; ++i, pos += step) {
+        int64_t p = pos < 0 ? 0 : pos;
+        int idx = (int)(p >> 16);
+        int w = (int)((p & 0xffff) >> (16 - W_BITS));
+        if (idx >= srcLen - 1) {
+            idx = srcLen - 1;
+            w = 0;
+        }
+        index[i] = idx;
+        weight[i] = w;
+    }
+}
+
+/*
+ * 面积平均用的分段表: 第i个输出像素覆盖源坐标[edge[i], edge[i+1])。
+ * 只在缩小到一半以下时使用, 每段至少两个源像素。
+ */
+static void buildEdges(int srcLen, int dstLen, std::vector<int> &edge)
+{
+    edge.resize(dstLen + 1);
+    for (int i = 0; i <= dstLen; ++i)
+        edge[i] = (int)((int64_t)i * srcLen / dstLen);
+}
+
+/*sum[i] += row[i], 32位累加, 行数再多也不会溢出*/
+static void accumulateRow(const uint8_t *row, uint32_t *sum, int n)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i *s = (__m128i *)(sum + i);
+        _mm_storeu_si128(s + 0, _mm_add_epi32(_mm_loadu_si128(s + 0), _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(s + 2, _mm_add_epi32(_mm_loadu_si128(s + 2), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(s + 3, _mm_add_epi32(_mm_loadu_si128(s + 3), _mm_unpackhi_epi16(hi, zero)));
+    }
+#elif defined(SCALE_HAVE_NEON)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(row + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+        vst1q_u32(sum + i + 0, vaddw_u16(vld1q_u32(sum + i + 0), vget_low_u16(lo)));
+        vst1q_u32(sum + i + 4, vaddw_u16(vld1q_u32(sum + i + 4), vget_high_u16(lo)));
+        vst1q_u32(sum + i + 8, vaddw_u16(vld1q_u32(sum + i + 8), vget_low_u16(hi)));
+        vst1q_u32(sum + i + 12, vaddw_u16(vld1q_u32(sum + i + 12), vget_high_u16(hi)));
+    }
+#endif
+    for (; i < n; ++i)
+        sum[i] += row[i];
+}
+
+/*
+ * 面积平均输出第[begin, end)行
+ * 纵向把覆盖到的源行逐行累加(SIMD), 这一步读完整个源图, 占了绝大部分时间;
+ * 横向再把每段的列和加起来除以像素数。横向每个输出像素对应的段长不固定,
+ * 又是3字节一个像素, SSE2/NEON没有合适的gather, 而它只处理纵向累加后的一行,
+ * 数据量是纵向的1/段高, 所以保持标量。
+ */
+static void boxRows(const uint8_t *src, int srcStride, int srcWidth,
+                    uint32_t *dst, int dstStride, int dstWidth,
+                    const std::vector<int> &xe, const std::vector<int> &ye, int begin, int end)
+{
+    thread_local std::vector<uint32_t> sum;
+    sum.resize(srcWidth * 3);
+
+    for (int y = begin; y < end; ++y) {
+        std::fill(sum.begin(), sum.end(), 0);
+        for (int sy = ye[y]; sy < ye[y + 1]; ++sy)
+            accumulateRow(src + (size_t)sy * srcStride, sum.data(), srcWidth * 3);
+
+        const int rows = ye[y + 1] - ye[y];
+        uint32_t *d = (uint32_t *)((uint8_t *)dst + y * dstStride);
+        for (int x = 0; x < dstWidth; ++x) {
+            uint32_t r = 0, g = 0, bl = 0;
+            for (const uint32_t *p = sum.data() + xe[x] * 3, *q = sum.data() + xe[x + 1] * 3; p < q; p += 3) {
+                r += p[0];
+                g += p[1];
+                bl += p[2];
+            }
+            /*除法换成乘24位定点倒数, 和直接除再四舍五入最多差1*/
+            const uint32_t count = (uint32_t)(rows * (xe[x + 1] - xe[x]));
+            const uint64_t inv = ((1u << 24) + count / 2) / count;
+            r = (uint32_t)((r * inv + (1u << 23)) >> 24);
+            g = (uint32_t)((g * inv + (1u << 23)) >> 24);
+            bl = (uint32_t)((bl * inv + (1u << 23)) >> 24);
+            d[x] = 0xff000000u | (r << 16) | (g << 8) | bl;
+        }
+    }
+}
+
+/*
+ * 双线性输出第[begin, end)行, 每个线程有自己的一行中间缓冲
+ * 横向插值同样保持标量: 源坐标不均匀且是3字节像素, 没有gather时拼向量的开销
+ * 比省下的乘法还多, 而纵向混合之后这一行已经在L1里。
+ */
+static void scaleRows(const uint8_t *src, int srcStride, int srcWidth,
+                      uint32_t *dst, int dstStride, int dstWidth,
+                      const std::vector<int> &xi, const std::vector<int> &xw,
+                      const std::vector<int> &yi, const std::vector<int> &yw, int begin, int end)
+{
+    thread_local std::vector<uint8_t> row;
+    row.resize(srcWidth * 3 + 3);
+
+    for (int y = begin; y < end; ++y) {
+        const uint8_t *a = src + yi[y] * srcStride;
+        const uint8_t *b = yw[y] ? a + srcStride : a;
+        blendRows(a, b, row.data(), srcWidth * 3, yw[y]);
+        /*补一个像素, 横向插值取x+1时不越界*/
+        row[srcWidth * 3 + 0] = row[srcWidth * 3 - 3];
+        row[srcWidth * 3 + 1] = row[srcWidth * 3 - 2];
+        row[srcWidth * 3 + 2] = row[srcWidth * 3 - 1];
+
+        uint32_t *d = (uint32_t *)((uint8_t *)dst + y * dstStride);
+        for (int x = 0; x < dstWidth; ++x) {
+            const uint8_t *p = row.data() + xi[x] * 3;
+            int w = xw[x];
+            int r = (p[0] * (W_ONE - w) + p[3] * w) >> W_BITS;
+            int g = (p[1] * (W_ONE - w) + p[4] * w) >> W_BITS;
+            int bl = (p[2] * (W_ONE - w) + p[5] * w) >> W_BITS;
+            d[x] = 0xff000000u | (uint32_t)(r << 16) | (uint32_t)(g << 8) | (uint32_t)bl;
+        }
+    }
+}
+
+void scaleRgb888ToRgb32(const uint8_t *src, int srcStride, int srcWidth, int srcHeight,
+                        uint32_t *dst, int dstStride, int dstWidth, int dstHeight,
+                        StripePool *pool)
+{
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+        return;
+
+    /*缩小到一半以下时双线性只取每两个源像素中的两个, 会丢细节、出锯齿, 改成面积平均*/
+    if (srcWidth >= dstWidth * 2 && srcHeight >= dstHeight * 2) {
+        std::vector<int> xe, ye;
+        buildEdges(srcWidth, dstWidth, xe);
+        buildEdges(srcHeight, dstHeight, ye);
+        if (!pool) {
+            boxRows(src, srcStride, srcWidth, dst, dstStride, dstWidth, xe, ye, 0, dstHeight);
+            return;
+        }
+        /*每个输出行读(源高/输出高)行源图*/
+        int rows = StripePool::stripeRows((size_t)srcWidth * 3 * ((srcHeight + dstHeight - 1) / dstHeight)
+                                          + (size_t)dstWidth * 4);
+        pool->run(dstHeight, rows, [&](int begin, int end) {
+            boxRows(src, srcStride, srcWidth, dst, dstStride, dstWidth, xe, ye, begin, end);
+        });
+        return;
+    }
+
+    std::vector<int> xi, xw, yi, yw;
+    buildAxis(srcWidth, dstWidth, xi, xw);
+    buildAxis(srcHeight, dstHeight, yi, yw);
+
+    if (!pool) {
+        scaleRows(src, srcStride, srcWidth, dst, dstStride, dstWidth, xi, xw, yi, yw, 0, dstHeight);
+        return;
+    }
+    /*每个输出行大约读两行源图、写一行输出*/
+    int rows = StripePool::stripeRows((size_t)srcWidth * 6 + (size_t)dstWidth * 4);
+    pool->run(dstHeight, rows, [&](int begin, int end) {
+        scaleRows(src, srcStride, srcWidth, dst, dstStride, dstWidth, xi, xw, yi, yw, begin, end);
+    });
+}
@@ -0,0 +1,19 @@
+#ifndef IMAGESCALE_H
+#define IMAGESCALE_H
+
+#include <cstdint>
+
+class StripePool;
+
+/*
+ * RGB888 -> RGB32(0xffRRGGBB) 缩放
+ * 先对两条源行做纵向插值(SIMD), 再按预先算好的横坐标表做横向插值并
+ * 直接输出显示端的原生格式, 整个过程对源图只读一遍。
+ * 两个方向都缩小到一半以下时改用面积平均(纵向SIMD累加), 每个源像素都参与, 不出锯齿。
+ * 给了pool时按输出行切成条带并行缩放, 结果与单线程逐位一致。
+ */
+void scaleRgb888ToRgb32(const uint8_t *src, int srcStride, int srcWidth, int srcHeight,
+                        uint32_t *dst, int dstStride, int dstWidth, int dstHeight,
+                        StripePool *pool = nullptr);
+
+#endif
@@ -0,0 +1,94 @@
+#include "jpegyuv.h"
+#include <csetjmp>
+#include <vector>
+#include <jpeglib.h>
+
+namespace {
+
+struct JpegError {
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+/*libjpeg默认出错时直接exit(), 这里改为跳回调用处返回失败*/
+void jpegErrorExit(j_common_ptr cinfo)
+{
+    JpegError *err = (JpegError *)cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+}
+
+bool writeYuyvJpeg(const uint8_t *yuyv, int stride, int width, int height,
+                   int quality, FILE *out)
+{
+    if (!yuyv || !out || width < 2 || height < 1)
+        return false;
+
+    /*一次写一个MCU行(8行), Y按16像素、色度按8像素对齐, 右边用最后一个像素补齐*/
+    const int rows = DCTSIZE;
+    const int yWidth = (width + 15) & ~15;
+    const int cWidth = yWidth / 2;
+    std::vector<JSAMPLE> planes((size_t)rows * (yWidth + 2 * cWidth));
+    JSAMPROW yRows[DCTSIZE], cbRows[DCTSIZE], crRows[DCTSIZE];
+    for (int i = 0; i < rows; ++i) {
+        yRows[i]  = planes.data() + (size_t)i * yWidth;
+        cbRows[i] = planes.data() + (size_t)rows * yWidth + (size_t)i * cWidth;
+        crRows[i] = planes.data() + (size_t)rows * (yWidth + cWidth) + (size_t)i * cWidth;
+    }
+    JSAMPARRAY data[3] = { yRows, cbRows, crRows };
+
+    jpeg_compress_struct cinfo;
+    JpegError err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpegErrorExit;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, out);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.raw_data_in = TRUE;
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 1;
+    cinfo.comp_info[1].h_samp_factor = 1;
+    cinfo.comp_info[1].v_samp_factor = 1;
+    cinfo.comp_info[2].h_samp_factor = 1;
+    cinfo.comp_info[2].v_samp_factor = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+
+    const int pairs = width / 2;
+    while (cinfo.next_scanline < cinfo.image_height) {
+        for (int i = 0; i < rows; ++i) {
+            /*最后一个MCU行不满8行时重复最后一行*/
+            int line = (int)cinfo.next_scanline + i;
+            if (line >= height) line = height - 1;
+            const uint8_t *s = yuyv + (size_t)line * stride;
+            JSAMPLE *y = yRows[i], *cb = cbRows[i], *cr = crRows[i];
+            for (int x = 0; x < pairs; ++x, s += 4) {
+                y[2 * x]     = s[0];
+                cb[x]        = s[1];
+                y[2 * x + 1] = s[2];
+                cr[x]        = s[3];
+            }
+            for (int x = pairs * 2; x < yWidth; ++x) y[x] = y[pairs * 2 - 1];
+            for (int x = pairs; x < cWidth; ++x) {
+                cb[x] = cb[pairs - 1];
+                cr[x] = cr[pairs - 1];
+            }
+        }
+        jpeg_write_raw_data(&cinfo, data, rows);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return true;
+}
@@ -0,0 +1,16 @@
+#ifndef JPEGYUV_H
+#define JPEGYUV_H
+
+#include <cstdint>
+#include <cstdio>
+
+/*
+ * 直接从YUYV编码JPEG
+ * 走libjpeg的raw_data_in路径, 按4:2:2(Y水平2倍采样)把YUYV拆成
+ * Y/Cb/Cr三个平面喂给编码器, 不经过RGB中转, 也省掉了编码器内部
+ * 的颜色空间转换和下采样。
+ */
+bool writeYuyvJpeg(const uint8_t *yuyv, int stride, int width, int height,
+                   int quality, FILE *out);
+
+#endif
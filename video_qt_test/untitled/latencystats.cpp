@@ -0,0 +1,143 @@
+#include "latencystats.h"
+#include <cstdio>
+#include <ctime>
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+int LatencyHistogram::bucketOf(uint64_t v)
+{
+    if (v < (uint64_t)SUB_COUNT) return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    int sub = (int)((v >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+    return (e - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+uint64_t LatencyHistogram::bucketLow(int index)
+{
+    if (index < SUB_COUNT) return (uint64_t)index;
+    int e = index / SUB_COUNT + SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(index % SUB_COUNT);
+    return (SUB_COUNT + sub) << (e - SUB_BITS);
+}
+
+void LatencyHistogram::record(int64_t ns)
+{
+    /*时钟不一致时可能出现负值, 记为0*/
+    if (ns < 0) ns = 0;
+    m_buckets[bucketOf((uint64_t)ns)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add((uint64_t)ns, std::memory_order_relaxed);
+    int64_t old = m_max.load(std::memory_order_relaxed);
+    while (ns > old && !m_max.compare_exchange_weak(old, ns, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (int i = 0; i < BUCKETS; ++i)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean() const
+{
+    uint64_t n = count();
+    return n ? (double)m_sum.load(std::memory_order_relaxed) / n : 0.0;
+}
+
+int64_t LatencyHistogram::percentile(double p) const
+{
+    /*各格计数是分别读的, 与count()可能略有出入, 以各格之和为准*/
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+        total += m_buckets[i].load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(p * total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t low = bucketLow(i);
+            uint64_t high = (i + 1 < BUCKETS) ? bucketLow(i + 1) : low;
+            int64_t mid = (int64_t)(low + (high - low) / 2);
+            return mid < max() ? mid : max();
+        }
+    }
+    return max();
+}
+
+int64_t LatencyStats::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+const char *LatencyStats::stageName(Stage stage)
+{
+    switch (stage) {
+    case Dequeue: return "dequeue";
+    case Convert: return "convert";
+    case Scale:   return "scale";
+    case Display: return "display";
+    default:      return "unknown";
+    }
+}
+
+void LatencyStats::reset()
+{
+    for (int i = 0; i < StageCount; ++i)
+        m_stages[i].reset();
+}
+
+QString LatencyStats::summary() const
+{
+    QString text;
+    for (int i = 0; i < StageCount; ++i) {
+        const LatencyHistogram &h = m_stages[i];
+        char line[128];
+        snprintf(line, sizeof(line), "%-8s p50 %6.2f  p99 %6.2f  max %6.2f ms\n",
+                 stageName((Stage)i), h.percentile(0.50) / 1e6,
+                 h.percentile(0.99) / 1e6, h.max() / 1e6);
+        text += QString(line);
+    }
+    return text;
+}
+
+std::string LatencyStats::toJson() const
+{
+    std::string json = "{\"timestamp_ns\":" + std::to_string(now()) + ",\"unit\":\"us\",\"stages\":{";
+    for (int i = 0; i < StageCount; ++i) {
+        const LatencyHistogram &h = m_stages[i];
+        char item[256];
+        snprintf(item, sizeof(item),
+                 "%s\"%s\":{\"count\":%llu,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,"
+                 "\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}",
+                 i ? "," : "", stageName((Stage)i), (unsigned long long)h.count(),
+                 h.mean() / 1e3, h.percentile(0.50) / 1e3, h.percentile(0.90) / 1e3,
+                 h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3, h.max() / 1e3);
+        json += item;
+    }
+    json += "}}\n";
+    return json;
+}
+
+bool LatencyStats::dumpTo(const char *path) const
+{
+    std::string tmp = std::string(path) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (!fp) return false;
+    std::string json = toJson();
+    bool ok = fwrite(json.data(), 1, json.size(), fp) == json.size();
+    ok = (fclose(fp) == 0) && ok;
+    return ok && rename(tmp.c_str(), path) == 0;
+}
@@ -0,0 +1,75 @@
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#include <QString>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+ * 无锁的对数-线性延迟直方图(HDR风格)
+ * 每个2的幂区间再均分16格, 相对误差不超过1/16; record()只做一次
+ * relaxed的fetch_add, 任意线程可以同时记录和读取。
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(int64_t ns);
+    void reset();
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    int64_t max() const { return m_max.load(std::memory_order_relaxed); }
+    double mean() const;
+    /*p取0~1, 返回所在格的中点(不超过max)*/
+    int64_t percentile(double p) const;
+
+private:
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS) * SUB_COUNT;
+
+    static int bucketOf(uint64_t v);
+    static uint64_t bucketLow(int index);
+
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<int64_t> m_max;
+};
+
+/*
+ * 采集到显示各阶段的延迟统计
+ * 时间都取CLOCK_MONOTONIC, 与驱动的V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC时间戳可以直接相减。
+ */
+class LatencyStats
+{
+public:
+    enum Stage {
+        Dequeue,    /*驱动打时间戳 -> 出队*/
+        Convert,    /*格式转换/解码耗时*/
+        Scale,      /*预览缩放耗时*/
+        Display,    /*驱动打时间戳 -> 贴到界面上, 即端到端延迟*/
+        StageCount
+    };
+
+    static int64_t now();
+    static const char *stageName(Stage stage);
+
+    void record(Stage stage, int64_t ns) { m_stages[stage].record(ns); }
+    const LatencyHistogram &histogram(Stage stage) const { return m_stages[stage]; }
+    void reset();
+
+    /*界面叠加显示用的多行文本, 单位ms*/
+    QString summary() const;
+    /*机器可读的JSON, 单位us*/
+    std::string toJson() const;
+    /*先写临时文件再rename, 读取方不会看到写了一半的文件*/
+    bool dumpTo(const char *path) const;
+
+private:
+    LatencyHistogram m_stages[StageCount];
+};
+
+#endif
@@ -0,0 +1,279 @@
+#include "mjpegdecoder.h"
+#include "stripepool.h"
+#include <QDebug>
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+
+/*
+ * raw输出一个iMCU行里各分量的行数上限: 采样因子最大MAX_SAMP_FACTOR,
+ * 缩放解码时块高最大是DCTSIZE的两倍
+ */
+static const int MaxRawRows = 3 * MAX_SAMP_FACTOR * DCTSIZE * 2;
+
+struct MjpegDecoder::Context {
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+    /*
+     * raw输出的行指针放在这里而不是readRaw()的栈上: libjpeg出错时longjmp会
+     * 跳过中间的栈帧, 那里不能有需要析构的对象
+     */
+    JSAMPROW rawRows[MaxRawRows];
+};
+
+/*libjpeg默认出错时直接exit(), 这里改为跳回decode()返回空图像*/
+static void decoderErrorExit(j_common_ptr cinfo)
+{
+    longjmp(*(jmp_buf *)cinfo->client_data, 1);
+}
+
+/*坏帧很常见, 不把libjpeg的警告刷到终端上*/
+static void decoderOutputMessage(j_common_ptr)
+{
+}
+
+MjpegDecoder::MjpegDecoder()
+    : m_ctx(new Context)
+{
+    m_ctx->cinfo.err = jpeg_std_error(&m_ctx->mgr);
+    m_ctx->mgr.error_exit = decoderErrorExit;
+    m_ctx->mgr.output_message = decoderOutputMessage;
+    m_ctx->cinfo.client_data = &m_ctx->jump;
+    jpeg_create_decompress(&m_ctx->cinfo);
+}
+
+MjpegDecoder::~MjpegDecoder()
+{
+    jpeg_destroy_decompress(&m_ctx->cinfo);
+}
+
+void MjpegDecoder::setTargetSize(int width, int height)
+{
+    m_targetWidth = width;
+    m_targetHeight = height;
+}
+
+/*读入头部并按目标尺寸选出最大的缩放分母, 缩小后仍不小于目标尺寸*/
+bool MjpegDecoder::begin(const uint8_t *data, size_t size)
+{
+    jpeg_decompress_struct *cinfo = &m_ctx->cinfo;
+    jpeg_mem_src(cinfo, data, (unsigned long)size);
+    if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK)
+        return false;
+
+    int tw = m_targetWidth, th = m_targetHeight;
+    int denom = 1;
+    if (tw > 0 && th > 0) {
+        while (denom < 8 && (int)cinfo->image_width / (denom * 2) >= tw
+               && (int)cinfo->image_height / (denom * 2) >= th)
+            denom *= 2;
+    }
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = denom;
+    cinfo->dct_method = JDCT_ISLOW;
+    m_lastDenom = denom;
+    return true;
+}
+
+/*从池里取一张没有被下游持有的图像, 尺寸不符或都被占用时才重新分配*/
+QImage *MjpegDecoder::acquireImage(int width, int height)
+{
+    const int n = sizeof(m_pool) / sizeof(m_pool[0]);
+    for (int i = 0; i < n; ++i) {
+        QImage *img = &m_pool[(m_poolNext + i) % n];
+        if (!img->isNull() && img->isDetached() && img->width() == width && img->height() == height) {
+            m_poolNext = (m_poolNext + i + 1) % n;
+            return img;
+        }
+    }
+    ++m_poolMisses;
+    QImage *img = &m_pool[m_poolNext];
+    m_poolNext = (m_poolNext + 1) % n;
+    *img = QImage(width, height, QImage::Format_RGB888);
+    return img;
+}
+
+/*
+ * 能不能走平面YUV + NV内核: 三分量YCbCr, 亮度水平2倍采样(4:2:2为h2v1, 4:2:0为h2v2),
+ * 两个色度分量都是1x1, 缩放后的宽度为偶数(NV内核按像素对处理)
+ */
+static bool nvCompatible(jpeg_decompress_struct *cinfo)
+{
+    if (cinfo->num_components != 3 || cinfo->jpeg_color_space != JCS_YCbCr)
+        return false;
+    const jpeg_component_info *comp = cinfo->comp_info;
+    if (comp[0].h_samp_factor != 2 || (comp[0].v_samp_factor != 1 && comp[0].v_samp_factor != 2))
+        return false;
+    for (int c = 1; c < 3; ++c) {
+        if (comp[c].h_samp_factor != 1 || comp[c].v_samp_factor != 1)
+            return false;
+    }
+    jpeg_calc_output_dimensions(cinfo);
+    return (cinfo->output_width & 1) == 0;
+}
+
+QImage MjpegDecoder::decode(const uint8_t *data, size_t size, const YuvTables *tables)
+{
+    jpeg_decompress_struct *cinfo = &m_ctx->cinfo;
+    if (setjmp(m_ctx->jump)) {
+        jpeg_abort_decompress(cinfo);
+        return QImage();
+    }
+    if (!begin(data, size)) {
+        jpeg_abort_decompress(cinfo);
+        return QImage();
+    }
+    if (nvCompatible(cinfo)) {
+        if (!readRaw(&m_planes)) return QImage();
+        return planesToImage(m_planes, tables);
+    }
+
+    cinfo->out_color_space = JCS_RGB;
+    jpeg_start_decompress(cinfo);
+
+    QImage *img = acquireImage((int)cinfo->output_width, (int)cinfo->output_height);
+    /*直接解码到池中图像的各行里*/
+    while (cinfo->output_scanline < cinfo->output_height) {
+        JSAMPROW rows[4];
+        int n = 0;
+        for (; n < 4 && cinfo->output_scanline + n < cinfo->output_height; ++n)
+            rows[n] = img->scanLine((int)cinfo->output_scanline + n);
+        jpeg_read_scanlines(cinfo, rows, n);
+    }
+    jpeg_finish_decompress(cinfo);
+    return *img;
+}
+
+bool MjpegDecoder::decodeToYuv(const uint8_t *data, size_t size, YuvPlanes *out)
+{
+    jpeg_decompress_struct *cinfo = &m_ctx->cinfo;
+    if (setjmp(m_ctx->jump)) {
+        jpeg_abort_decompress(cinfo);
+        return false;
+    }
+    if (!begin(data, size) || cinfo->num_components != 3
+        || cinfo->jpeg_color_space != JCS_YCbCr) {
+        jpeg_abort_decompress(cinfo);
+        return false;
+    }
+    return readRaw(out);
+}
+
+/*在begin()之后按iMCU行读出各分量的原始采样, 出错时跳回调用者设置的setjmp*/
+bool MjpegDecoder::readRaw(YuvPlanes *out)
+{
+    jpeg_decompress_struct *cinfo = &m_ctx->cinfo;
+    cinfo->raw_data_out = TRUE;
+    cinfo->out_color_space = JCS_YCbCr;
+    jpeg_start_decompress(cinfo);
+
+    /*
+     * raw输出按iMCU行进行, 各分量的缓冲区按块大小对齐。缩放解码时libjpeg-turbo会把
+     * 色度分量的DCT缩放尺寸放大(相当于在IDCT里做了上采样), 所以块大小要按分量分别取。
+     */
+#if JPEG_LIB_VERSION >= 70
+    const int lines = cinfo->max_v_samp_factor * cinfo->min_DCT_v_scaled_size;
+#else
+    const int lines = cinfo->max_v_samp_factor * cinfo->min_DCT_scaled_size;
+#endif
+    int compRows[3];
+    size_t total = 0;
+    out->width = (int)cinfo->output_width;
+    out->height = (int)cinfo->output_height;
+    out->components = 3;
+    for (int c = 0; c < 3; ++c) {
+        jpeg_component_info *comp = &cinfo->comp_info[c];
+#if JPEG_LIB_VERSION >= 70
+        const int blockW = comp->DCT_h_scaled_size;
+        const int blockH = comp->DCT_v_scaled_size;
+#else
+        const int blockW = comp->DCT_scaled_size;
+        const int blockH = comp->DCT_scaled_size;
+#endif
+        int w = (int)comp->width_in_blocks * blockW;
+        int h = ((int)comp->height_in_blocks + comp->v_samp_factor) * blockH;
+        compRows[c] = comp->v_samp_factor * blockH;
+        out->planeOffset[c] = (int)total;
+        out->planeStride[c] = w;
+        out->planeWidth[c] = (int)comp->downsampled_width;
+        out->planeHeight[c] = (int)comp->downsampled_height;
+        total += (size_t)w * h;
+    }
+    if (compRows[0] + compRows[1] + compRows[2] > MaxRawRows) {
+        jpeg_abort_decompress(cinfo);
+        cinfo->raw_data_out = FALSE;
+        return false;
+    }
+    out->data.resize(total);
+
+    JSAMPROW *rowPtrs = m_ctx->rawRows;
+    JSAMPARRAY planes[3] = { rowPtrs, rowPtrs + compRows[0], rowPtrs + compRows[0] + compRows[1] };
+
+    while (cinfo->output_scanline < cinfo->output_height) {
+        const int iMcuRow = (int)cinfo->output_scanline / lines;
+        for (int c = 0; c < 3; ++c) {
+            uint8_t *first = out->data.data() + out->planeOffset[c]
+                             + (size_t)iMcuRow * compRows[c] * out->planeStride[c];
+            for (int r = 0; r < compRows[c]; ++r)
+                planes[c][r] = first + (size_t)r * out->planeStride[c];
+        }
+        jpeg_read_raw_data(cinfo, planes, lines);
+    }
+    jpeg_finish_decompress(cinfo);
+    cinfo->raw_data_out = FALSE;
+    return true;
+}
+
+/*
+ * Cb/Cr两个平面交织成NV12/NV16那样的UV平面, 再用半平面内核转成RGB888;
+ * 缩放解码时色度可能已经是全宽或全高, 这时隔一个取一个/逐行对应。
+ * 按条带分给各个核, 条带行数为偶数, 4:2:0的色度行不会被两个条带同时写。
+ */
+QImage MjpegDecoder::planesToImage(const YuvPlanes &planes, const YuvTables *tables)
+{
+    QImage *img = acquireImage(planes.width, planes.height);
+    if (img->isNull()) return QImage();
+
+    const int width = planes.width;
+    const int shift = planes.planeHeight[1] < planes.planeHeight[0] ? 1 : 0;
+    const int step = planes.planeWidth[1] < planes.planeWidth[0] ? 1 : 2;
+    const int uvStride = width;
+    const int uvRows = planes.planeHeight[1];
+    if (m_uv.size() < (size_t)uvStride * uvRows)
+        m_uv.resize((size_t)uvStride * uvRows);
+
+    const uint8_t *base = planes.data.data();
+    const uint8_t *y = base + planes.planeOffset[0];
+    const uint8_t *cb = base + planes.planeOffset[1];
+    const uint8_t *cr = base + planes.planeOffset[2];
+    const int yStride = planes.planeStride[0];
+    const int cStride = planes.planeStride[1];
+    uint8_t *uv = m_uv.data();
+    uint8_t *dst = img->bits();
+    const int dstStride = (int)img->bytesPerLine();
+    const int pairs = width / 2;
+
+    StripePool::shared()->run(planes.height, StripePool::stripeRows((size_t)yStride * 2 + dstStride),
+                              [&](int begin, int end) {
+        int cEnd = ((end - 1) >> shift) + 1;
+        if (cEnd > uvRows) cEnd = uvRows;
+        for (int r = begin >> shift; r < cEnd; ++r) {
+            const uint8_t *u = cb + (size_t)r * cStride;
+            const uint8_t *v = cr + (size_t)r * cStride;
+            uint8_t *d = uv + (size_t)r * uvStride;
+            for (int i = 0; i < pairs; ++i) {
+                d[2 * i] = u[i * step];
+                d[2 * i + 1] = v[i * step];
+            }
+        }
+        const uint8_t *sy = y + (size_t)begin * yStride;
+        const uint8_t *suv = uv + (size_t)(begin >> shift) * uvStride;
+        uint8_t *d = dst + (size_t)begin * dstStride;
+        if (tables)
+            nvToRgb888(*tables, sy, yStride, suv, uvStride, shift, d, dstStride, width, end - begin);
+        else
+            nvToRgb888(YuvKernel::Auto, sy, yStride, suv, uvStride, shift, d, dstStride, width, end - begin);
+    });
+    return *img;
+}
@@ -0,0 +1,72 @@
+#ifndef MJPEGDECODER_H
+#define MJPEGDECODER_H
+
+#include <QImage>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "yuvconvert.h"
+
+/*解码成平面YUV时的输出, 各分量保持JPEG里的原始采样率*/
+struct YuvPlanes {
+    std::vector<uint8_t> data;
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    int planeOffset[3] = {0, 0, 0};
+    int planeStride[3] = {0, 0, 0};
+    int planeWidth[3] = {0, 0, 0};
+    int planeHeight[3] = {0, 0, 0};
+};
+
+/*
+ * 可复用的MJPEG解码器
+ * 解码上下文只创建一次, 每帧只重新绑定输入数据; 根据预览大小选择
+ * IDCT缩放(1/2, 1/4, 1/8), 在DCT域直接缩小, 不用先解出全分辨率。
+ * 4:2:0/4:2:2的YCbCr帧(绝大多数摄像头)解成平面YUV, 色度交织后走和NV12/NV16相同的
+ * SIMD内核, 省掉libjpeg里的色度上采样和逐像素颜色转换; 其它采样方式由libjpeg直接输出RGB。
+ * 输出的QImage来自一个小的循环池, 下游都释放后会被下一帧复用。
+ * 每个实例只能在一个线程里解码, setTargetSize()可在任意线程调用。
+ */
+class MjpegDecoder
+{
+public:
+    MjpegDecoder();
+    ~MjpegDecoder();
+
+    /*预览需要的最小尺寸, 0表示按原始分辨率解码*/
+    void setTargetSize(int width, int height);
+
+    /*tables不为空时YUV路径在转换的同时做画面调节, libjpeg直接输出RGB的帧不调节*/
+    QImage decode(const uint8_t *data, size_t size, const YuvTables *tables = nullptr);
+    /*不做颜色转换, 直接输出平面YUV(跳过解码器里的上采样和YCbCr->RGB)*/
+    bool decodeToYuv(const uint8_t *data, size_t size, YuvPlanes *out);
+
+    /*最近一帧使用的缩放分母(1/2/4/8)*/
+    int scaleDenom() const { return m_lastDenom; }
+    unsigned long poolMisses() const { return m_poolMisses; }
+
+private:
+    struct Context;
+
+    bool begin(const uint8_t *data, size_t size);
+    bool readRaw(YuvPlanes *out);
+    QImage planesToImage(const YuvPlanes &planes, const YuvTables *tables);
+    QImage *acquireImage(int width, int height);
+
+    std::unique_ptr<Context> m_ctx;
+    std::atomic<int> m_targetWidth{0};
+    std::atomic<int> m_targetHeight{0};
+    int m_lastDenom = 1;
+    unsigned long m_poolMisses = 0;
+    /*输出图像池, 深度覆盖采集->缩放->显示路径上同时持有的帧*/
+    QImage m_pool[4];
+    int m_poolNext = 0;
+    /*YUV路径的中间缓冲区, 尺寸不变时每帧复用*/
+    YuvPlanes m_planes;
+    std::vector<uint8_t> m_uv;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "previewscaler.h"
+#include "imagescale.h"
+
+PreviewScaler::PreviewScaler(FrameMailbox *input, QObject *parent)
+    : QThread(parent)
+    , m_input(input)
+    , m_output(new FrameMailbox(this))
+    , m_latency(nullptr)
+    , m_pending(false)
+    , m_running(false)
+    , m_targetChanged(false)
+{
+}
+
+PreviewScaler::~PreviewScaler()
+{
+    stop();
+}
+
+void PreviewScaler::start(Priority priority)
+{
+    m_mutex.lock();
+    m_running = true;
+    m_mutex.unlock();
+    QThread::start(priority);
+}
+
+void PreviewScaler::stop()
+{
+    m_mutex.lock();
+    m_running = false;
+    m_cond.wakeOne();
+    m_mutex.unlock();
+    wait();
+}
+
+void PreviewScaler::setTargetSize(const QSize &size)
+{
+    m_mutex.lock();
+    if (size != m_target) {
+        m_target = size;
+        m_targetChanged = true;
+        m_cond.wakeOne();
+    }
+    m_mutex.unlock();
+}
+
+void PreviewScaler::wake()
+{
+    m_mutex.lock();
+    m_pending = true;
+    m_cond.wakeOne();
+    m_mutex.unlock();
+}
+
+void PreviewScaler::run()
+{
+    QImage last;
+    while (true) {
+        m_mutex.lock();
+        while (m_running && !m_pending && !m_targetChanged)
+            m_cond.wait(&m_mutex);
+        if (!m_running) {
+            m_mutex.unlock();
+            break;
+        }
+        bool resized = m_targetChanged;
+        m_pending = false;
+        m_targetChanged = false;
+        QSize target = m_target;
+        m_mutex.unlock();
+
+        /*只因尺寸变化而重新缩放的旧帧不带采集时间, 不计入端到端延迟*/
+        QImage frame;
+        qint64 captured = 0;
+        if (m_input->take(&frame, &captured)) {
+            last = frame;
+        } else if (!resized || last.isNull()) {
+            continue;
+        }
+
+        qint64 start = LatencyStats::now();
+        QImage scaled = scaleFrame(last, target);
+        if (m_latency)
+            m_latency->record(LatencyStats::Scale, LatencyStats::now() - start);
+        if (!scaled.isNull())
+            m_output->post(scaled, captured);
+    }
+}
+
+QImage PreviewScaler::scaleFrame(const QImage &frame, const QSize &target)
+{
+    if (frame.isNull() || target.isEmpty())
+        return QImage();
+
+    QImage src = frame;
+    if (src.format() != QImage::Format_RGB888)
+        src = src.convertToFormat(QImage::Format_RGB888);
+
+    QSize size = src.size().scaled(target, Qt::KeepAspectRatio);
+    if (size.isEmpty())
+        return QImage();
+
+    QImage out = m_pool.acquire(size.width(), size.height(), QImage::Format_RGB32);
+    if (out.isNull())
+        return QImage();
+    /*
+     * 在本线程里直接缩放, 不用共享条带池: 池的run()是串行的, 会和采集线程的YUV转换
+     * 互相排队。缩放本来就在单独的线程上和转换并行, 缩小时走面积平均, 单线程足够。
+     */
+    scaleRgb888ToRgb32(src.constBits(), (int)src.bytesPerLine(), src.width(), src.height(),
+                       (uint32_t *)out.bits(), (int)out.bytesPerLine(), out.width(), out.height());
+    return out;
+}
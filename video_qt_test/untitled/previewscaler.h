@@ -0,0 +1,60 @@
+#ifndef PREVIEWSCALER_H
+#define PREVIEWSCALER_H
+
+#include <QThread>
+#include <QImage>
+#include <QMutex>
+#include <QSize>
+#include <QWaitCondition>
+#include "framemailbox.h"
+#include "framepool.h"
+#include "latencystats.h"
+
+/*
+ * 预览缩放线程
+ * 从采集线程的信箱取最新帧, 按显示控件的大小(保持宽高比)缩放成
+ * RGB32, 再放进自己的输出信箱; GUI线程拿到的图像可以直接贴图。
+ * 缩放过程中采集线程不受影响, 只会把来不及处理的帧覆盖掉。
+ */
+class PreviewScaler : public QThread
+{
+    Q_OBJECT
+public:
+    explicit PreviewScaler(FrameMailbox *input, QObject *parent = nullptr);
+    ~PreviewScaler();
+
+    /*隐藏QThread::start(), 在线程启动前置位运行标志, 紧接着的stop()不会被run()覆盖*/
+    void start(Priority priority = InheritPriority);
+    void stop();
+    /*显示区域大小, 可在任意线程调用; 改变后会用上一帧立即重新缩放*/
+    void setTargetSize(const QSize &size);
+
+    FrameMailbox *output() const { return m_output; }
+    /*缩放输出图像池的统计*/
+    FramePool::Stats framePoolStats() const { return m_pool.stats(); }
+    /*缩放耗时记录到这里, 需在start()之前设置*/
+    void setLatencyStats(LatencyStats *stats) { m_latency = stats; }
+
+public slots:
+    /*输入信箱有新帧时调用(DirectConnection, 在采集线程里执行)*/
+    void wake();
+
+protected:
+    void run() override;
+
+private:
+    QImage scaleFrame(const QImage &frame, const QSize &target);
+
+    FrameMailbox *m_input;
+    FrameMailbox *m_output;
+    LatencyStats *m_latency;
+    FramePool m_pool;
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    bool m_pending;
+    bool m_running;
+    QSize m_target;
+    bool m_targetChanged;
+};
+
+#endif
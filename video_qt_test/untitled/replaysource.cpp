@@ -0,0 +1,372 @@
+#include "replaysource.h"
+#include "capturemode.h"
+#include <QDebug>
+#include <linux/videodev2.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+/*全部帧文件的只读映射, 最后一个持有者释放时解除映射*/
+struct ReplaySource::Files {
+    struct File {
+        const uint8_t *data;
+        size_t size;
+    };
+    std::vector<File> files;
+    size_t bytes = 0;
+
+    ~Files() {
+        for (const File &f : files)
+            munmap((void *)f.data, f.size);
+    }
+};
+
+static int64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*按扩展名识别格式, 与录像时用的扩展名对应*/
+static uint32_t formatOfFile(const std::string &name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos) return 0;
+    std::string ext = name.substr(dot + 1);
+    if (ext == "yuyv") return V4L2_PIX_FMT_YUYV;
+    if (ext == "nv12") return V4L2_PIX_FMT_NV12;
+    if (ext == "nv16") return V4L2_PIX_FMT_NV16;
+    if (ext == "jpg" || ext == "jpeg") return V4L2_PIX_FMT_MJPEG;
+    return 0;
+}
+
+static bool isRegularFile(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/*文件名序列最多展开这么多个编号, 防止目录里文件异常多时无限增长*/
+static const int MAX_SEQUENCE_FILES = 1000000;
+
+/*把"前缀%d后缀"或"前缀%0Nd后缀"拆开; 路径不是恰好一个整数编号时返回false*/
+static bool splitSequencePattern(const std::string &path, std::string *prefix,
+                                 std::string *suffix, int *width)
+{
+    size_t pos = path.find('%');
+    if (pos == std::string::npos) return false;
+    size_t end = pos + 1;
+    int w = 0;
+    if (end < path.size() && path[end] == '0') {
+        ++end;
+        while (end < path.size() && isdigit((unsigned char)path[end]) && w <= 10)
+            w = w * 10 + (path[end++] - '0');
+        if (!w || w > 10) return false;  /*int最多10位*/
+    }
+    if (end >= path.size() || path[end] != 'd') return false;
+    if (path.find('%', end + 1) != std::string::npos) return false;
+    *prefix = path.substr(0, pos);
+    *suffix = path.substr(end + 1);
+    *width = w;
+    return true;
+}
+
+/*把目录、printf格式的文件名或单个文件展开成按播放顺序排列的文件列表*/
+static std::vector<std::string> listFrameFiles(const std::string &path)
+{
+    std::vector<std::string> list;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path.c_str());
+        if (!dir) return list;
+        while (struct dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.compare(0, 12, "video_frame_") == 0 && formatOfFile(name))
+                list.push_back(path + "/" + name);
+        }
+        closedir(dir);
+        /*编号是定宽补零的, 按文件名排序即按编号排序*/
+        std::sort(list.begin(), list.end());
+    } else if (path.find('%') != std::string::npos) {
+        /*路径不能直接当printf格式串用, 只认一个%d/%0Nd, 其余原样拼接*/
+        std::string prefix, suffix;
+        int width;
+        if (!splitSequencePattern(path, &prefix, &suffix, &width)) {
+            qDebug() << "回放错误: 文件名序列只支持一个 %d 或 %0Nd:" << path.c_str();
+            return list;
+        }
+        for (int i = 0; i < MAX_SEQUENCE_FILES; ++i) {
+            char number[16];
+            snprintf(number, sizeof(number), "%0*d", width, i);
+            std::string name = prefix + number + suffix;
+            if (isRegularFile(name))
+                list.push_back(name);
+            else if (i > 0)
+                break;  /*允许从0或1开始编号, 之后遇到第一个缺号就结束*/
+        }
+    } else if (isRegularFile(path)) {
+        list.push_back(path);
+    }
+    return list;
+}
+
+static void *mapFile(const std::string &path, size_t *size)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    void *data = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        /*预先缺页, 回放时只测处理速度, 不受磁盘和缺页影响*/
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = nullptr;
+        } else {
+            *size = (size_t)st.st_size;
+        }
+    }
+    ::close(fd);
+    return data;
+}
+
+/*由文件大小推出每行字节数, 与格式和尺寸不符时返回0*/
+static int strideOf(uint32_t format, size_t size, int width, int height)
+{
+    size_t rows, minStride;
+    switch (format) {
+    case V4L2_PIX_FMT_YUYV: rows = height; minStride = (size_t)width * 2; break;
+    case V4L2_PIX_FMT_NV12: rows = (size_t)height + (height + 1) / 2; minStride = width; break;
+    case V4L2_PIX_FMT_NV16: rows = (size_t)height * 2; minStride = width; break;
+    default: return 0;  /*MJPEG不按行存放*/
+    }
+    if (!rows || size % rows) return 0;
+    size_t stride = size / rows;
+    /*行尾对齐填充一般不超过256字节, 相差更多说明给的尺寸不对*/
+    return stride >= minStride && stride - minStride < 256 ? (int)stride : 0;
+}
+
+ReplaySource::ReplaySource(const QString &path)
+    : m_path(path)
+{
+}
+
+ReplaySource::~ReplaySource()
+{
+    close();
+}
+
+void ReplaySource::setFrameSize(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+}
+
+void ReplaySource::setFrameRate(double fps)
+{
+    if (fps > 0) m_fps = fps;
+}
+
+unsigned int ReplaySource::frameCount() const
+{
+    return m_files ? (unsigned int)m_files->files.size() : 0;
+}
+
+size_t ReplaySource::mappedBytes() const
+{
+    return m_files ? m_files->bytes : 0;
+}
+
+bool ReplaySource::open()
+{
+    close();
+    std::string path = m_path.toLocal8Bit().constData();
+    std::vector<std::string> names = listFrameFiles(path);
+    if (names.empty()) {
+        qDebug() << "错误: 没有找到回放文件" << m_path;
+        return false;
+    }
+
+    /*只回放和第一个文件格式相同的文件, 原始格式的每个文件大小必须一致*/
+    std::shared_ptr<Files> files = std::make_shared<Files>();
+    m_pixelFormat = formatOfFile(names[0]);
+    m_bytesPerLine = 0;
+    size_t rawSize = 0;
+    for (const std::string &name : names) {
+        if (formatOfFile(name) != m_pixelFormat) {
+            qDebug() << "警告: 跳过格式不同的回放文件" << name.c_str();
+            continue;
+        }
+        size_t size = 0;
+        void *data = mapFile(name, &size);
+        if (!data) {
+            qDebug() << "警告: 无法映射回放文件" << name.c_str();
+            continue;
+        }
+        if (m_pixelFormat != V4L2_PIX_FMT_MJPEG) {
+            int stride = strideOf(m_pixelFormat, size, m_width, m_height);
+            /*和V4L2Camera::frameToImage用同一个标准, 发出去的帧bytesUsed一定够用*/
+            if (!stride || size < captureFrameBytes(m_pixelFormat, stride, m_height)
+                    || (rawSize && size != rawSize)) {
+                qDebug() << "警告: 回放文件大小与尺寸不符, 跳过" << name.c_str() << size;
+                munmap(data, size);
+                continue;
+            }
+            rawSize = size;
+            m_bytesPerLine = stride;
+        }
+        files->files.push_back({(const uint8_t *)data, size});
+        files->bytes += size;
+    }
+    if (files->files.empty()) {
+        qDebug() << "错误: 没有可用的回放文件" << m_path;
+        return false;
+    }
+
+    m_files = files;
+    m_index = 0;
+    m_sequence = 0;
+    m_loopsDone = 0;
+    m_ticks = 0;
+    m_pending = 0;
+    m_yielded = false;
+    m_end = false;
+    m_dropped = 0;
+
+    if (m_paced) {
+        if (!armTimer()) {
+            close();
+            return false;
+        }
+    } else {
+        /*计数非零且从不读取, 始终可读*/
+        m_fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_fd < 0) {
+            qDebug() << "错误: 创建eventfd失败";
+            close();
+            return false;
+        }
+    }
+
+    qDebug() << "回放:" << description();
+    return true;
+}
+
+/*按绝对时间定期到期, 不会因为处理延迟而累积误差*/
+bool ReplaySource::armTimer()
+{
+    m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_fd < 0) {
+        qDebug() << "错误: 创建timerfd失败";
+        return false;
+    }
+    m_periodNs = (int64_t)(1e9 / m_fps);
+    if (m_periodNs < 1) m_periodNs = 1;
+    m_startNs = monotonicNs();
+
+    struct itimerspec spec;
+    int64_t first = m_startNs + m_periodNs;
+    spec.it_value.tv_sec = first / 1000000000LL;
+    spec.it_value.tv_nsec = first % 1000000000LL;
+    spec.it_interval.tv_sec = m_periodNs / 1000000000LL;
+    spec.it_interval.tv_nsec = m_periodNs % 1000000000LL;
+    if (timerfd_settime(m_fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        qDebug() << "错误: 设置timerfd失败";
+        return false;
+    }
+    return true;
+}
+
+void ReplaySource::close()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_files.reset();
+}
+
+/*前进若干帧, 播放到最后一个文件时绕回开头*/
+void ReplaySource::advance(uint64_t frames)
+{
+    const size_t count = m_files->files.size();
+    m_sequence += (uint32_t)frames;
+    m_index += (size_t)(frames % count);
+    m_loopsDone += (unsigned int)(frames / count);
+    if (m_index >= count) {
+        m_index -= count;
+        ++m_loopsDone;
+    }
+    if (m_loops && m_loopsDone >= m_loops)
+        m_end = true;
+}
+
+FrameHandle ReplaySource::dequeueFrame()
+{
+    if (!m_files || m_end) return FrameHandle();
+
+    int64_t timestamp;
+    if (m_paced) {
+        if (!m_pending) {
+            uint64_t expirations = 0;
+            if (read(m_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                return FrameHandle();
+            m_ticks += expirations;
+            m_pending = expirations;
+            /*积压太多时只保留最新的Backlog帧, 和驱动没有空闲缓冲区时一样*/
+            if (m_pending > Backlog) {
+                uint64_t skip = m_pending - Backlog;
+                m_dropped += (unsigned long)skip;
+                m_pending = Backlog;
+                advance(skip);
+                if (m_end) return FrameHandle();
+            }
+        }
+        --m_pending;
+        /*以这一帧对应的到期时刻作为采集时间*/
+        timestamp = m_startNs + (int64_t)(m_ticks - m_pending) * m_periodNs;
+    } else {
+        /*每轮只出一帧, 让调用方回到poll处理其它事件*/
+        if (m_yielded) {
+            m_yielded = false;
+            return FrameHandle();
+        }
+        m_yielded = true;
+        timestamp = monotonicNs();
+    }
+
+    const Files::File &file = m_files->files[m_index];
+    FrameHandle::Info info;
+    info.pixelFormat  = m_pixelFormat;
+    info.width        = m_width;
+    info.height       = m_height;
+    info.bytesPerLine = m_bytesPerLine;
+    info.bytesUsed    = file.size;
+    info.sequence     = m_sequence;
+    info.timestampNs  = timestamp;
+    std::shared_ptr<Files> files = m_files;
+    FrameHandle frame(file.data, info, [files] {});
+    advance(1);
+    return frame;
+}
+
+QString ReplaySource::description() const
+{
+    char text[256];
+    if (m_paced)
+        snprintf(text, sizeof(text), "%u帧 %s %dx%d, 定速%gfps", frameCount(),
+                 captureFormatName(m_pixelFormat), m_width, m_height, m_fps);
+    else
+        snprintf(text, sizeof(text), "%u帧 %s %dx%d, 不限速", frameCount(),
+                 captureFormatName(m_pixelFormat), m_width, m_height);
+    return QString::fromUtf8((std::string(m_path.toLocal8Bit().constData()) + " (" + text + ")").c_str());
+}
@@ -0,0 +1,94 @@
+#ifndef REPLAYSOURCE_H
+#define REPLAYSOURCE_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include "framepool.h"
+#include "framesource.h"
+#include "mjpegdecoder.h"
+
+/*
+ * 回放录好的原始帧文件
+ * 每个文件一帧(video_tset和CameraThread录像生成的video_frame_NNNN.yuyv/.nv12/.nv16/.jpg),
+ * 打开时全部只读mmap并预先缺页, 发出的帧句柄直接指向映射, 不做拷贝。
+ * 定速模式用timerfd按帧率出帧, 消费者来不及取时最多积压Backlog帧, 多出的跳过并计入丢帧,
+ * 跳过的帧也占用sequence, 和驱动丢帧时一样; 不定速模式每轮poll出一帧, 尽快回放。
+ * 不需要加载任何内核模块, 适合在CI里做可重复的吞吐测试。
+ */
+class ReplaySource : public FrameSource
+{
+public:
+    /*
+     * path可以是目录(取其中的video_frame_*文件, 按文件名排序), printf格式的文件名
+     * (如dump/video_frame_%04d.yuyv, 从0或1开始连续编号)或单个文件
+     */
+    explicit ReplaySource(const QString &path = QString());
+    ~ReplaySource();
+
+    /*以下设置需在open之前调用*/
+    void setPath(const QString &path) { m_path = path; }
+    /*原始格式的文件里没有尺寸, 需要指明每帧的宽高; 默认640x480*/
+    void setFrameSize(int width, int height);
+    /*true按setFrameRate的帧率出帧(默认), false尽快出帧*/
+    void setPaced(bool paced) { m_paced = paced; }
+    /*播放几遍, 0为一直循环(默认)*/
+    void setLoops(unsigned int loops) { m_loops = loops; }
+
+    bool open() override;
+    void close() override;
+    int fileDescriptor() const override { return m_fd; }
+    FrameHandle dequeueFrame() override;
+    bool atEnd() const override { return m_end; }
+
+    void setFrameRate(double fps) override;
+
+    MjpegDecoder *mjpegDecoder() override { return &m_decoder; }
+    FramePool *framePool() override { return &m_framePool; }
+    QString description() const override;
+
+    uint32_t pixelFormat() const { return m_pixelFormat; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    unsigned int frameCount() const;
+    size_t mappedBytes() const;
+    /*定速回放时因为积压太多而跳过的帧*/
+    unsigned long droppedFrames() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    /*定速回放时最多积压的帧数, 相当于驱动的缓冲区个数*/
+    static const unsigned int Backlog = 4;
+
+private:
+    struct Files;
+
+    bool armTimer();
+    void advance(uint64_t frames);
+
+    QString m_path;
+    int m_width = 640;
+    int m_height = 480;
+    double m_fps = 30.0;
+    bool m_paced = true;
+    unsigned int m_loops = 0;
+
+    /*所有文件的映射, 发出去的帧句柄也各持有一份引用, 关闭后仍然有效*/
+    std::shared_ptr<Files> m_files;
+    uint32_t m_pixelFormat = 0;
+    int m_bytesPerLine = 0;
+    int m_fd = -1;              /*定速时为timerfd, 不定速时为始终可读的eventfd*/
+    int64_t m_startNs = 0;
+    int64_t m_periodNs = 0;
+    uint64_t m_ticks = 0;       /*timerfd累计到期次数*/
+    uint64_t m_pending = 0;     /*已到期还没取走的帧*/
+    bool m_yielded = false;     /*不定速时本轮已经出过一帧*/
+    size_t m_index = 0;         /*下一帧的文件序号*/
+    uint32_t m_sequence = 0;
+    unsigned int m_loopsDone = 0;
+    bool m_end = false;
+    std::atomic<unsigned long> m_dropped{0};
+
+    MjpegDecoder m_decoder;
+    FramePool m_framePool;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "snapshotencoder.h"
+#include "jpegyuv.h"
+#include "v4l2camera.h"
+#include <QDebug>
+#include <cstdio>
+#include <linux/videodev2.h>
+
+SnapshotEncoder::SnapshotEncoder(int workers, int maxQueue, int quality)
+    : m_maxQueue(maxQueue)
+    , m_quality(quality)
+    , m_running(true)
+{
+    for (int i = 0; i < workers; ++i)
+        m_workers.emplace_back(&SnapshotEncoder::workerLoop, this);
+}
+
+SnapshotEncoder::~SnapshotEncoder()
+{
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_running = false;
+    }
+    m_cond.notify_all();
+    /*已经排队的照片会先写完再退出*/
+    for (std::thread &t : m_workers)
+        t.join();
+}
+
+bool SnapshotEncoder::submit(const FrameHandle &frame, const QString &fileName)
+{
+    if (frame.isNull()) return false;
+    if (m_depth.load() >= m_maxQueue) {
+        ++m_rejected;
+        return false;
+    }
+    Job job;
+    /*拷贝一份再排队, 驱动缓冲区马上就能还回去, 不会因为编码慢而断粮*/
+    job.frame = frame.isZeroCopy() ? FrameHandle::copyOf(frame.data(), frame.info()) : frame;
+    job.fileName = fileName;
+    return enqueue(std::move(job));
+}
+
+bool SnapshotEncoder::submit(const QImage &image, const QString &fileName)
+{
+    if (image.isNull()) return false;
+    Job job;
+    job.image = image;
+    job.fileName = fileName;
+    return enqueue(std::move(job));
+}
+
+bool SnapshotEncoder::enqueue(Job &&job)
+{
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        if (m_depth.load() >= m_maxQueue) {
+            ++m_rejected;
+            return false;
+        }
+        m_queue.push_back(std::move(job));
+        int depth = ++m_depth;
+        int high = m_maxDepth.load();
+        while (depth > high && !m_maxDepth.compare_exchange_weak(high, depth)) {}
+    }
+    m_cond.notify_one();
+    return true;
+}
+
+void SnapshotEncoder::workerLoop()
+{
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            m_cond.wait(locker, [this] { return !m_running || !m_queue.empty(); });
+            if (m_queue.empty()) return;
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        if (encode(job)) {
+            ++m_encoded;
+            qDebug() << "图片已保存为:" << job.fileName;
+        } else {
+            qDebug() << "错误: 保存图片失败" << job.fileName;
+        }
+        --m_depth;
+    }
+}
+
+bool SnapshotEncoder::encode(const Job &job)
+{
+    if (!job.image.isNull())
+        return job.image.save(job.fileName, "JPEG", m_quality);
+
+    const FrameHandle &frame = job.frame;
+    if (!V4L2Camera::frameComplete(frame)) return false;
+    if (frame.pixelFormat() == V4L2_PIX_FMT_YUYV || frame.pixelFormat() == V4L2_PIX_FMT_MJPEG) {
+        FILE *fp = fopen(job.fileName.toLocal8Bit().constData(), "wb");
+        if (!fp) return false;
+        bool ok;
+        if (frame.pixelFormat() == V4L2_PIX_FMT_MJPEG) {
+            /*MJPEG本身就是JPEG, 原样写盘*/
+            ok = fwrite(frame.data(), 1, frame.bytesUsed(), fp) == frame.bytesUsed();
+        } else {
+            ok = writeYuyvJpeg(frame.data(), frame.bytesPerLine(), frame.width(), frame.height(),
+                               m_quality, fp);
+        }
+        ok = (fclose(fp) == 0) && ok;
+        return ok;
+    }
+    return false;
+}
@@ -0,0 +1,62 @@
+#ifndef SNAPSHOTENCODER_H
+#define SNAPSHOTENCODER_H
+
+#include <QImage>
+#include <QString>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "framehandle.h"
+
+/*
+ * 后台拍照编码池
+ * 采集线程只把原始帧拷贝一份放进有界队列就返回, JPEG编码和写盘都在
+ * 工作线程里完成。YUYV帧直接按YUV编码, MJPEG帧原样写盘, 其它格式
+ * 退回QImage::save()。队列满时拒绝新的请求并计数, 从不阻塞采集线程。
+ */
+class SnapshotEncoder
+{
+public:
+    explicit SnapshotEncoder(int workers = 2, int maxQueue = 8, int quality = 90);
+    ~SnapshotEncoder();
+
+    /*提交一帧原始数据, 队列已满时返回false*/
+    bool submit(const FrameHandle &frame, const QString &fileName);
+    /*提交已经转换好的图像*/
+    bool submit(const QImage &image, const QString &fileName);
+
+    int queueDepth() const { return m_depth.load(); }
+    int queueLimit() const { return m_maxQueue; }
+    int maxQueueDepth() const { return m_maxDepth.load(); }
+    unsigned long encodedCount() const { return m_encoded.load(); }
+    unsigned long rejectedCount() const { return m_rejected.load(); }
+
+private:
+    struct Job {
+        FrameHandle frame;
+        QImage image;
+        QString fileName;
+    };
+
+    bool enqueue(Job &&job);
+    void workerLoop();
+    bool encode(const Job &job);
+
+    const int m_maxQueue;
+    const int m_quality;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Job> m_queue;
+    bool m_running;
+
+    std::atomic<int> m_depth{0};        /*排队中加正在编码的任务数*/
+    std::atomic<int> m_maxDepth{0};
+    std::atomic<unsigned long> m_encoded{0};
+    std::atomic<unsigned long> m_rejected{0};
+};
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+/*队列满时的处理方式*/
+enum class OverflowPolicy {
+    DropOldest,     /*丢掉最旧的一项, 新的照样入队(实时预览)*/
+    DropNewest,     /*丢掉要入队的这一项(录像, 保证已排队的连续)*/
+    Block           /*生产者等待消费者腾出空间*/
+};
+
+struct QueueStats {
+    unsigned int capacity = 0;
+    unsigned int depth = 0;         /*当前排队数*/
+    unsigned int maxDepth = 0;
+    unsigned long pushed = 0;
+    unsigned long popped = 0;
+    unsigned long dropped = 0;      /*按策略丢弃的项数*/
+    unsigned long blocked = 0;      /*Block策略下生产者等待的次数*/
+};
+
+/*
+ * 有界单生产者单消费者环形队列
+ * 每个槽带一个序号(Vyukov的做法): 槽空闲时序号为将写入它的位置的两倍, 写满后再加一,
+ * 取走后换成下一圈的位置。用两倍是为了容量为1时空闲和写满的序号不会相同。DropOldest时生产者要和消费者抢队头, 所以队头用CAS推进,
+ * 队尾只有生产者写。入队出队都不加锁, 只有队列空(消费者)或满(Block策略的生产者)
+ * 需要睡眠时才用到互斥量和条件变量。
+ */
+template <class T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(unsigned int capacity, OverflowPolicy policy = OverflowPolicy::DropOldest)
+        : m_capacity(capacity ? capacity : 1)
+        , m_policy(policy)
+        , m_slots(new Slot[m_capacity])
+    {
+        for (size_t i = 0; i < m_capacity; ++i)
+            m_slots[i].seq.store(2 * i, std::memory_order_relaxed);
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /*生产者调用; 被DropNewest丢弃或队列已关闭时返回false*/
+    bool push(T value) {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        for (;;) {
+            if (m_closed.load(std::memory_order_acquire)) return false;
+            size_t seq = slotAt(pos).seq.load(std::memory_order_acquire);
+            if (seq == 2 * pos) break;
+            /*队头的槽还没被取走, 队列已满*/
+            if (m_policy == OverflowPolicy::DropNewest) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (m_policy == OverflowPolicy::DropOldest) {
+                /*抢不到说明消费者正在取这一项, 稍等它放出槽位即可*/
+                if (popSlot(nullptr))
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            m_blocked.fetch_add(1, std::memory_order_relaxed);
+            waitFor([&] { return slotAt(pos).seq.load(std::memory_order_acquire) == 2 * pos; }, -1);
+        }
+
+        Slot &slot = slotAt(pos);
+        slot.value = std::move(value);
+        slot.seq.store(2 * pos + 1, std::memory_order_release);
+        m_tail.store(pos + 1, std::memory_order_release);
+        m_pushed.fetch_add(1, std::memory_order_relaxed);
+
+        unsigned int depth = this->depth();
+        unsigned int high = m_maxDepth.load(std::memory_order_relaxed);
+        while (depth > high && !m_maxDepth.compare_exchange_weak(high, depth)) {}
+        notify();
+        return true;
+    }
+
+    /*消费者调用, 队列空时立即返回false*/
+    bool tryPop(T *out) {
+        if (!popSlot(out)) return false;
+        m_popped.fetch_add(1, std::memory_order_relaxed);
+        if (m_policy == OverflowPolicy::Block) notify();
+        return true;
+    }
+
+    /*消费者调用, 最多等timeoutMs毫秒(小于0为一直等); 超时或已关闭且取空时返回false*/
+    bool pop(T *out, int timeoutMs = -1) {
+        for (;;) {
+            if (tryPop(out)) return true;
+            if (m_closed.load(std::memory_order_acquire)) return tryPop(out);
+            if (!waitFor([&] { return !empty(); }, timeoutMs))
+                return tryPop(out);
+        }
+    }
+
+    /*唤醒所有等待的线程, 之后push失败, pop取完剩余项后失败*/
+    void close() {
+        m_closed.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_cond.notify_all();
+    }
+    bool isClosed() const { return m_closed.load(std::memory_order_acquire); }
+    /*close()之后重新启用, 只能在没有生产者和消费者时调用*/
+    void reopen() { m_closed.store(false, std::memory_order_release); }
+
+    bool empty() const {
+        size_t head = m_head.load(std::memory_order_acquire);
+        return slotAt(head).seq.load(std::memory_order_acquire) != 2 * head + 1;
+    }
+
+    unsigned int depth() const {
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        size_t head = m_head.load(std::memory_order_acquire);
+        return tail > head ? (unsigned int)(tail - head) : 0;
+    }
+
+    unsigned int capacity() const { return (unsigned int)m_capacity; }
+    OverflowPolicy policy() const { return m_policy; }
+
+    QueueStats stats() const {
+        QueueStats st;
+        st.capacity = (unsigned int)m_capacity;
+        st.depth = depth();
+        st.maxDepth = m_maxDepth.load(std::memory_order_relaxed);
+        st.pushed = m_pushed.load(std::memory_order_relaxed);
+        st.popped = m_popped.load(std::memory_order_relaxed);
+        st.dropped = m_dropped.load(std::memory_order_relaxed);
+        st.blocked = m_blocked.load(std::memory_order_relaxed);
+        return st;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<size_t> seq{0};
+        T value;
+    };
+
+    Slot &slotAt(size_t pos) const { return m_slots[pos % m_capacity]; }
+
+    /*消费者取一项, DropOldest时生产者也会来取; out为空时直接丢弃*/
+    bool popSlot(T *out) {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        Slot *slot;
+        for (;;) {
+            slot = &slotAt(pos);
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            ptrdiff_t diff = (ptrdiff_t)(seq - (2 * pos + 1));
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_acq_rel))
+                    break;
+            } else if (diff < 0) {
+                return false;   /*空*/
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);   /*另一方已经取走了这一项*/
+            }
+        }
+        /*先移出来再放出槽位, 丢弃的项在这里析构(帧句柄就此归还驱动)*/
+        T value = std::move(slot->value);
+        slot->value = T();
+        slot->seq.store(2 * (pos + m_capacity), std::memory_order_release);
+        if (out) *out = std::move(value);
+        return true;
+    }
+
+    /*条件不满足时睡眠, 入队出队的一方在waiters非零时才去加锁通知*/
+    template <class Pred>
+    bool waitFor(Pred ready, int timeoutMs) {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        bool ok;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            auto done = [&] { return ready() || m_closed.load(std::memory_order_acquire); };
+            if (timeoutMs < 0) {
+                m_cond.wait(locker, done);
+                ok = true;
+            } else {
+                ok = m_cond.wait_for(locker, std::chrono::milliseconds(timeoutMs), done);
+            }
+        }
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        return ok && ready();
+    }
+
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed) == 0) return;
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_cond.notify_all();
+    }
+
+    const size_t m_capacity;
+    const OverflowPolicy m_policy;
+    std::unique_ptr<Slot[]> m_slots;
+
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+
+    alignas(64) std::atomic<bool> m_closed{false};
+    std::atomic<int> m_waiters{0};
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+
+    std::atomic<unsigned int> m_maxDepth{0};
+    std::atomic<unsigned long> m_pushed{0};
+    std::atomic<unsigned long> m_popped{0};
+    std::atomic<unsigned long> m_dropped{0};
+    std::atomic<unsigned long> m_blocked{0};
+};
+
+#endif
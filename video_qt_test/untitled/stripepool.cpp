@@ -0,0 +1,175 @@
+#include "stripepool.h"
+#include <QDebug>
+#include <algorithm>
+#include <cstdlib>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+static inline void cpuRelax() { _mm_pause(); }
+#elif defined(__aarch64__) || defined(__arm__)
+static inline void cpuRelax() { __asm__ __volatile__("yield"); }
+#else
+static inline void cpuRelax() {}
+#endif
+
+/*工作线程做完一帧后先自旋这么多次再睡眠, 紧接着来的任务不用经过调度器*/
+static const int SpinCount = 4000;
+
+/*本线程发起的run()累计记到的工作线程CPU时间*/
+static thread_local int64_t t_chargedCpuNs = 0;
+
+static int64_t threadCpuNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+StripePool::StripePool(int threads)
+{
+    /*只在允许运行的核上建线程, 每个线程绑定一个核*/
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+    if (threads < 0)
+        threads = cpus.empty() ? 0 : (int)cpus.size() - 1;
+    /*调用线程占一个核, 工作线程从第二个可用核开始依次绑定*/
+    for (int i = 0; i < threads; ++i) {
+        int cpu = cpus.empty() ? -1 : cpus[(i + 1) % cpus.size()];
+        m_workers.emplace_back(&StripePool::workerLoop, this, cpu);
+    }
+}
+
+StripePool::~StripePool()
+{
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_running = false;
+    }
+    m_wake.notify_all();
+    for (std::thread &t : m_workers)
+        t.join();
+}
+
+int StripePool::stripeRows(size_t bytesPerRow, size_t budget)
+{
+    size_t rows = bytesPerRow ? budget / bytesPerRow : budget;
+    rows &= ~(size_t)1;
+    return rows < 2 ? 2 : (int)std::min<size_t>(rows, 1 << 20);
+}
+
+StripePool *StripePool::shared()
+{
+    static StripePool *pool = [] {
+        const char *env = getenv("V4L2_STRIPE_THREADS");
+        StripePool *p = new StripePool(env && *env ? atoi(env) : -1);
+        qDebug() << "条带并行:" << p->threadCount() << "个工作线程";
+        return p;
+    }();
+    return pool;
+}
+
+int64_t StripePool::chargedCpuNs()
+{
+    return t_chargedCpuNs;
+}
+
+void StripePool::runStripes(int rows, int rowsPerStripe, Call call, void *fn)
+{
+    if (rows <= 0) return;
+    if (rowsPerStripe < 1) rowsPerStripe = 1;
+    int stripes = (rows + rowsPerStripe - 1) / rowsPerStripe;
+    if (m_workers.empty() || stripes == 1) {
+        call(fn, 0, rows);
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLocker(m_runLock);
+    Job job;
+    job.call = call;
+    job.fn = fn;
+    job.rows = rows;
+    job.rowsPerStripe = rowsPerStripe;
+    job.stripes = stripes;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        job.generation = m_job.generation + 1;
+        m_job = job;
+        m_done.store(0, std::memory_order_relaxed);
+        m_jobCpuNs.store(0, std::memory_order_relaxed);
+        m_next.store((uint64_t)job.generation << 32, std::memory_order_release);
+    }
+    m_wake.notify_all();
+
+    work(job, false);
+    if (m_done.load(std::memory_order_acquire) < stripes) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        m_finished.wait(locker, [&] { return m_done.load(std::memory_order_acquire) >= stripes; });
+    }
+    /*工作线程先记CPU时间再递增完成数, 这里看到全部完成时时间已经加齐*/
+    t_chargedCpuNs += m_jobCpuNs.load(std::memory_order_relaxed);
+}
+
+/*
+ * 领取并处理条带直到领完。代数和条带号在同一个原子量里, 上一帧迟到的线程
+ * CAS必然失败, 不会碰到新一帧的条带, 也不会把完成数算错。
+ */
+void StripePool::work(const Job &job, bool worker)
+{
+    const uint64_t tag = (uint64_t)job.generation << 32;
+    uint64_t cur = m_next.load(std::memory_order_acquire);
+    for (;;) {
+        if ((cur & ~(uint64_t)0xffffffffu) != tag) return;
+        int stripe = (int)(uint32_t)cur;
+        if (stripe >= job.stripes) return;
+        if (!m_next.compare_exchange_weak(cur, cur + 1, std::memory_order_acq_rel))
+            continue;
+
+        int begin = stripe * job.rowsPerStripe;
+        int end = std::min(begin + job.rowsPerStripe, job.rows);
+        int64_t cpuStart = worker ? threadCpuNs() : 0;
+        job.call(job.fn, begin, end);
+        if (worker)
+            m_jobCpuNs.fetch_add(threadCpuNs() - cpuStart, std::memory_order_relaxed);
+        if (m_done.fetch_add(1, std::memory_order_acq_rel) + 1 == job.stripes) {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_finished.notify_all();
+        }
+        cur = m_next.load(std::memory_order_acquire);
+    }
+}
+
+void StripePool::workerLoop(int cpu)
+{
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    uint32_t seen = 0;
+    for (;;) {
+        for (int i = 0; i < SpinCount; ++i) {
+            if ((uint32_t)(m_next.load(std::memory_order_acquire) >> 32) != seen) break;
+            cpuRelax();
+        }
+        Job job;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            m_wake.wait(locker, [&] { return !m_running || m_job.generation != seen; });
+            if (!m_running) return;
+            job = m_job;
+        }
+        seen = job.generation;
+        work(job, true);
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef STRIPEPOOL_H
+#define STRIPEPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+ * 条带并行池
+ * 常驻的工作线程各自绑定一个核, 把一帧按行切成放得进缓存的横条并行处理。
+ * 调用线程自己也领条带, 全部条带完成后run()才返回; 条带用一个原子计数器领取,
+ * 每帧只有一次唤醒, 没有任务队列和内存分配。
+ * 同一时刻只执行一个run(), 其它线程的调用排队等待。
+ */
+class StripePool
+{
+public:
+    /*threads为工作线程数(不含调用线程), 小于0时按可用核数减一*/
+    explicit StripePool(int threads = -1);
+    ~StripePool();
+
+    /*把[0, rows)按rowsPerStripe切开, 并行调用fn(begin, end)*/
+    template <class F>
+    void run(int rows, int rowsPerStripe, F &&fn) {
+        runStripes(rows, rowsPerStripe, &invoke<typename std::remove_reference<F>::type>, &fn);
+    }
+
+    int threadCount() const { return (int)m_workers.size(); }
+
+    /*每行处理的字节数(读加写)换算成条带行数, 结果为偶数, 保证NV12的色度行不被切开*/
+    static int stripeRows(size_t bytesPerRow, size_t budget = StripeBytes);
+
+    /*进程共享的池, 线程数可由环境变量V4L2_STRIPE_THREADS指定(0表示不并行)*/
+    static StripePool *shared();
+
+    /*
+     * 调用线程发起的run()里, 工作线程处理条带累计用掉的CPU时间(纳秒)
+     * 调用线程自己的CLOCK_THREAD_CPUTIME_ID不含这部分, 两者相加才是每帧的真实开销;
+     * 只算执行条带的时间, 不含工作线程空闲时的自旋。
+     */
+    static int64_t chargedCpuNs();
+
+    /*一个条带的数据量, 按每核L2的一半估算*/
+    static const size_t StripeBytes = 128 * 1024;
+
+private:
+    typedef void (*Call)(void *fn, int begin, int end);
+
+    template <class F>
+    static void invoke(void *fn, int begin, int end) { (*(F *)fn)(begin, end); }
+
+    /*一次run()的参数, 工作线程在锁内拷贝一份*/
+    struct Job {
+        Call call = nullptr;
+        void *fn = nullptr;
+        int rows = 0;
+        int rowsPerStripe = 0;
+        int stripes = 0;
+        uint32_t generation = 0;
+    };
+
+    void runStripes(int rows, int rowsPerStripe, Call call, void *fn);
+    void work(const Job &job, bool worker);
+    void workerLoop(int cpu);
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_runLock;               /*串行化不同线程的run()*/
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_finished;
+    Job m_job;
+    bool m_running = true;
+    /*高32位为任务代数, 低32位为下一个待领取的条带, 一次CAS同时校验两者*/
+    std::atomic<uint64_t> m_next{0};
+    std::atomic<int> m_done{0};
+    std::atomic<int64_t> m_jobCpuNs{0};  /*本次run()里工作线程的CPU时间*/
+};
+
+#endif
@@ -1,14 +1,52 @@
 QT += core gui widgets
 SOURCES += \
     camerathread.cpp \
+    capturemanager.cpp \
+    capturemode.cpp \
+    framearena.cpp \
+    framehandle.cpp \
+    framestamp.cpp \
+    framemailbox.cpp \
+    framepool.cpp \
+    imageadjust.cpp \
+    imagescale.cpp \
+    jpegyuv.cpp \
+    latencystats.cpp \
     main.cpp \
+    mjpegdecoder.cpp \
+    previewscaler.cpp \
+    replaysource.cpp \
+    snapshotencoder.cpp \
+    stripepool.cpp \
     v4l2camera.cpp \
-    widget.cpp
+    v4l2source.cpp \
+    widget.cpp \
+    yuvconvert.cpp
 
 HEADERS += \
     camerathread.h \
+    capturemanager.h \
+    capturemode.h \
+    framearena.h \
+    framehandle.h \
+    framestamp.h \
+    framemailbox.h \
+    framepool.h \
+    framesource.h \
+    imageadjust.h \
+    imagescale.h \
+    jpegyuv.h \
+    latencystats.h \
+    mjpegdecoder.h \
+    previewscaler.h \
+    replaysource.h \
+    snapshotencoder.h \
+    spscqueue.h \
+    stripepool.h \
     v4l2camera.h \
-    widget.h
+    v4l2source.h \
+    widget.h \
+    yuvconvert.h
 
 FORMS += \
     widget.ui
@@ -18,6 +56,9 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 CONFIG += c++17
 
+# 拍照直接从YUV编码JPEG、MJPEG按预览大小缩放解码, 使用libjpeg-turbo
+LIBS += -ljpeg
+
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
@@ -1,22 +1,136 @@
 #include "v4l2camera.h"
+#include "yuvconvert.h"
+#include "framearena.h"
+#include "stripepool.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <linux/udmabuf.h>
+#include <algorithm>
 #include <cstring>
+#include <vector>
+#include <atomic>
+#include <mutex>
 #include <QDebug>
-#include <algorithm>
 
-/*添加一个成员变量来记录当前的像素格式*/
-static v4l2_format current_fmt;
+/*
+ * 单平面和多平面API通用的v4l2_buffer, 多平面时只用一个内存平面
+ * (所有分量放在同一块缓冲区里, NV12/NV16的UV平面紧跟在Y平面之后)。
+ */
+struct V4L2Buffer
+{
+    V4L2Buffer(v4l2_buf_type type, v4l2_memory memory, unsigned int index = 0) {
+        memset(&buf, 0, sizeof(buf));
+        memset(&plane, 0, sizeof(plane));
+        buf.type = type;
+        buf.memory = memory;
+        buf.index = index;
+        if (V4L2_TYPE_IS_MULTIPLANAR(type)) {
+            buf.m.planes = &plane;
+            buf.length = 1;
+        }
+    }
+    V4L2Buffer(const V4L2Buffer &) = delete;
+    V4L2Buffer &operator=(const V4L2Buffer &) = delete;
+
+    bool multiplanar() const { return V4L2_TYPE_IS_MULTIPLANAR(buf.type); }
+    uint32_t length() const { return multiplanar() ? plane.length : buf.length; }
+    uint32_t bytesUsed() const { return multiplanar() ? plane.bytesused : buf.bytesused; }
+    uint32_t offset() const { return multiplanar() ? plane.m.mem_offset : buf.m.offset; }
+    void setUserPtr(void *start, size_t length) {
+        if (multiplanar()) {
+            plane.m.userptr = (unsigned long)start;
+            plane.length = length;
+        } else {
+            buf.m.userptr = (unsigned long)start;
+            buf.length = length;
+        }
+    }
+    void setDmabuf(int dmabuf, size_t length) {
+        if (multiplanar()) {
+            plane.m.fd = dmabuf;
+            plane.length = length;
+        } else {
+            buf.m.fd = dmabuf;
+            buf.length = length;
+        }
+    }
+
+    v4l2_buffer buf;
+    v4l2_plane plane;
+};
+
+/*
+ * 采集缓冲区的共享状态, 由摄像头和所有未释放的帧句柄共同持有。
+ * 关闭设备时只是detach, 真正的munmap(或释放USERPTR内存池、关闭dma-buf)
+ * 推迟到最后一个帧句柄释放之后, 保证消费者手里的零拷贝数据在关闭过程中始终有效。
+ */
+class BufferRing
+{
+public:
+    ~BufferRing() {
+        if (memory != V4L2_MEMORY_USERPTR) {
+            for (unsigned int i = 0; i < capacity; ++i) {
+                if (!buffers[i].start) continue;
+                munmap(buffers[i].start, buffers[i].length);
+            }
+        }
+        for (int dmabuf : dmabufFds) {
+            if (dmabuf >= 0) close(dmabuf);
+        }
+        free(buffers);
+    }
+
+    /*把缓冲区还给驱动, 可在任意线程调用*/
+    bool requeue(unsigned int index) {
+        std::lock_guard<std::mutex> locker(lock);
+        if (fd < 0) return false;
+        V4L2Buffer buf(type, memory, index);
+        if (memory == V4L2_MEMORY_USERPTR)
+            buf.setUserPtr(buffers[index].start, buffers[index].length);
+        else if (memory == V4L2_MEMORY_DMABUF)
+            buf.setDmabuf(dmabufFds[index], buffers[index].length);
+        if (ioctl(fd, VIDIOC_QBUF, &buf.buf) < 0) {
+            qDebug() << "警告: VIDIOC_QBUF 失败";
+            return false;
+        }
+        ++queued;
+        return true;
+    }
+
+    /*设备即将关闭, 之后释放的帧不再入队*/
+    void detach() {
+        std::lock_guard<std::mutex> locker(lock);
+        fd = -1;
+    }
 
-V4L2Camera::V4L2Camera() {}
+    int fd = -1;
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    v4l2_memory memory = V4L2_MEMORY_MMAP;
+    buffer *buffers = nullptr;     /*按capacity分配, 追加缓冲区时不需要realloc*/
+    unsigned int capacity = 0;
+    std::atomic<unsigned int> count{0};
+    FrameArena arena;       /*USERPTR模式下所有缓冲区都切自这里*/
+    /*DMABUF模式下导入的fd, 或MMAP模式下导出的fd; 按capacity分配, -1表示没有*/
+    std::vector<int> dmabufFds;
+    std::atomic<int> queued{0};
+
+private:
+    std::mutex lock;
+};
+
+V4L2Camera::V4L2Camera() {
+    memset(&m_fmt, 0, sizeof(m_fmt));
+    memset(&m_pix, 0, sizeof(m_pix));
+}
 
 V4L2Camera::~V4L2Camera() {
     closeDevice();
 }
 
-bool V4L2Camera::openDevice(const char *deviceName, int width, int height) {
+bool V4L2Camera::openDevice(const char *deviceName, int width, int height, IoMode mode) {
+    m_haveSeq = false;
     fd = open(deviceName, O_RDWR | O_NONBLOCK, 0);
     if (fd < 0) {
         qDebug() << "错误: 无法打开设备" << deviceName;
@@ -24,6 +138,7 @@ bool V4L2Camera::openDevice(const char *deviceName, int width, int height) {
     }
     m_width = width;
     m_height = height;
+    m_ioMode = mode;
     if (!initDevice()) {
         closeDevice();
         return false;
@@ -38,129 +153,713 @@ bool V4L2Camera::initDevice() {
         return false;
     }
 
-    /*尝试多种格式*/
-    memset(&current_fmt, 0, sizeof(current_fmt));
-    current_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    current_fmt.fmt.pix.width       = m_width;
-    current_fmt.fmt.pix.height      = m_height;
-    current_fmt.fmt.pix.field       = V4L2_FIELD_ANY;
-
-    /*首先尝试 YUYV*/
-    current_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-    if (ioctl(fd, VIDIOC_S_FMT, &current_fmt) == 0) {
-        qDebug() << "成功设置格式为 YUYV";
-    } else {
-        /* 如果 YUYV 失败，尝试 MJPEG*/
-        qDebug() << "YUYV 格式设置失败, 正在尝试 MJPEG...";
-        current_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
-        if (ioctl(fd, VIDIOC_S_FMT, &current_fmt) != 0) {
-            qDebug() << "错误: MJPEG 格式也设置失败";
+    /*ISP一类的设备只提供多平面API*/
+    uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_CAPTURE) && (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE))
+        m_bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    else
+        m_bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    if (!negotiateMode())
+        return false;
+
+    /*USERPTR/DMABUF不可用(驱动不支持或内存申请失败)时自动退回MMAP*/
+    if (m_ioMode == IoUserPtr && !initUserPtr()) {
+        qDebug() << "USERPTR 模式不可用, 退回 MMAP";
+        m_ioMode = IoMmap;
+    }
+    if (m_ioMode == IoDmabuf && !initDmabuf()) {
+        qDebug() << "DMABUF 导入模式不可用, 退回 MMAP";
+        m_ioMode = IoMmap;
+    }
+    if (m_ioMode == IoMmap && !initMmap()) {
+        return false;
+    }
+
+    enum v4l2_buf_type type = m_bufType;
+    if (ioctl(fd, VIDIOC_STREAMON, &type) < 0) {
+        qDebug() << "错误: VIDIOC_STREAMON 失败";
+        return false;
+    }
+    return true;
+}
+
+/*
+ * 驱动不支持时S_FMT一般会换成别的格式而不是报错, 所以要核对返回的像素格式;
+ * 多平面API下只接受所有分量在一个内存平面里的格式。
+ */
+bool V4L2Camera::setFormat(uint32_t fourcc) {
+    memset(&m_fmt, 0, sizeof(m_fmt));
+    m_fmt.type = m_bufType;
+    if (m_bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        m_fmt.fmt.pix_mp.width       = m_width;
+        m_fmt.fmt.pix_mp.height      = m_height;
+        m_fmt.fmt.pix_mp.field       = V4L2_FIELD_ANY;
+        m_fmt.fmt.pix_mp.pixelformat = fourcc;
+        m_fmt.fmt.pix_mp.num_planes  = 1;
+        if (ioctl(fd, VIDIOC_S_FMT, &m_fmt) != 0 || m_fmt.fmt.pix_mp.pixelformat != fourcc
+                || m_fmt.fmt.pix_mp.num_planes != 1)
             return false;
+        memset(&m_pix, 0, sizeof(m_pix));
+        m_pix.width        = m_fmt.fmt.pix_mp.width;
+        m_pix.height       = m_fmt.fmt.pix_mp.height;
+        m_pix.pixelformat  = m_fmt.fmt.pix_mp.pixelformat;
+        m_pix.field        = m_fmt.fmt.pix_mp.field;
+        m_pix.bytesperline = m_fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+        m_pix.sizeimage    = m_fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+        return true;
+    }
+    m_fmt.fmt.pix.width       = m_width;
+    m_fmt.fmt.pix.height      = m_height;
+    m_fmt.fmt.pix.field       = V4L2_FIELD_ANY;
+    m_fmt.fmt.pix.pixelformat = fourcc;
+    if (ioctl(fd, VIDIOC_S_FMT, &m_fmt) != 0 || m_fmt.fmt.pix.pixelformat != fourcc)
+        return false;
+    m_pix = m_fmt.fmt.pix;
+    return true;
+}
+
+std::vector<CaptureMode> V4L2Camera::enumerateModes(int width, int height) const {
+    std::vector<CaptureMode> modes;
+    if (fd < 0) return modes;
+
+    struct v4l2_fmtdesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.type = m_bufType;
+    for (desc.index = 0; ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0; ++desc.index) {
+        if (!captureFormatSupported(desc.pixelformat)) continue;
+
+        /*离散尺寸全部列出, 步进/连续的取请求尺寸按步长向上取整后的一个*/
+        std::vector<std::pair<int, int>> sizes;
+        struct v4l2_frmsizeenum fsize;
+        memset(&fsize, 0, sizeof(fsize));
+        fsize.pixel_format = desc.pixelformat;
+        for (fsize.index = 0; ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &fsize) == 0; ++fsize.index) {
+            if (fsize.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+                sizes.push_back({ (int)fsize.discrete.width, (int)fsize.discrete.height });
+                continue;
+            }
+            const v4l2_frmsize_stepwise &sw = fsize.stepwise;
+            uint32_t sw_w = sw.step_width ? sw.step_width : 1;
+            uint32_t sw_h = sw.step_height ? sw.step_height : 1;
+            uint32_t w = std::max<uint32_t>(width, sw.min_width);
+            uint32_t h = std::max<uint32_t>(height, sw.min_height);
+            w = sw.min_width + (w - sw.min_width + sw_w - 1) / sw_w * sw_w;
+            h = sw.min_height + (h - sw.min_height + sw_h - 1) / sw_h * sw_h;
+            sizes.push_back({ (int)std::min(w, sw.max_width), (int)std::min(h, sw.max_height) });
+            break;
+        }
+        /*不支持ENUM_FRAMESIZES的驱动, 只能按请求尺寸去试*/
+        if (sizes.empty())
+            sizes.push_back({ width, height });
+
+        for (const auto &size : sizes) {
+            CaptureMode mode;
+            mode.pixelFormat = desc.pixelformat;
+            mode.width = size.first;
+            mode.height = size.second;
+
+            struct v4l2_frmivalenum ival;
+            memset(&ival, 0, sizeof(ival));
+            ival.pixel_format = desc.pixelformat;
+            ival.width = size.first;
+            ival.height = size.second;
+            bool any = false;
+            for (ival.index = 0; ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0; ++ival.index) {
+                if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+                    mode.intervalNum = ival.discrete.numerator;
+                    mode.intervalDen = ival.discrete.denominator;
+                    modes.push_back(mode);
+                    any = true;
+                    continue;
+                }
+                /*步进/连续的帧间隔: 最快的一档, 以及正好是请求帧率的一档(在范围内时)*/
+                mode.intervalNum = ival.stepwise.min.numerator;
+                mode.intervalDen = ival.stepwise.min.denominator;
+                modes.push_back(mode);
+                double slowest = ival.stepwise.max.numerator
+                        ? (double)ival.stepwise.max.denominator / ival.stepwise.max.numerator : 0.0;
+                if (m_targetFps > 0 && m_targetFps < mode.fps() && m_targetFps >= slowest) {
+                    mode.intervalNum = 1000;
+                    mode.intervalDen = (uint32_t)(m_targetFps * 1000.0 + 0.5);
+                    modes.push_back(mode);
+                }
+                any = true;
+                break;
+            }
+            if (!any) {
+                mode.intervalNum = 0;
+                mode.intervalDen = 0;
+                modes.push_back(mode);
+            }
+        }
+    }
+    return modes;
+}
+
+/*
+ * 枚举设备支持的模式, 按代价选出处理起来最省的一个, 并以驱动返回的格式为准更新尺寸。
+ * 驱动什么都不报告时退回按每像素字节数从少到多依次尝试: NV12 -> NV16 -> YUYV -> MJPEG。
+ */
+bool V4L2Camera::negotiateMode() {
+    const int width = m_width;
+    const int height = m_height;
+    ModeChoice choice = chooseCaptureMode(enumerateModes(width, height), width, height, m_targetFps);
+
+    bool ok = false;
+    if (choice.isValid()) {
+        m_width = choice.mode.width;
+        m_height = choice.mode.height;
+        ok = setFormat(choice.mode.pixelFormat);
+        if (!ok)
+            qDebug() << "警告: 驱动拒绝了选中的模式" << captureModeName(choice.mode).c_str();
+    }
+    if (!ok) {
+        static const uint32_t formats[] = {
+            V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV16, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_MJPEG
+        };
+        m_width = width;
+        m_height = height;
+        for (uint32_t fourcc : formats) {
+            if ((ok = setFormat(fourcc)))
+                break;
         }
-        qDebug() << "成功设置格式为 MJPEG";
+        choice = ModeChoice();
+        choice.reason = "设备没有报告可用的模式, 按格式顺序尝试";
+    }
+    if (!ok) {
+        qDebug() << "错误: NV12/NV16/YUYV/MJPEG 格式都设置失败";
+        return false;
+    }
+
+    /*驱动可能调整了尺寸(对齐或上限), 后续的转换都以它返回的为准*/
+    if ((int)m_pix.width != m_width || (int)m_pix.height != m_height) {
+        qDebug() << "驱动把尺寸从" << m_width << "x" << m_height
+                 << "调整为" << m_pix.width << "x" << m_pix.height;
     }
+    m_width = (int)m_pix.width;
+    m_height = (int)m_pix.height;
+    /*个别驱动不填bytesperline/sizeimage, 按格式补上; MJPEG没有行的概念, 仍为0*/
+    if (!m_pix.bytesperline)
+        m_pix.bytesperline = (uint32_t)captureLineBytes(m_pix.pixelformat, m_width);
+    if (!m_pix.sizeimage)
+        m_pix.sizeimage = (uint32_t)captureFrameBytes(m_pix.pixelformat, (int)m_pix.bytesperline, m_height);
 
+    m_mode = CaptureMode();
+    m_mode.pixelFormat = m_pix.pixelformat;
+    m_mode.width = m_width;
+    m_mode.height = m_height;
+    if (choice.mode.intervalNum)
+        setFrameInterval(choice.mode.intervalNum, choice.mode.intervalDen);
+    else if (m_targetFps > 0)
+        setFrameInterval(1000, (uint32_t)(m_targetFps * 1000.0 + 0.5));
+    m_modeReason = choice.reason;
+
+    qDebug() << "采集模式:" << captureModeName(m_mode).c_str()
+             << (m_bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? "(多平面API)" : "")
+             << ", 转换内核:" << yuvKernelName(YuvKernel::Auto);
+    qDebug() << "选择原因:" << m_modeReason.c_str();
+    return true;
+}
+
+/*设置帧间隔并读回驱动实际采用的值; 不支持S_PARM的驱动保持默认帧率*/
+void V4L2Camera::setFrameInterval(uint32_t numerator, uint32_t denominator) {
+    struct v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = m_bufType;
+    if (ioctl(fd, VIDIOC_G_PARM, &parm) < 0)
+        return;
+    if (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME) {
+        parm.parm.capture.timeperframe.numerator = numerator;
+        parm.parm.capture.timeperframe.denominator = denominator;
+        if (ioctl(fd, VIDIOC_S_PARM, &parm) < 0)
+            qDebug() << "警告: 设置帧率失败";
+    }
+    m_mode.intervalNum = parm.parm.capture.timeperframe.numerator;
+    m_mode.intervalDen = parm.parm.capture.timeperframe.denominator;
+}
+
+/*按策略申请缓冲区, 以驱动实际分配的数量为准; 返回0表示失败*/
+unsigned int V4L2Camera::requestBuffers(v4l2_memory memory) {
     struct v4l2_requestbuffers req;
     memset(&req, 0, sizeof(req));
-    req.count = 4;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-    if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0) {
+    req.count = m_policy.count;
+    req.type = m_bufType;
+    req.memory = memory;
+    if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0 || req.count == 0) {
+        return 0;
+    }
+    if (req.count != m_policy.count) {
+        qDebug() << "申请" << m_policy.count << "个缓冲区, 驱动实际分配了" << req.count << "个";
+    }
+
+    /*自动增长时一次留够数组和内存池的空间*/
+    unsigned int capacity = req.count;
+    if (m_policy.autoGrow && m_policy.maxCount > capacity)
+        capacity = m_policy.maxCount;
+
+    std::shared_ptr<BufferRing> ring = std::make_shared<BufferRing>();
+    ring->fd = fd;
+    ring->type = m_bufType;
+    ring->memory = memory;
+    ring->buffers = (buffer*)calloc(capacity, sizeof(buffer));
+    if (!ring->buffers) {
+        qDebug() << "错误: 缓冲区数组分配失败";
+        std::atomic_store(&m_ring, ring);
+        releaseBuffers(memory);
+        return 0;
+    }
+    ring->capacity = capacity;
+    ring->dmabufFds.assign(capacity, -1);
+    std::atomic_store(&m_ring, ring);
+    return req.count;
+}
+
+bool V4L2Camera::initMmap() {
+    unsigned int count = requestBuffers(V4L2_MEMORY_MMAP);
+    if (count == 0) {
         qDebug() << "错误: VIDIOC_REQBUFS 失败";
         return false;
     }
+    for (unsigned int n = 0; n < count; ++n) {
+        if (!mapBuffer(n)) return false;
+    }
+    return queueBuffers(0, count);
+}
 
-    buffers = (buffer*)calloc(req.count, sizeof(*buffers));
-    for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
-        struct v4l2_buffer buf;
-        memset(&buf, 0, sizeof(buf));
-        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index  = n_buffers;
-        if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
-            qDebug() << "错误: VIDIOC_QUERYBUF 失败";
-            return false;
+bool V4L2Camera::mapBuffer(unsigned int n) {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    V4L2Buffer buf(m_bufType, V4L2_MEMORY_MMAP, n);
+    if (ioctl(fd, VIDIOC_QUERYBUF, &buf.buf) < 0) {
+        qDebug() << "错误: VIDIOC_QUERYBUF 失败";
+        return false;
+    }
+    void *start = mmap(NULL, buf.length(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.offset());
+    if (start == MAP_FAILED) {
+        qDebug() << "错误: mmap 失败";
+        return false;
+    }
+    ring->buffers[n].start = start;
+    ring->buffers[n].length = buf.length();
+    ++ring->count;
+    if (m_exportDmabuf)
+        exportBuffer(n);
+    return true;
+}
+
+/*VIDIOC_EXPBUF把MMAP缓冲区导出为dma-buf, 失败时只是不导出*/
+bool V4L2Camera::exportBuffer(unsigned int n) {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    struct v4l2_exportbuffer exp;
+    memset(&exp, 0, sizeof(exp));
+    exp.type = m_bufType;
+    exp.index = n;
+    exp.flags = O_RDONLY | O_CLOEXEC;
+    if (ioctl(fd, VIDIOC_EXPBUF, &exp) < 0) {
+        qDebug() << "警告: VIDIOC_EXPBUF 失败, 不再导出 dma-buf";
+        m_exportDmabuf = false;
+        return false;
+    }
+    ring->dmabufFds[n] = exp.fd;
+    return true;
+}
+
+/*用udmabuf把memfd包装成dma-buf, 没有外部分配器时给DMABUF导入模式用*/
+static int allocUdmabuf(size_t size)
+{
+    int dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (dev < 0) return -1;
+
+    int memfd = memfd_create("v4l2camera", MFD_ALLOW_SEALING | MFD_CLOEXEC);
+    if (memfd < 0) {
+        close(dev);
+        return -1;
+    }
+    int dmabuf = -1;
+    /*udmabuf要求memfd不能再缩小*/
+    if (ftruncate(memfd, (off_t)size) == 0 && fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) == 0) {
+        struct udmabuf_create create;
+        memset(&create, 0, sizeof(create));
+        create.memfd = memfd;
+        create.flags = UDMABUF_FLAGS_CLOEXEC;
+        create.offset = 0;
+        create.size = size;
+        dmabuf = ioctl(dev, UDMABUF_CREATE, &create);
+    }
+    close(memfd);
+    close(dev);
+    return dmabuf;
+}
+
+bool V4L2Camera::initDmabuf() {
+    unsigned int count = requestBuffers(V4L2_MEMORY_DMABUF);
+    if (count == 0) {
+        qDebug() << "驱动不支持 DMABUF";
+        return false;
+    }
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = m_pix.sizeimage;
+    if (size == 0) size = (size_t)m_width * m_height * 2;
+    size = (size + page - 1) / page * page;
+
+    /*外部给的fd复制一份自己持有; 不够时用udmabuf补齐*/
+    unsigned int capacity = ring->capacity;
+    for (unsigned int n = 0; n < capacity; ++n) {
+        int dmabuf = n < m_importFds.size() ? fcntl(m_importFds[n], F_DUPFD_CLOEXEC, 0)
+                                            : allocUdmabuf(size);
+        if (dmabuf < 0) {
+            if (n < count) {
+                qDebug() << "错误: 没有可用的 dma-buf";
+                releaseBuffers(V4L2_MEMORY_DMABUF);
+                return false;
+            }
+            /*只是自动增长用的余量不够, 缩小容量*/
+            ring->capacity = n;
+            break;
         }
-        buffers[n_buffers].length = buf.length;
-        buffers[n_buffers].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
-        if (buffers[n_buffers].start == MAP_FAILED) {
-            qDebug() << "错误: mmap 失败";
+        size_t length = (size_t)lseek(dmabuf, 0, SEEK_END);
+        void *start = mmap(NULL, length, PROT_READ, MAP_SHARED, dmabuf, 0);
+        ring->dmabufFds[n] = dmabuf;
+        if (start == MAP_FAILED) {
+            qDebug() << "错误: dma-buf mmap 失败";
+            releaseBuffers(V4L2_MEMORY_DMABUF);
             return false;
         }
+        ring->buffers[n].start = start;
+        ring->buffers[n].length = length;
+    }
+    ring->count = count;
+    if (!queueBuffers(0, count)) {
+        releaseBuffers(V4L2_MEMORY_DMABUF);
+        return false;
     }
+    qDebug() << "DMABUF 导入模式:" << count << "个缓冲区"
+             << (m_importFds.empty() ? "(udmabuf)" : "(外部分配)");
+    return true;
+}
 
-    for (unsigned int i = 0; i < n_buffers; ++i) {
-        struct v4l2_buffer buf;
-        memset(&buf, 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
-        if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) {
-            qDebug() << "错误: VIDIOC_QBUF 失败";
+bool V4L2Camera::initUserPtr() {
+    unsigned int count = requestBuffers(V4L2_MEMORY_USERPTR);
+    if (count == 0) {
+        qDebug() << "驱动不支持 USERPTR";
+        return false;
+    }
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+
+    size_t size = m_pix.sizeimage;
+    if (size == 0) size = (size_t)m_width * m_height * 2;
+
+    /*内存池按capacity切槽, 自动增长时直接用空闲的槽*/
+    if (!ring->arena.allocate(size, ring->capacity, m_arenaFlags)) {
+        releaseBuffers(V4L2_MEMORY_USERPTR);
+        return false;
+    }
+    for (unsigned int n = 0; n < ring->capacity; ++n) {
+        ring->buffers[n].start = ring->arena.slot(n);
+        ring->buffers[n].length = ring->arena.slotSize();
+    }
+    ring->count = count;
+    /*驱动可能在QBUF时才拒绝用户内存(对齐、vmalloc限制等)*/
+    if (!queueBuffers(0, count)) {
+        releaseBuffers(V4L2_MEMORY_USERPTR);
+        return false;
+    }
+    qDebug() << "USERPTR 模式:" << count << "个缓冲区, 内存池"
+             << ring->arena.mappedSize() << "字节"
+             << (ring->arena.usesHugeTlb() ? "(大页)" : "(普通页)")
+             << (ring->arena.isLocked() ? "已锁定" : "");
+    return true;
+}
+
+bool V4L2Camera::queueBuffers(unsigned int first, unsigned int count) {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    for (unsigned int i = first; i < first + count; ++i) {
+        if (!ring->requeue(i)) {
+            qDebug() << "错误: 缓冲区" << i << "入队失败";
             return false;
         }
     }
+    return true;
+}
 
-    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (ioctl(fd, VIDIOC_STREAMON, &type) < 0) {
-        qDebug() << "错误: VIDIOC_STREAMON 失败";
+/*
+ * 运行中用VIDIOC_CREATE_BUFS追加缓冲区, 不需要停流。
+ * 只在采集线程里调用, 新缓冲区的下标接在已有缓冲区之后。
+ */
+bool V4L2Camera::growBuffers(unsigned int extra) {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    unsigned int count = ring->count;
+    if (count + extra > ring->capacity) extra = ring->capacity - count;
+    if (extra == 0) return false;
+
+    struct v4l2_create_buffers create;
+    memset(&create, 0, sizeof(create));
+    create.count = extra;
+    create.memory = ring->memory;
+    create.format = m_fmt;
+    if (ioctl(fd, VIDIOC_CREATE_BUFS, &create) < 0 || create.count == 0) {
+        qDebug() << "警告: VIDIOC_CREATE_BUFS 失败, 停止自动增加缓冲区";
+        m_policy.autoGrow = false;
         return false;
     }
+    /*驱动分配的下标必须紧跟在已有的之后, 且不超过预留的数组*/
+    if (create.index != count || create.index + create.count > ring->capacity) {
+        qDebug() << "警告: 驱动追加的缓冲区下标异常, 停止自动增加缓冲区";
+        m_policy.autoGrow = false;
+        return false;
+    }
+    for (unsigned int n = count; n < count + create.count; ++n) {
+        if (ring->memory == V4L2_MEMORY_MMAP) {
+            if (!mapBuffer(n)) return false;
+        } else {
+            ++ring->count;
+        }
+    }
+    if (!queueBuffers(count, create.count)) return false;
+    m_grown += create.count;
+    qDebug() << "检测到丢帧, 缓冲区增加到" << ring->count << "个";
     return true;
 }
 
+/*放弃已申请的缓冲区, 让驱动回到可以重新REQBUFS的状态*/
+void V4L2Camera::releaseBuffers(v4l2_memory memory) {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    if (ring) ring->detach();
+    std::atomic_store(&m_ring, std::shared_ptr<BufferRing>());
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = 0;
+    req.type = m_bufType;
+    req.memory = memory;
+    ioctl(fd, VIDIOC_REQBUFS, &req);
+}
+
 QImage V4L2Camera::getFrame() {
-    if (fd < 0) return QImage();
-    struct v4l2_buffer buf;
-    memset(&buf, 0, sizeof(buf));
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
+    FrameHandle frame = dequeueFrame();
+    if (frame.isNull()) return QImage();
+    /*frame离开作用域时缓冲区自动还给驱动*/
+    return frameToImage(frame, &m_decoder, nullptr, &m_framePool);
+}
+
+FrameHandle V4L2Camera::dequeueFrame() {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    if (fd < 0 || !ring) return FrameHandle();
+    V4L2Buffer dq(ring->type, ring->memory);
+    const v4l2_buffer &buf = dq.buf;
 
-    if (ioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
-        return QImage();
+    if (ioctl(fd, VIDIOC_DQBUF, &dq.buf) < 0) {
+        return FrameHandle();
     }
+    int left = --ring->queued;
 
-    QImage image;
-    /*根据当前格式选择不同的处理方式*/
-    if (current_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV) {
-        /*YUYV to RGB转换*/
-        image = QImage(m_width, m_height, QImage::Format_RGB888);
-        unsigned char* yuyv = (unsigned char*)buffers[buf.index].start;
-        unsigned char* rgb = image.bits();
-        for (int i = 0; i < m_width * m_height / 2; ++i) {
-            int y1 = yuyv[i*4 + 0];
-            int u  = yuyv[i*4 + 1] - 128;
-            int y2 = yuyv[i*4 + 2];
-            int v  = yuyv[i*4 + 3] - 128;
-            auto clamp = [](int val) { return (unsigned char)std::max(0, std::min(val, 255)); };
-            rgb[i*6 + 0] = clamp(y1 + 1.402 * v);
-            rgb[i*6 + 1] = clamp(y1 - 0.344 * u - 0.714 * v);
-            rgb[i*6 + 2] = clamp(y1 + 1.772 * u);
-            rgb[i*6 + 3] = clamp(y2 + 1.402 * v);
-            rgb[i*6 + 4] = clamp(y2 - 0.344 * u - 0.714 * v);
-            rgb[i*6 + 5] = clamp(y2 + 1.772 * u);
+    /*用户空间持有的缓冲区数及驱动侧丢帧, 供调整缓冲区个数参考*/
+    unsigned int held = ring->count - (unsigned int)left;
+    if (held > m_maxHeld) m_maxHeld = held;
+    bool dropped = false;
+    if (m_haveSeq && buf.sequence != m_lastSeq + 1) {
+        uint32_t gap = buf.sequence - m_lastSeq - 1;
+        if (gap < 0x80000000u) {
+            m_sequenceGaps += gap;
+            dropped = true;
         }
-    } else if (current_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG) {
-        /*MJPEG格式，直接用Qt的解码功能*/
-        image = QImage::fromData((const uchar *)buffers[buf.index].start, buf.bytesused, "JPEG");
     }
+    m_haveSeq = true;
+    m_lastSeq = buf.sequence;
+
+    FrameHandle::Info info;
+    info.pixelFormat  = m_pix.pixelformat;
+    info.width        = m_width;
+    info.height       = m_height;
+    info.bytesPerLine = (int)m_pix.bytesperline;
+    info.bytesUsed    = dq.bytesUsed();
+    info.sequence     = buf.sequence;
+    info.index        = buf.index;
+    info.dmabufFd     = ring->dmabufFds[buf.index];
+    /*只有单调时钟的时间戳才能和LatencyStats::now()相减*/
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+        info.timestampNs = (int64_t)buf.timestamp.tv_sec * 1000000000LL
+                         + (int64_t)buf.timestamp.tv_usec * 1000;
+    const uint8_t *data = (const uint8_t *)ring->buffers[buf.index].start;
+
+    /*消费者持有的帧太多, 驱动队列见底: 按策略拷贝或丢弃, 不让驱动断粮*/
+    if (left < (int)m_minQueued) {
+        ++m_starved;
+        if (!m_starveReported) {
+            qDebug() << "警告: 驱动队列仅剩" << left << "个缓冲区, 消费者持有的帧过多,"
+                     << (m_starvePolicy == CopyWhenStarved ? "改为拷贝" : "丢弃该帧");
+            m_starveReported = true;
+        }
+        FrameHandle frame;
+        if (m_starvePolicy == CopyWhenStarved)
+            frame = FrameHandle::copyOf(data, info);
+        ring->requeue(buf.index);
+        if (m_policy.autoGrow) growBuffers(2);
+        return frame;
+    }
+    m_starveReported = false;
+    if (dropped && m_policy.autoGrow) growBuffers(2);
+
+    unsigned int index = buf.index;
+    return FrameHandle(data, info, [ring, index]() { ring->requeue(index); });
+}
+
+FrameHandle V4L2Camera::dequeueLatestFrame(unsigned int *skipped) {
+    FrameHandle latest;
+    unsigned int n = 0;
+    for (;;) {
+        FrameHandle frame = dequeueFrame();
+        if (frame.isNull()) break;
+        if (!latest.isNull()) ++n;
+        latest = frame;   /*旧帧的引用在此释放, 缓冲区回到驱动*/
+    }
+    if (skipped) *skipped = n;
+    return latest;
+}
 
-    if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) {
-        qDebug() << "警告: VIDIOC_QBUF 失败";
+QImage V4L2Camera::frameToImage(const FrameHandle &frame, MjpegDecoder *decoder,
+                                 const YuvTables *tables, FramePool *pool) {
+    QImage image;
+    if (frame.isNull()) return image;
+    if (!frameComplete(frame)) {
+        /*截断的帧按行读会越界, 丢弃; 只在第一次出现时提示*/
+        static std::atomic<bool> reported(false);
+        if (!reported.exchange(true))
+            qDebug() << "警告: 帧数据不完整, 丢弃" << captureFormatName(frame.pixelFormat())
+                     << frame.bytesUsed() << "字节";
+        return image;
+    }
+    /*调节参数为默认值时不查表, 直接走SIMD内核*/
+    if (tables && tables->identity) tables = nullptr;
+    /*根据帧格式选择不同的处理方式*/
+    if (frame.pixelFormat() == V4L2_PIX_FMT_YUYV) {
+        /*YUYV to RGB转换, 由yuvconvert按CPU能力选择SIMD内核, 按条带分给各个核; 有画面调节时查表转换*/
+        image = pool ? pool->acquire(frame.width(), frame.height(), QImage::Format_RGB888)
+                     : QImage(frame.width(), frame.height(), QImage::Format_RGB888);
+        if (image.isNull()) return image;
+        const uint8_t *src = frame.data();
+        int srcStride = frame.bytesPerLine();
+        uint8_t *dst = image.bits();
+        int dstStride = (int)image.bytesPerLine();
+        int width = frame.width();
+        StripePool::shared()->run(frame.height(), StripePool::stripeRows(srcStride + dstStride),
+                                  [&](int begin, int end) {
+            if (tables)
+                yuyvToRgb888(*tables, src + (size_t)begin * srcStride, srcStride,
+                             dst + (size_t)begin * dstStride, dstStride, width, end - begin);
+            else
+                yuyvToRgb888(src + (size_t)begin * srcStride, srcStride,
+                             dst + (size_t)begin * dstStride, dstStride, width, end - begin);
+        });
+    } else if (frame.pixelFormat() == V4L2_PIX_FMT_NV12 || frame.pixelFormat() == V4L2_PIX_FMT_NV16) {
+        /*半平面格式, UV平面紧跟在Y平面之后, 两个平面每行字节数相同; 条带行数为偶数, NV12的色度行不会被切开*/
+        image = pool ? pool->acquire(frame.width(), frame.height(), QImage::Format_RGB888)
+                     : QImage(frame.width(), frame.height(), QImage::Format_RGB888);
+        if (image.isNull()) return image;
+        int shift = frame.pixelFormat() == V4L2_PIX_FMT_NV12 ? 1 : 0;
+        const uint8_t *y = frame.data();
+        int stride = frame.bytesPerLine();
+        const uint8_t *uv = y + (size_t)stride * frame.height();
+        uint8_t *dst = image.bits();
+        int dstStride = (int)image.bytesPerLine();
+        int width = frame.width();
+        StripePool::shared()->run(frame.height(), StripePool::stripeRows(stride * 2 + dstStride),
+                                  [&](int begin, int end) {
+            const uint8_t *sy = y + (size_t)begin * stride;
+            const uint8_t *suv = uv + (size_t)(begin >> shift) * stride;
+            uint8_t *d = dst + (size_t)begin * dstStride;
+            if (tables)
+                nvToRgb888(*tables, sy, stride, suv, stride, shift, d, dstStride, width, end - begin);
+            else if (shift)
+                nv12ToRgb888(sy, stride, suv, stride, d, dstStride, width, end - begin);
+            else
+                nv16ToRgb888(sy, stride, suv, stride, d, dstStride, width, end - begin);
+        });
+    } else if (frame.pixelFormat() == V4L2_PIX_FMT_MJPEG) {
+        /*MJPEG格式, 优先用可复用的解码器, 可以按预览大小在DCT域缩小, 常见的YCbCr采样走YUV内核*/
+        if (decoder)
+            image = decoder->decode(frame.data(), frame.bytesUsed(), tables);
+        else
+            image = QImage::fromData(frame.data(), (int)frame.bytesUsed(), "JPEG");
     }
     return image;
 }
 
+bool V4L2Camera::frameComplete(const FrameHandle &frame) {
+    if (frame.pixelFormat() == V4L2_PIX_FMT_MJPEG) {
+        /*MJPEG没有固定大小, 至少要以SOI开头、以EOI结尾(有的摄像头在EOI后面补零)*/
+        const uint8_t *p = frame.data();
+        size_t n = frame.bytesUsed();
+        if (!p || n < 4 || p[0] != 0xff || p[1] != 0xd8) return false;
+        while (n > 4 && p[n - 1] == 0) --n;
+        return p[n - 2] == 0xff && p[n - 1] == 0xd9;
+    }
+    return frame.bytesUsed() >= captureFrameBytes(frame.pixelFormat(), frame.bytesPerLine(), frame.height());
+}
+
+void V4L2Camera::setStarvePolicy(StarvePolicy policy, unsigned int minQueued) {
+    m_starvePolicy = policy;
+    m_minQueued = minQueued;
+}
+
+void V4L2Camera::setBufferPolicy(const BufferPolicy &policy) {
+    m_policy = policy;
+    if (m_policy.count < 1) m_policy.count = 1;
+    if (m_policy.maxCount < m_policy.count) m_policy.maxCount = m_policy.count;
+    if (m_policy.maxCount > VIDEO_MAX_FRAME) m_policy.maxCount = VIDEO_MAX_FRAME;
+}
+
+V4L2Camera::BufferStats V4L2Camera::bufferStats() const {
+    BufferStats st;
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    if (ring) {
+        st.count = ring->count;
+        int queued = ring->queued.load();
+        st.queued = queued > 0 ? (unsigned int)queued : 0;
+        st.held = st.count > st.queued ? st.count - st.queued : 0;
+    }
+    st.maxHeld = m_maxHeld;
+    st.starved = m_starved;
+    st.sequenceGaps = m_sequenceGaps;
+    st.grown = m_grown;
+    return st;
+}
+
+unsigned int V4L2Camera::bufferCount() const {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    return ring ? ring->count.load() : 0;
+}
+
+int V4L2Camera::dmabufFd(unsigned int index) const {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    if (!ring || index >= ring->count) return -1;
+    return ring->dmabufFds[index];
+}
+
+void V4L2Camera::setImportDmabufs(const std::vector<int> &fds) {
+    m_importFds = fds;
+}
+
+const FrameArena *V4L2Camera::frameArena() const {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    return (ring && ring->memory == V4L2_MEMORY_USERPTR) ? &ring->arena : nullptr;
+}
+
+unsigned int V4L2Camera::queuedBuffers() const {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
+    return ring ? (unsigned int)ring->queued.load() : 0;
+}
+
 void V4L2Camera::uninitDevice() {
+    std::shared_ptr<BufferRing> ring = std::atomic_load(&m_ring);
     if (fd < 0) return;
-    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    /*先detach, 之后仍被消费者持有的帧释放时不会再QBUF*/
+    if (ring) ring->detach();
+    enum v4l2_buf_type type = m_bufType;
     ioctl(fd, VIDIOC_STREAMOFF, &type);
-    for (unsigned int i = 0; i < n_buffers; ++i) {
-        munmap(buffers[i].start, buffers[i].length);
-    }
-    free(buffers);
-    buffers = nullptr;
-    n_buffers = 0;
+    /*munmap由最后一个持有者完成*/
+    std::atomic_store(&m_ring, std::shared_ptr<BufferRing>());
 }
 
 void V4L2Camera::closeDevice() {
@@ -171,6 +870,18 @@ void V4L2Camera::closeDevice() {
     }
 }
 
+bool V4L2Camera::setTestPattern(int pattern) {
+    if (fd < 0) return false;
+    struct v4l2_control ctl;
+    ctl.id = V4L2_CID_TEST_PATTERN;
+    ctl.value = pattern;
+    if (ioctl(fd, VIDIOC_S_CTRL, &ctl) != 0) {
+        qDebug() << "错误: 设置测试图案失败";
+        return false;
+    }
+    return true;
+}
+
 bool V4L2Camera::setBrightness(int value) {
     if (fd < 0) return false;
     struct v4l2_control ctl;
@@ -4,33 +4,165 @@
 #include <QString>
 #include <QImage>
 #include <linux/videodev2.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "capturemode.h"
+#include "framearena.h"
+#include "framehandle.h"
+#include "framepool.h"
+#include "mjpegdecoder.h"
+#include "yuvconvert.h"
 
 struct buffer {
     void   *start;
     size_t length;
 };
 
+class BufferRing;
+
 class V4L2Camera
 {
 public:
+    /*出队后驱动队列里剩余的缓冲区低于下限时(消费者持有太多帧)的处理方式*/
+    enum StarvePolicy {
+        CopyWhenStarved,   /*拷贝出一份, 缓冲区立即还给驱动*/
+        DropWhenStarved    /*丢弃这一帧, 缓冲区立即还给驱动*/
+    };
+
+    /*缓冲区的内存来源*/
+    enum IoMode {
+        IoMmap,     /*驱动分配, mmap到用户空间*/
+        IoUserPtr,  /*从自己的内存池分配, 以USERPTR方式入队; 不支持时自动退回MMAP*/
+        IoDmabuf    /*导入dma-buf(外部给的或udmabuf分配的), 以DMABUF方式入队; 不支持时自动退回MMAP*/
+    };
+
+    /*缓冲区个数策略, 在openDevice之前设置*/
+    struct BufferPolicy {
+        unsigned int count = 4;         /*初始申请数, 越少延迟越低*/
+        unsigned int maxCount = 16;     /*自动增长的上限*/
+        bool autoGrow = false;          /*饥饿或驱动丢帧时用CREATE_BUFS追加*/
+    };
+
+    /*缓冲区使用情况, 可在任意线程读取*/
+    struct BufferStats {
+        unsigned int count = 0;         /*驱动实际分配的缓冲区数*/
+        unsigned int queued = 0;        /*在驱动队列里等待填充*/
+        unsigned int held = 0;          /*已出队、仍被用户空间持有*/
+        unsigned int maxHeld = 0;       /*held的历史最大值*/
+        unsigned long starved = 0;
+        unsigned long sequenceGaps = 0; /*驱动sequence不连续, 即驱动侧丢的帧*/
+        unsigned int grown = 0;         /*自动追加的缓冲区数*/
+    };
+
     V4L2Camera();
     ~V4L2Camera();
 
-    bool openDevice(const char *deviceName, int width, int height);
+    /*width/height为需要的输出尺寸, 实际采集模式按代价从设备支持的模式里选*/
+    bool openDevice(const char *deviceName, int width, int height, IoMode mode = IoMmap);
     void closeDevice();
     QImage getFrame();
 
+    /*零拷贝取帧: 返回的句柄直接指向mmap缓冲区, 最后一个引用释放时才QBUF*/
+    FrameHandle dequeueFrame();
+    /*取出驱动里所有已就绪的帧, 只保留最新的一帧, 较旧的立即还给驱动*/
+    FrameHandle dequeueLatestFrame(unsigned int *skipped = nullptr);
+    /*
+     * decoder为空时MJPEG退回Qt的图像插件解码; tables不为空时YUV格式在转换的同时做画面调节;
+     * pool不为空时YUV格式的输出图像从池里取, 不再每帧分配; 数据不完整的帧返回空图像
+     */
+    static QImage frameToImage(const FrameHandle &frame, MjpegDecoder *decoder = nullptr,
+                               const YuvTables *tables = nullptr, FramePool *pool = nullptr);
+    /*
+     * bytesUsed够不够帧格式和尺寸所需(见captureFrameBytes), 按行读原始数据之前都要检查;
+     * MJPEG检查SOI和EOI标记, 空帧和截断的帧都不算完整
+     */
+    static bool frameComplete(const FrameHandle &frame);
+    /*本摄像头的MJPEG解码器, 只能在采集线程里使用*/
+    MjpegDecoder *mjpegDecoder() { return &m_decoder; }
+    /*本摄像头转换输出用的图像池, 可在任意线程查询统计*/
+    FramePool *framePool() { return &m_framePool; }
+
+    void setStarvePolicy(StarvePolicy policy, unsigned int minQueued = 1);
+    void setBufferPolicy(const BufferPolicy &policy);
+    BufferPolicy bufferPolicy() const { return m_policy; }
+    BufferStats bufferStats() const;
+    unsigned int bufferCount() const;
+    unsigned int queuedBuffers() const;     /*当前仍在驱动队列中的缓冲区数*/
+    unsigned long starvedFrames() const { return m_starved; }
+
+    /*需要的帧率, 在openDevice之前设置; 默认30*/
+    void setFrameRate(double fps) { m_targetFps = fps; }
+    /*枚举设备支持的格式/尺寸/帧间隔, 连续或步进的尺寸只取最接近width x height的一个*/
+    std::vector<CaptureMode> enumerateModes(int width, int height) const;
+    /*实际生效的模式(以S_FMT/S_PARM返回的为准)和选择它的原因*/
+    CaptureMode captureMode() const { return m_mode; }
+    QString modeReason() const { return QString::fromUtf8(m_modeReason.c_str()); }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
     bool setBrightness(int value);
+    /*V4L2_CID_TEST_PATTERN, vcam驱动: 0纯色 1彩条 2渐变(后两种带帧标记)*/
+    bool setTestPattern(int pattern);
+
+    int fileDescriptor() const { return fd; }
+    /*实际生效的模式, 打开后才有意义*/
+    IoMode ioMode() const { return m_ioMode; }
+    /*USERPTR内存池的FrameArena::Flag组合, 在openDevice之前设置*/
+    void setArenaFlags(int flags) { m_arenaFlags = flags; }
+    /*USERPTR模式下的内存池, 其他模式返回空; 只在设备关闭之前有效*/
+    const FrameArena *frameArena() const;
+
+    /*MMAP模式下把每个缓冲区用VIDIOC_EXPBUF导出为dma-buf, 在openDevice之前设置*/
+    void setExportDmabuf(bool enable) { m_exportDmabuf = enable; }
+    /*IoDmabuf模式下要导入的dma-buf, 内部会dup; 不够时用/dev/udmabuf补齐*/
+    void setImportDmabufs(const std::vector<int> &fds);
+    /*缓冲区对应的dma-buf fd(导出或导入的), 由摄像头持有, 没有时返回-1*/
+    int dmabufFd(unsigned int index) const;
 
 private:
     bool initDevice();
+    bool setFormat(uint32_t fourcc);
+    bool negotiateMode();
+    void setFrameInterval(uint32_t numerator, uint32_t denominator);
     void uninitDevice();
+    unsigned int requestBuffers(v4l2_memory memory);
+    bool initMmap();
+    bool initUserPtr();
+    bool mapBuffer(unsigned int index);
+    bool exportBuffer(unsigned int index);
+    bool initDmabuf();
+    bool queueBuffers(unsigned int first, unsigned int count);
+    bool growBuffers(unsigned int extra);
+    void releaseBuffers(v4l2_memory memory);
 
     int fd = -1;
-    buffer *buffers = nullptr;
-    unsigned int n_buffers = 0;
+    v4l2_format m_fmt;      /*当前的像素格式, 每个摄像头实例各自一份*/
+    v4l2_pix_format m_pix;  /*m_fmt换算成单平面描述, 多平面API时也用它*/
+    v4l2_buf_type m_bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    /*采集线程换掉它时用atomic_store, 其它线程会来查询, 所有读取都用atomic_load取一份引用*/
+    std::shared_ptr<BufferRing> m_ring;
+    MjpegDecoder m_decoder;
+    FramePool m_framePool;
+    StarvePolicy m_starvePolicy = CopyWhenStarved;
+    unsigned int m_minQueued = 1;
+    std::atomic<unsigned long> m_starved{0};
+    bool m_starveReported = false;
     int m_width = 0;
     int m_height = 0;
+    double m_targetFps = 30.0;
+    CaptureMode m_mode;
+    std::string m_modeReason;
+    IoMode m_ioMode = IoMmap;
+    int m_arenaFlags = FrameArena::HugePages;
+    BufferPolicy m_policy;
+    bool m_exportDmabuf = false;
+    std::vector<int> m_importFds;
+    bool m_haveSeq = false;
+    uint32_t m_lastSeq = 0;
+    std::atomic<unsigned long> m_sequenceGaps{0};
+    std::atomic<unsigned int> m_maxHeld{0};
+    std::atomic<unsigned int> m_grown{0};
 };
 
 #endif
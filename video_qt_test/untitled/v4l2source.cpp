@@ -0,0 +1,27 @@
+#include "v4l2source.h"
+
+V4L2Source::V4L2Source()
+    : m_device("/dev/video1")
+    , m_width(640)
+    , m_height(480)
+    , m_ioMode(V4L2Camera::IoMmap)
+{
+}
+
+void V4L2Source::setDevice(const QString &device, int width, int height, V4L2Camera::IoMode mode)
+{
+    m_device = device;
+    m_width = width;
+    m_height = height;
+    m_ioMode = mode;
+}
+
+bool V4L2Source::open()
+{
+    return m_camera.openDevice(m_device.toLocal8Bit().constData(), m_width, m_height, m_ioMode);
+}
+
+QString V4L2Source::description() const
+{
+    return m_device;
+}
@@ -0,0 +1,40 @@
+#ifndef V4L2SOURCE_H
+#define V4L2SOURCE_H
+
+#include "framesource.h"
+#include "v4l2camera.h"
+
+/*V4L2设备作为帧来源, 设备相关的设置和统计通过camera()访问*/
+class V4L2Source : public FrameSource
+{
+public:
+    V4L2Source();
+
+    /*在open之前设置; 默认/dev/video1 640x480 MMAP*/
+    void setDevice(const QString &device, int width, int height,
+                   V4L2Camera::IoMode mode = V4L2Camera::IoMmap);
+    V4L2Camera *camera() { return &m_camera; }
+    const V4L2Camera *camera() const { return &m_camera; }
+
+    bool open() override;
+    void close() override { m_camera.closeDevice(); }
+    int fileDescriptor() const override { return m_camera.fileDescriptor(); }
+    FrameHandle dequeueFrame() override { return m_camera.dequeueFrame(); }
+
+    void setFrameRate(double fps) override { m_camera.setFrameRate(fps); }
+    bool setBrightness(int value) override { return m_camera.setBrightness(value); }
+    bool setTestPattern(int pattern) override { return m_camera.setTestPattern(pattern); }
+
+    MjpegDecoder *mjpegDecoder() override { return m_camera.mjpegDecoder(); }
+    FramePool *framePool() override { return m_camera.framePool(); }
+    QString description() const override;
+
+private:
+    V4L2Camera m_camera;
+    QString m_device;
+    int m_width;
+    int m_height;
+    V4L2Camera::IoMode m_ioMode;
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include "widget.h"
 #include "ui_widget.h"
 #include <QPixmap>
+#include <QResizeEvent>
+#include <QDebug>
 
 Widget::Widget(QWidget *parent)
     : QWidget(parent)
@@ -19,39 +21,110 @@ Widget::Widget(QWidget *parent)
     /* 创建并配置后台工作线程*/
     m_cameraThread = new CameraThread(this);
 
-    /* 连接信号槽：当后台线程发出 newFrame 信号时，调用主窗口的 updateFrame 函数*/
-    connect(m_cameraThread, &CameraThread::newFrame, this, &Widget::updateFrame);
-
-    /* 连接UI按钮的 clicked() 信号到对应的槽函数*/
-    connect(ui->picture, &QPushButton::clicked, this, &Widget::on_picture_clicked);
-    connect(ui->brightness1, &QPushButton::clicked, this, &Widget::on_brightness1_clicked);
-    connect(ui->brightness2, &QPushButton::clicked, this, &Widget::on_brightness2_clicked);
+    /* 缩放线程把采集到的帧缩放到显示区域大小, GUI线程只负责贴图*/
+    m_scaler = new PreviewScaler(m_cameraThread->mailbox(), this);
+    m_scaler->setTargetSize(ui->video_widget->size());
+    m_scaler->setLatencyStats(m_cameraThread->latency());
+    m_cameraThread->setPreviewSize(ui->video_widget->size());
+
+    /* 采集线程放入新帧时直接在采集线程里唤醒缩放线程*/
+    connect(m_cameraThread->mailbox(), &FrameMailbox::frameAvailable,
+            m_scaler, &PreviewScaler::wake, Qt::DirectConnection);
+    /* 缩放好的帧放进信箱, 通知是合并过的, GUI忙时不会堆积排队事件*/
+    connect(m_scaler->output(), &FrameMailbox::frameAvailable, this, &Widget::updateFrame);
+
+    /* 按钮的 on_<对象>_clicked 槽由 setupUi() 自动连接, 不要再手动connect, 否则每次点击触发两次*/
+
+    /* 延迟统计叠加层, 勾选"延迟统计"后每500ms刷新一次*/
+    m_latencyLabel = new QLabel(ui->video_widget);
+    m_latencyLabel->setGeometry(8, 8, 430, 128);
+    m_latencyLabel->setAlignment(Qt::AlignLeft | Qt::AlignTop);
+    m_latencyLabel->setStyleSheet("background-color: rgba(0, 0, 0, 160); color: rgb(0, 255, 0);"
+                                  "font-family: monospace; font-size: 11px;");
+    m_latencyLabel->setVisible(false);
+    m_latencyTimer = new QTimer(this);
+    m_latencyTimer->setInterval(500);
+    connect(m_latencyTimer, &QTimer::timeout, this, &Widget::refreshLatencyOverlay);
+    connect(ui->latency_overlay, &QCheckBox::toggled, this, &Widget::toggleLatencyOverlay);
+
+    /* 设置了V4L2_LATENCY_DUMP时定期把统计写成JSON, 周期由V4L2_LATENCY_DUMP_MS指定(默认1000ms)*/
+    m_dumpTimer = new QTimer(this);
+    m_dumpPath = qgetenv("V4L2_LATENCY_DUMP");
+    if (!m_dumpPath.isEmpty()) {
+        int interval = qgetenv("V4L2_LATENCY_DUMP_MS").toInt();
+        connect(m_dumpTimer, &QTimer::timeout, this, &Widget::dumpLatency);
+        m_dumpTimer->start(interval > 0 ? interval : 1000);
+    }
 
     /* 启动后台线程捕捉摄像头画面*/
+    m_scaler->start();
     m_cameraThread->start();
 }
 
 Widget::~Widget()
 {
     m_cameraThread->stop();
+    m_scaler->stop();
     delete ui;
 }
 
-/*这个槽函数在每次接收到新图像时被调用*/
-void Widget::updateFrame(const QImage &frame)
+/*这个槽函数在信箱里有新图像时被调用, 中间被覆盖掉的帧直接跳过*/
+void Widget::updateFrame()
+{
+    QImage frame;
+    qint64 captured = 0;
+    if (!m_scaler->output()->take(&frame, &captured)) return;
+
+    /* 图像已经是显示区域大小的RGB32, 这里只做贴图*/
+    ui->video_widget->setPixmap(QPixmap::fromImage(frame));
+    if (captured)
+        m_cameraThread->latency()->record(LatencyStats::Display, LatencyStats::now() - captured);
+}
+
+void Widget::toggleLatencyOverlay(bool checked)
+{
+    m_latencyLabel->setVisible(checked);
+    if (checked) {
+        refreshLatencyOverlay();
+        m_latencyTimer->start();
+    } else {
+        m_latencyTimer->stop();
+    }
+}
+
+void Widget::refreshLatencyOverlay()
+{
+    /* 延迟之后附上流水线各级队列的深度和丢帧数*/
+    CameraThread::PipelineStats pipe = m_cameraThread->pipelineStats();
+    QString queues = QString("queue convert %1/%2 drop %3 | record %4/%5 drop %6")
+            .arg(pipe.convert.depth).arg(pipe.convert.capacity).arg(pipe.convert.dropped)
+            .arg(pipe.record.depth).arg(pipe.record.capacity).arg(pipe.record.dropped);
+    FramePool::Stats pool = m_cameraThread->framePoolStats();
+    queues += QString("\npool hit %1 miss %2 held %3 peak %4")
+            .arg(pool.hits).arg(pool.misses).arg(pool.outstanding).arg(pool.highWater);
+    m_latencyLabel->setText(m_cameraThread->latency()->summary() + queues);
+}
+
+void Widget::dumpLatency()
+{
+    if (!m_cameraThread->latency()->dumpTo(m_dumpPath.constData())) {
+        qDebug() << "警告: 写入延迟统计失败" << m_dumpPath;
+        m_dumpTimer->stop();
+    }
+}
+
+void Widget::resizeEvent(QResizeEvent *event)
 {
-    /* 在主GUI线程中安全地更新UI界面*/
-    ui->video_widget->setPixmap(QPixmap::fromImage(frame).scaled(
-        ui->video_widget->size(),
-        Qt::KeepAspectRatio,
-        Qt::SmoothTransformation
-    ));
+    QWidget::resizeEvent(event);
+    /* 显示区域大小变化后, 缩放线程会用上一帧立即重新缩放*/
+    m_scaler->setTargetSize(ui->video_widget->size());
+    m_cameraThread->setPreviewSize(ui->video_widget->size());
 }
 
-/*拍照按钮的槽函数*/
+/*拍照按钮的槽函数, 按连拍框里的张数从接下来的帧里各存一张*/
 void Widget::on_picture_clicked()
 {
-    m_cameraThread->capturePicture();
+    m_cameraThread->capturePicture(ui->burst_count->value());
 }
 
 /*亮度 + 按钮的槽函数*/
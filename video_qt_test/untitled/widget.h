@@ -2,7 +2,10 @@
 #define WIDGET_H
 
 #include <QWidget>
+#include <QLabel>
+#include <QTimer>
 #include "camerathread.h"
+#include "previewscaler.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class Widget; }
@@ -17,16 +20,27 @@ public:
     ~Widget();
 
 public slots:
-    void updateFrame(const QImage &frame); /*接收新图像的槽*/
+    void updateFrame(); /*有新图像时从信箱取最新一帧显示*/
 
 private slots:
     void on_picture_clicked();
     void on_brightness1_clicked();
     void on_brightness2_clicked();
+    void toggleLatencyOverlay(bool checked);
+    void refreshLatencyOverlay();
+    void dumpLatency();
+
+protected:
+    void resizeEvent(QResizeEvent *event) override;
 
 private:
     Ui::Widget *ui;
     CameraThread *m_cameraThread;
+    PreviewScaler *m_scaler;
+    QLabel *m_latencyLabel;     /*叠加在画面左上角的延迟统计*/
+    QTimer *m_latencyTimer;
+    QTimer *m_dumpTimer;
+    QByteArray m_dumpPath;      /*环境变量V4L2_LATENCY_DUMP指定的JSON输出路径*/
     int m_brightness;
 };
 #endif
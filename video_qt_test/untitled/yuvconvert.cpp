@@ -0,0 +1,648 @@
+#include "yuvconvert.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUV_HAVE_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUV_HAVE_NEON 1
+#endif
+
+/*
+ * Q6定点系数: R = Y + 1.402V, G = Y - 0.344U - 0.714V, B = Y + 1.772U
+ * 所有中间量 (Y<<6) + 系数*UV 都落在int16范围内, 因此SIMD路径可以直接
+ * 用16位乘加, 与标量路径结果逐位一致。右移时截断而不舍入, 和原先浮点
+ * 实现的截断行为一致, 全部输入下与浮点结果相差不超过1。
+ */
+enum {
+    K_RV = 90,   /*1.402 * 64*/
+    K_GU = 22,   /*0.344 * 64*/
+    K_GV = 46,   /*0.714 * 64*/
+    K_BU = 113   /*1.772 * 64*/
+};
+
+static inline uint8_t q6ToU8(int v)
+{
+    v >>= 6;
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+/*共用一对色度的两个像素*/
+static inline void storePair(uint8_t *dst, int y0, int y1, int u, int v)
+{
+    y0 <<= 6;
+    y1 <<= 6;
+    u -= 128;
+    v -= 128;
+    int rv = K_RV * v;
+    int guv = -K_GU * u - K_GV * v;
+    int bu = K_BU * u;
+    dst[0] = q6ToU8(y0 + rv);
+    dst[1] = q6ToU8(y0 + guv);
+    dst[2] = q6ToU8(y0 + bu);
+    dst[3] = q6ToU8(y1 + rv);
+    dst[4] = q6ToU8(y1 + guv);
+    dst[5] = q6ToU8(y1 + bu);
+}
+
+/*转换一行中从第first对像素开始的剩余部分, 也是所有SIMD路径的尾部处理*/
+static void yuyvRowScalar(const uint8_t *src, uint8_t *dst, int first, int pairs)
+{
+    src += first * 4;
+    dst += first * 6;
+    for (int i = first; i < pairs; ++i, src += 4, dst += 6)
+        storePair(dst, src[0], src[2], src[1], src[3]);
+}
+
+/*半平面格式的一行, y和uv都指向行首*/
+static void nvRowScalar(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int first, int pairs)
+{
+    y += first * 2;
+    uv += first * 2;
+    dst += first * 6;
+    for (int i = first; i < pairs; ++i, y += 2, uv += 2, dst += 6)
+        storePair(dst, y[0], y[1], uv[0], uv[1]);
+}
+
+static void nvRowScalar(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width)
+{
+    nvRowScalar(y, uv, dst, 0, width / 2);
+}
+
+/*查表解码的一对像素, 和SIMD内核一样直接截断(不加舍入), 输出时顺带查色调表*/
+static inline void storePairLut(uint8_t *dst, const YuvTables &t, int y0, int y1, int u, int v)
+{
+    int l0 = t.y[y0];
+    int l1 = t.y[y1];
+    int rv = t.rv[v];
+    int guv = t.gu[u] + t.gv[v];
+    int bu = t.bu[u];
+    dst[0] = t.tone[q6ToU8(l0 + rv)];
+    dst[1] = t.tone[q6ToU8(l0 + guv)];
+    dst[2] = t.tone[q6ToU8(l0 + bu)];
+    dst[3] = t.tone[q6ToU8(l1 + rv)];
+    dst[4] = t.tone[q6ToU8(l1 + guv)];
+    dst[5] = t.tone[q6ToU8(l1 + bu)];
+}
+
+static void convertScalar(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                          int width, int height)
+{
+    for (int y = 0; y < height; ++y)
+        yuyvRowScalar(src + y * srcStride, dst + y * dstStride, 0, width / 2);
+}
+
+#ifdef YUV_HAVE_X86
+
+#ifdef __SSE2__
+/*一次处理16个像素(32字节输入, 48字节输出)*/
+static void convertSse2(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                        int width, int height)
+{
+    const __m128i lo8  = _mm_set1_epi16(0x00ff);
+    const __m128i c128 = _mm_set1_epi16(128);
+    const __m128i krv  = _mm_set1_epi16(K_RV);
+    const __m128i kgu  = _mm_set1_epi16(-K_GU);
+    const __m128i kgv  = _mm_set1_epi16(-K_GV);
+    const __m128i kbu  = _mm_set1_epi16(K_BU);
+    const int blocks = width / 16;
+    alignas(16) uint8_t r[16], g[16], b[16];
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *s = src + y * srcStride;
+        uint8_t *d = dst + y * dstStride;
+        for (int n = 0; n < blocks; ++n, s += 32, d += 48) {
+            __m128i a  = _mm_loadu_si128((const __m128i *)s);
+            __m128i bb = _mm_loadu_si128((const __m128i *)(s + 16));
+            __m128i ya = _mm_slli_epi16(_mm_and_si128(a, lo8), 6);
+            __m128i yb = _mm_slli_epi16(_mm_and_si128(bb, lo8), 6);
+            __m128i uv = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(bb, 8));
+            __m128i u  = _mm_sub_epi16(_mm_and_si128(uv, lo8), c128);
+            __m128i v  = _mm_sub_epi16(_mm_srli_epi16(uv, 8), c128);
+
+            __m128i rv  = _mm_mullo_epi16(v, krv);
+            __m128i guv = _mm_add_epi16(_mm_mullo_epi16(u, kgu), _mm_mullo_epi16(v, kgv));
+            __m128i bu  = _mm_mullo_epi16(u, kbu);
+
+            /*每个色度值对应两个相邻像素*/
+            __m128i R = _mm_packus_epi16(
+                _mm_srai_epi16(_mm_add_epi16(ya, _mm_unpacklo_epi16(rv, rv)), 6),
+                _mm_srai_epi16(_mm_add_epi16(yb, _mm_unpackhi_epi16(rv, rv)), 6));
+            __m128i G = _mm_packus_epi16(
+                _mm_srai_epi16(_mm_add_epi16(ya, _mm_unpacklo_epi16(guv, guv)), 6),
+                _mm_srai_epi16(_mm_add_epi16(yb, _mm_unpackhi_epi16(guv, guv)), 6));
+            __m128i B = _mm_packus_epi16(
+                _mm_srai_epi16(_mm_add_epi16(ya, _mm_unpacklo_epi16(bu, bu)), 6),
+                _mm_srai_epi16(_mm_add_epi16(yb, _mm_unpackhi_epi16(bu, bu)), 6));
+
+            /*SSE2没有字节重排指令, 经L1中的小块交织成RGB888*/
+            _mm_store_si128((__m128i *)r, R);
+            _mm_store_si128((__m128i *)g, G);
+            _mm_store_si128((__m128i *)b, B);
+            for (int i = 0; i < 16; ++i) {
+                d[i * 3 + 0] = r[i];
+                d[i * 3 + 1] = g[i];
+                d[i * 3 + 2] = b[i];
+            }
+        }
+        yuyvRowScalar(src + y * srcStride, dst + y * dstStride, blocks * 8, width / 2);
+    }
+}
+
+/*半平面一行, 一次16个像素: 16字节Y + 16字节UV, 之后与YUYV路径完全相同*/
+static void nvRowSse2(const uint8_t *y, const uint8_t *uv, uint8_t *d, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo8  = _mm_set1_epi16(0x00ff);
+    const __m128i c128 = _mm_set1_epi16(128);
+    const __m128i krv  = _mm_set1_epi16(K_RV);
+    const __m128i kgu  = _mm_set1_epi16(-K_GU);
+    const __m128i kgv  = _mm_set1_epi16(-K_GV);
+    const __m128i kbu  = _mm_set1_epi16(K_BU);
+    const int blocks = width / 16;
+    alignas(16) uint8_t r[16], g[16], b[16];
+
+    for (int n = 0; n < blocks; ++n) {
+        __m128i yy = _mm_loadu_si128((const __m128i *)(y + n * 16));
+        __m128i c  = _mm_loadu_si128((const __m128i *)(uv + n * 16));
+        __m128i ya = _mm_slli_epi16(_mm_unpacklo_epi8(yy, zero), 6);
+        __m128i yb = _mm_slli_epi16(_mm_unpackhi_epi8(yy, zero), 6);
+        __m128i u  = _mm_sub_epi16(_mm_and_si128(c, lo8), c128);
+        __m128i v  = _mm_sub_epi16(_mm_srli_epi16(c, 8), c128);
+
+        __m128i rv  = _mm_mullo_epi16(v, krv);
+        __m128i guv = _mm_add_epi16(_mm_mullo_epi16(u, kgu), _mm_mullo_epi16(v, kgv));
+        __m128i bu  = _mm_mullo_epi16(u, kbu);
+
+        __m128i R = _mm_packus_epi16(
+            _mm_srai_epi16(_mm_add_epi16(ya, _mm_unpacklo_epi16(rv, rv)), 6),
+            _mm_srai_epi16(_mm_add_epi16(yb, _mm_unpackhi_epi16(rv, rv)), 6));
+        __m128i G = _mm_packus_epi16(
+            _mm_srai_epi16(_mm_add_epi16(ya, _mm_unpacklo_epi16(guv, guv)), 6),
+            _mm_srai_epi16(_mm_add_epi16(yb, _mm_unpackhi_epi16(guv, guv)), 6));
+        __m128i B = _mm_packus_epi16(
+            _mm_srai_epi16(_mm_add_epi16(ya, _mm_unpacklo_epi16(bu, bu)), 6),
+            _mm_srai_epi16(_mm_add_epi16(yb, _mm_unpackhi_epi16(bu, bu)), 6));
+
+        _mm_store_si128((__m128i *)r, R);
+        _mm_store_si128((__m128i *)g, G);
+        _mm_store_si128((__m128i *)b, B);
+        uint8_t *o = d + n * 48;
+        for (int i = 0; i < 16; ++i) {
+            o[i * 3 + 0] = r[i];
+            o[i * 3 + 1] = g[i];
+            o[i * 3 + 2] = b[i];
+        }
+    }
+    nvRowScalar(y, uv, d, blocks * 8, width / 2);
+}
+#endif
+
+#if defined(__GNUC__)
+#define YUV_HAVE_AVX2 1
+#define YUV_TARGET_AVX2 __attribute__((target("avx2")))
+
+/*把16个像素的R/G/B平面交织成48字节RGB888*/
+YUV_TARGET_AVX2
+static inline void storeRgb16(uint8_t *d, __m128i r, __m128i g, __m128i b, const __m128i mask[3][3])
+{
+    for (int p = 0; p < 3; ++p) {
+        __m128i o = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, mask[p][0]),
+                                              _mm_shuffle_epi8(g, mask[p][1])),
+                                 _mm_shuffle_epi8(b, mask[p][2]));
+        _mm_storeu_si128((__m128i *)(d + p * 16), o);
+    }
+}
+
+/*一次处理32个像素(64字节输入, 96字节输出)*/
+YUV_TARGET_AVX2
+static void convertAvx2(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                        int width, int height)
+{
+    const __m256i lo8  = _mm256_set1_epi16(0x00ff);
+    const __m256i c128 = _mm256_set1_epi16(128);
+    const __m256i krv  = _mm256_set1_epi16(K_RV);
+    const __m256i kgu  = _mm256_set1_epi16(-K_GU);
+    const __m256i kgv  = _mm256_set1_epi16(-K_GV);
+    const __m256i kbu  = _mm256_set1_epi16(K_BU);
+    const int blocks = width / 32;
+
+    /*输出第p个16字节中第k个字节取自通道(16p+k)%3的第(16p+k)/3个像素*/
+    __m128i mask[3][3];
+    for (int p = 0; p < 3; ++p) {
+        for (int c = 0; c < 3; ++c) {
+            alignas(16) int8_t m[16];
+            for (int k = 0; k < 16; ++k) {
+                int pos = p * 16 + k;
+                m[k] = (pos % 3 == c) ? (int8_t)(pos / 3) : (int8_t)0x80;
+            }
+            mask[p][c] = _mm_load_si128((const __m128i *)m);
+        }
+    }
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *s = src + y * srcStride;
+        uint8_t *d = dst + y * dstStride;
+        for (int n = 0; n < blocks; ++n, s += 64, d += 96) {
+            __m256i a  = _mm256_loadu_si256((const __m256i *)s);
+            __m256i bb = _mm256_loadu_si256((const __m256i *)(s + 32));
+            /*ya: 像素0-7 | 8-15, yb: 像素16-23 | 24-31 (每128位通道各一组)*/
+            __m256i ya = _mm256_slli_epi16(_mm256_and_si256(a, lo8), 6);
+            __m256i yb = _mm256_slli_epi16(_mm256_and_si256(bb, lo8), 6);
+            /*packus按通道进行: uv低通道为色度对0-3,8-11, 高通道为4-7,12-15*/
+            __m256i uv = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(bb, 8));
+            __m256i u  = _mm256_sub_epi16(_mm256_and_si256(uv, lo8), c128);
+            __m256i v  = _mm256_sub_epi16(_mm256_srli_epi16(uv, 8), c128);
+
+            __m256i rv  = _mm256_mullo_epi16(v, krv);
+            __m256i guv = _mm256_add_epi16(_mm256_mullo_epi16(u, kgu), _mm256_mullo_epi16(v, kgv));
+            __m256i bu  = _mm256_mullo_epi16(u, kbu);
+
+            /*unpacklo/hi后与ya/yb的像素顺序正好对齐*/
+            __m256i R = _mm256_packus_epi16(
+                _mm256_srai_epi16(_mm256_add_epi16(ya, _mm256_unpacklo_epi16(rv, rv)), 6),
+                _mm256_srai_epi16(_mm256_add_epi16(yb, _mm256_unpackhi_epi16(rv, rv)), 6));
+            __m256i G = _mm256_packus_epi16(
+                _mm256_srai_epi16(_mm256_add_epi16(ya, _mm256_unpacklo_epi16(guv, guv)), 6),
+                _mm256_srai_epi16(_mm256_add_epi16(yb, _mm256_unpackhi_epi16(guv, guv)), 6));
+            __m256i B = _mm256_packus_epi16(
+                _mm256_srai_epi16(_mm256_add_epi16(ya, _mm256_unpacklo_epi16(bu, bu)), 6),
+                _mm256_srai_epi16(_mm256_add_epi16(yb, _mm256_unpackhi_epi16(bu, bu)), 6));
+
+            /*packus后的64位块顺序为 0-7,16-23,8-15,24-31, 重排回线性顺序*/
+            R = _mm256_permute4x64_epi64(R, 0xD8);
+            G = _mm256_permute4x64_epi64(G, 0xD8);
+            B = _mm256_permute4x64_epi64(B, 0xD8);
+
+            storeRgb16(d, _mm256_castsi256_si128(R), _mm256_castsi256_si128(G),
+                       _mm256_castsi256_si128(B), mask);
+            storeRgb16(d + 48, _mm256_extracti128_si256(R, 1), _mm256_extracti128_si256(G, 1),
+                       _mm256_extracti128_si256(B, 1), mask);
+        }
+        yuyvRowScalar(src + y * srcStride, dst + y * dstStride, blocks * 16, width / 2);
+    }
+}
+
+/*
+ * 半平面一行, 一次32个像素。Y按通道unpack后, ya为像素0-7|16-23, yb为8-15|24-31,
+ * 与UV按通道展开的顺序一致, packus之后就是线性顺序, 不需要YUYV路径的permute。
+ */
+YUV_TARGET_AVX2
+static void nvRowAvx2(const uint8_t *y, const uint8_t *uv, uint8_t *d, int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo8  = _mm256_set1_epi16(0x00ff);
+    const __m256i c128 = _mm256_set1_epi16(128);
+    const __m256i krv  = _mm256_set1_epi16(K_RV);
+    const __m256i kgu  = _mm256_set1_epi16(-K_GU);
+    const __m256i kgv  = _mm256_set1_epi16(-K_GV);
+    const __m256i kbu  = _mm256_set1_epi16(K_BU);
+    const int blocks = width / 32;
+
+    __m128i mask[3][3];
+    for (int p = 0; p < 3; ++p) {
+        for (int c = 0; c < 3; ++c) {
+            alignas(16) int8_t m[16];
+            for (int k = 0; k < 16; ++k) {
+                int pos = p * 16 + k;
+                m[k] = (pos % 3 == c) ? (int8_t)(pos / 3) : (int8_t)0x80;
+            }
+            mask[p][c] = _mm_load_si128((const __m128i *)m);
+        }
+    }
+
+    for (int n = 0; n < blocks; ++n) {
+        __m256i yy = _mm256_loadu_si256((const __m256i *)(y + n * 32));
+        __m256i c  = _mm256_loadu_si256((const __m256i *)(uv + n * 32));
+        __m256i ya = _mm256_slli_epi16(_mm256_unpacklo_epi8(yy, zero), 6);
+        __m256i yb = _mm256_slli_epi16(_mm256_unpackhi_epi8(yy, zero), 6);
+        __m256i u  = _mm256_sub_epi16(_mm256_and_si256(c, lo8), c128);
+        __m256i v  = _mm256_sub_epi16(_mm256_srli_epi16(c, 8), c128);
+
+        __m256i rv  = _mm256_mullo_epi16(v, krv);
+        __m256i guv = _mm256_add_epi16(_mm256_mullo_epi16(u, kgu), _mm256_mullo_epi16(v, kgv));
+        __m256i bu  = _mm256_mullo_epi16(u, kbu);
+
+        __m256i R = _mm256_packus_epi16(
+            _mm256_srai_epi16(_mm256_add_epi16(ya, _mm256_unpacklo_epi16(rv, rv)), 6),
+            _mm256_srai_epi16(_mm256_add_epi16(yb, _mm256_unpackhi_epi16(rv, rv)), 6));
+        __m256i G = _mm256_packus_epi16(
+            _mm256_srai_epi16(_mm256_add_epi16(ya, _mm256_unpacklo_epi16(guv, guv)), 6),
+            _mm256_srai_epi16(_mm256_add_epi16(yb, _mm256_unpackhi_epi16(guv, guv)), 6));
+        __m256i B = _mm256_packus_epi16(
+            _mm256_srai_epi16(_mm256_add_epi16(ya, _mm256_unpacklo_epi16(bu, bu)), 6),
+            _mm256_srai_epi16(_mm256_add_epi16(yb, _mm256_unpackhi_epi16(bu, bu)), 6));
+
+        uint8_t *o = d + n * 96;
+        storeRgb16(o, _mm256_castsi256_si128(R), _mm256_castsi256_si128(G),
+                   _mm256_castsi256_si128(B), mask);
+        storeRgb16(o + 48, _mm256_extracti128_si256(R, 1), _mm256_extracti128_si256(G, 1),
+                   _mm256_extracti128_si256(B, 1), mask);
+    }
+    nvRowScalar(y, uv, d, blocks * 16, width / 2);
+}
+#endif
+
+#endif /*YUV_HAVE_X86*/
+
+#ifdef YUV_HAVE_NEON
+/*一次处理16个像素, vld4解交织出 Y偶/U/Y奇/V, vst3直接写RGB888*/
+static void convertNeon(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                        int width, int height)
+{
+    const int blocks = width / 16;
+    const int16x8_t c128 = vdupq_n_s16(128);
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *s = src + y * srcStride;
+        uint8_t *d = dst + y * dstStride;
+        for (int n = 0; n < blocks; ++n, s += 32, d += 48) {
+            uint8x8x4_t in = vld4_u8(s);
+            int16x8_t ye = vreinterpretq_s16_u16(vshll_n_u8(in.val[0], 6));
+            int16x8_t yo = vreinterpretq_s16_u16(vshll_n_u8(in.val[2], 6));
+            int16x8_t u  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[1])), c128);
+            int16x8_t v  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[3])), c128);
+
+            int16x8_t rv  = vmulq_n_s16(v, K_RV);
+            int16x8_t guv = vmlaq_n_s16(vmulq_n_s16(u, -K_GU), v, -K_GV);
+            int16x8_t bu  = vmulq_n_s16(u, K_BU);
+
+            /*vqshrun_n_s16(x, 6) 即 sat_u8(x >> 6), 与标量路径一致*/
+            uint8x8x2_t r = vzip_u8(vqshrun_n_s16(vaddq_s16(ye, rv), 6),
+                                    vqshrun_n_s16(vaddq_s16(yo, rv), 6));
+            uint8x8x2_t g = vzip_u8(vqshrun_n_s16(vaddq_s16(ye, guv), 6),
+                                    vqshrun_n_s16(vaddq_s16(yo, guv), 6));
+            uint8x8x2_t b = vzip_u8(vqshrun_n_s16(vaddq_s16(ye, bu), 6),
+                                    vqshrun_n_s16(vaddq_s16(yo, bu), 6));
+
+            uint8x16x3_t out;
+            out.val[0] = vcombine_u8(r.val[0], r.val[1]);
+            out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+            out.val[2] = vcombine_u8(b.val[0], b.val[1]);
+            vst3q_u8(d, out);
+        }
+        yuyvRowScalar(src + y * srcStride, dst + y * dstStride, blocks * 8, width / 2);
+    }
+}
+
+/*半平面一行, 一次16个像素, vld2分别解交织出 Y偶/Y奇 和 U/V*/
+static void nvRowNeon(const uint8_t *y, const uint8_t *uv, uint8_t *d, int width)
+{
+    const int blocks = width / 16;
+    const int16x8_t c128 = vdupq_n_s16(128);
+
+    for (int n = 0; n < blocks; ++n) {
+        uint8x8x2_t yy = vld2_u8(y + n * 16);
+        uint8x8x2_t c  = vld2_u8(uv + n * 16);
+        int16x8_t ye = vreinterpretq_s16_u16(vshll_n_u8(yy.val[0], 6));
+        int16x8_t yo = vreinterpretq_s16_u16(vshll_n_u8(yy.val[1], 6));
+        int16x8_t u  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(c.val[0])), c128);
+        int16x8_t v  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(c.val[1])), c128);
+
+        int16x8_t rv  = vmulq_n_s16(v, K_RV);
+        int16x8_t guv = vmlaq_n_s16(vmulq_n_s16(u, -K_GU), v, -K_GV);
+        int16x8_t bu  = vmulq_n_s16(u, K_BU);
+
+        uint8x8x2_t r = vzip_u8(vqshrun_n_s16(vaddq_s16(ye, rv), 6),
+                                vqshrun_n_s16(vaddq_s16(yo, rv), 6));
+        uint8x8x2_t g = vzip_u8(vqshrun_n_s16(vaddq_s16(ye, guv), 6),
+                                vqshrun_n_s16(vaddq_s16(yo, guv), 6));
+        uint8x8x2_t b = vzip_u8(vqshrun_n_s16(vaddq_s16(ye, bu), 6),
+                                vqshrun_n_s16(vaddq_s16(yo, bu), 6));
+
+        uint8x16x3_t out;
+        out.val[0] = vcombine_u8(r.val[0], r.val[1]);
+        out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+        out.val[2] = vcombine_u8(b.val[0], b.val[1]);
+        vst3q_u8(d + n * 48, out);
+    }
+    nvRowScalar(y, uv, d, blocks * 8, width / 2);
+}
+#endif
+
+typedef void (*ConvertFn)(const uint8_t *, int, uint8_t *, int, int, int);
+typedef void (*NvRowFn)(const uint8_t *, const uint8_t *, uint8_t *, int);
+
+bool yuvKernelSupported(YuvKernel kernel)
+{
+    switch (kernel) {
+    case YuvKernel::Auto:
+    case YuvKernel::Scalar:
+        return true;
+#if defined(YUV_HAVE_X86) && defined(__SSE2__)
+    case YuvKernel::Sse2:
+        return true;
+#endif
+#ifdef YUV_HAVE_AVX2
+    case YuvKernel::Avx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef YUV_HAVE_NEON
+    case YuvKernel::Neon:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+static YuvKernel detectKernel()
+{
+    const YuvKernel order[] = { YuvKernel::Neon, YuvKernel::Avx2, YuvKernel::Sse2 };
+    for (YuvKernel k : order) {
+        if (yuvKernelSupported(k))
+            return k;
+    }
+    return YuvKernel::Scalar;
+}
+
+YuvKernel yuvActiveKernel()
+{
+    static const YuvKernel kernel = detectKernel();
+    return kernel;
+}
+
+const char *yuvKernelName(YuvKernel kernel)
+{
+    switch (kernel) {
+    case YuvKernel::Auto:   return yuvKernelName(yuvActiveKernel());
+    case YuvKernel::Scalar: return "scalar";
+    case YuvKernel::Sse2:   return "sse2";
+    case YuvKernel::Avx2:   return "avx2";
+    case YuvKernel::Neon:   return "neon";
+    }
+    return "unknown";
+}
+
+static ConvertFn selectFn(YuvKernel kernel)
+{
+    if (kernel == YuvKernel::Auto)
+        kernel = yuvActiveKernel();
+    else if (!yuvKernelSupported(kernel))
+        kernel = YuvKernel::Scalar;
+
+    switch (kernel) {
+#if defined(YUV_HAVE_X86) && defined(__SSE2__)
+    case YuvKernel::Sse2: return convertSse2;
+#endif
+#ifdef YUV_HAVE_AVX2
+    case YuvKernel::Avx2: return convertAvx2;
+#endif
+#ifdef YUV_HAVE_NEON
+    case YuvKernel::Neon: return convertNeon;
+#endif
+    default:              return convertScalar;
+    }
+}
+
+static NvRowFn selectNvRow(YuvKernel kernel)
+{
+    if (kernel == YuvKernel::Auto)
+        kernel = yuvActiveKernel();
+    else if (!yuvKernelSupported(kernel))
+        kernel = YuvKernel::Scalar;
+
+    switch (kernel) {
+#if defined(YUV_HAVE_X86) && defined(__SSE2__)
+    case YuvKernel::Sse2: return nvRowSse2;
+#endif
+#ifdef YUV_HAVE_AVX2
+    case YuvKernel::Avx2: return nvRowAvx2;
+#endif
+#ifdef YUV_HAVE_NEON
+    case YuvKernel::Neon: return nvRowNeon;
+#endif
+    default:              return nvRowScalar;
+    }
+}
+
+/*NV12的一行UV被相邻两行Y共用, 在L1里连续用两次*/
+static void convertNv(NvRowFn row, const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride,
+                      int chromaShift, uint8_t *dst, int dstStride, int width, int height)
+{
+    for (int y = 0; y < height; ++y)
+        row(srcY + (size_t)y * yStride, srcUV + (size_t)(y >> chromaShift) * uvStride,
+            dst + (size_t)y * dstStride, width);
+}
+
+void nvToRgb888(YuvKernel kernel, const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride,
+                int chromaShift, uint8_t *dst, int dstStride, int width, int height)
+{
+    convertNv(selectNvRow(kernel), srcY, yStride, srcUV, uvStride, chromaShift,
+              dst, dstStride, width & ~1, height);
+}
+
+void nv12ToRgb888(const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride,
+                  uint8_t *dst, int dstStride, int width, int height)
+{
+    static const NvRowFn fn = selectNvRow(YuvKernel::Auto);
+    convertNv(fn, srcY, yStride, srcUV, uvStride, 1, dst, dstStride, width & ~1, height);
+}
+
+void nv16ToRgb888(const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride,
+                  uint8_t *dst, int dstStride, int width, int height)
+{
+    static const NvRowFn fn = selectNvRow(YuvKernel::Auto);
+    convertNv(fn, srcY, yStride, srcUV, uvStride, 0, dst, dstStride, width & ~1, height);
+}
+
+void yuyvToRgb888(YuvKernel kernel, const uint8_t *src, int srcStride,
+                  uint8_t *dst, int dstStride, int width, int height)
+{
+    selectFn(kernel)(src, srcStride, dst, dstStride, width & ~1, height);
+}
+
+void yuyvToRgb888(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                  int width, int height)
+{
+    static const ConvertFn fn = selectFn(YuvKernel::Auto);
+    fn(src, srcStride, dst, dstStride, width & ~1, height);
+}
+
+/*
+ * 解码表在0-255的尺度上计算, Y和UV先按范围展开再乘矩阵系数, 不带舍入偏置,
+ * 和q6ToU8/SIMD内核一样直接截断, 查表和走内核只差在系数的精度上;
+ * 色调表: 以128为中心乘对比度、加亮度, 截到0-255后做gamma。
+ */
+void buildYuvTables(const YuvAdjust &adjust, YuvTables *t)
+{
+    const double kr = adjust.matrix == YuvMatrix::Bt709 ? 0.2126 : 0.299;
+    const double kb = adjust.matrix == YuvMatrix::Bt709 ? 0.0722 : 0.114;
+    const double kg = 1.0 - kr - kb;
+    const bool limited = adjust.range == YuvRange::Limited;
+    const double yScale = limited ? 255.0 / 219.0 : 1.0;
+    const double cScale = limited ? 255.0 / 224.0 : 1.0;
+    const int yBlack = limited ? 16 : 0;
+    const double gamma = adjust.gamma > 0.0f ? adjust.gamma : 1.0;
+
+    for (int i = 0; i < 256; ++i) {
+        t->y[i] = (int32_t)std::lround((i - yBlack) * yScale * 64.0);
+        double c = (i - 128) * cScale * 64.0;
+        t->rv[i] = (int32_t)std::lround(2.0 * (1.0 - kr) * c);
+        t->gu[i] = (int32_t)std::lround(-2.0 * kb * (1.0 - kb) / kg * c);
+        t->gv[i] = (int32_t)std::lround(-2.0 * kr * (1.0 - kr) / kg * c);
+        t->bu[i] = (int32_t)std::lround(2.0 * (1.0 - kb) * c);
+
+        double v = (i - 128) * adjust.contrast + 128.0 + adjust.brightness;
+        v = v < 0.0 ? 0.0 : (v > 255.0 ? 255.0 : v);
+        t->tone[i] = (uint8_t)std::lround(255.0 * std::pow(v / 255.0, 1.0 / gamma));
+    }
+    t->standardDecode = adjust.standardDecode();
+    t->toneIdentity = adjust.toneIdentity();
+    t->identity = adjust.isIdentity();
+}
+
+static void applyTone(const YuvTables &t, uint8_t *row, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        row[i] = t.tone[row[i]];
+}
+
+void yuyvToRgb888(const YuvTables &tables, const uint8_t *src, int srcStride,
+                  uint8_t *dst, int dstStride, int width, int height)
+{
+    static const ConvertFn fn = selectFn(YuvKernel::Auto);
+    width &= ~1;
+    if (tables.identity) {
+        fn(src, srcStride, dst, dstStride, width, height);
+        return;
+    }
+    const int pairs = width / 2;
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *s = src + (size_t)y * srcStride;
+        uint8_t *d = dst + (size_t)y * dstStride;
+        if (tables.standardDecode) {
+            fn(s, srcStride, d, dstStride, width, 1);
+            applyTone(tables, d, width * 3);
+            continue;
+        }
+        for (int i = 0; i < pairs; ++i, s += 4, d += 6)
+            storePairLut(d, tables, s[0], s[2], s[1], s[3]);
+    }
+}
+
+void nvToRgb888(const YuvTables &tables, const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride,
+                int chromaShift, uint8_t *dst, int dstStride, int width, int height)
+{
+    static const NvRowFn row = selectNvRow(YuvKernel::Auto);
+    width &= ~1;
+    if (tables.identity) {
+        convertNv(row, srcY, yStride, srcUV, uvStride, chromaShift, dst, dstStride, width, height);
+        return;
+    }
+    const int pairs = width / 2;
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *sy = srcY + (size_t)y * yStride;
+        const uint8_t *uv = srcUV + (size_t)(y >> chromaShift) * uvStride;
+        uint8_t *d = dst + (size_t)y * dstStride;
+        if (tables.standardDecode) {
+            row(sy, uv, d, width);
+            applyTone(tables, d, width * 3);
+            continue;
+        }
+        for (int i = 0; i < pairs; ++i, sy += 2, uv += 2, d += 6)
+            storePairLut(d, tables, sy[0], sy[1], uv[0], uv[1]);
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef YUVCONVERT_H
+#define YUVCONVERT_H
+
+#include <cstdint>
+
+/*
+ * YUV -> RGB888 转换内核
+ * 全部使用同一套Q6定点系数(BT.601: 1.402 / 0.344 / 0.714 / 1.772 乘以64后取整),
+ * 标量、SSE2、AVX2、NEON 各路径逐位一致, 运行时根据CPU能力选择最快的一条。
+ */
+enum class YuvKernel {
+    Auto,   /*按CPU能力自动选择*/
+    Scalar,
+    Sse2,
+    Avx2,
+    Neon
+};
+
+/*YUYV(YUV422打包) -> RGB888, width必须为偶数, stride以字节为单位*/
+void yuyvToRgb888(const uint8_t *src, int srcStride,
+                  uint8_t *dst, int dstStride,
+                  int width, int height);
+
+/*指定内核执行, 用于对比各路径的输出与性能; 不支持的内核退回标量实现*/
+void yuyvToRgb888(YuvKernel kernel,
+                  const uint8_t *src, int srcStride,
+                  uint8_t *dst, int dstStride,
+                  int width, int height);
+
+/*
+ * NV12/NV16(Y平面 + UV交织平面) -> RGB888, width必须为偶数。
+ * NV12的UV平面每行对应两行Y, NV16每行对应一行Y; 两个平面的stride可以不同。
+ */
+void nv12ToRgb888(const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride,
+                  uint8_t *dst, int dstStride, int width, int height);
+void nv16ToRgb888(const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride,
+                  uint8_t *dst, int dstStride, int width, int height);
+
+/*指定内核执行的半平面版本, chromaShift为UV平面相对Y平面的垂直下采样位数(NV12为1, NV16为0)*/
+void nvToRgb888(YuvKernel kernel,
+                const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride, int chromaShift,
+                uint8_t *dst, int dstStride, int width, int height);
+
+/*YUV的色彩矩阵和取值范围*/
+enum class YuvMatrix { Bt601, Bt709 };
+enum class YuvRange {
+    Full,       /*Y/UV都是0-255(JPEG及vcam)*/
+    Limited     /*Y为16-235, UV为16-240(多数摄像头和视频)*/
+};
+
+/*
+ * 软件画面调节参数, 默认值即原先的BT.601全范围转换。
+ * 矩阵和范围决定YUV怎么解码; 亮度/对比度/gamma是作用在解码后RGB上的色调曲线。
+ */
+struct YuvAdjust {
+    int brightness = 0;         /*亮度偏移, -255~255*/
+    float contrast = 1.0f;      /*以中灰为中心的对比度倍数*/
+    float gamma = 1.0f;         /*大于1提亮暗部*/
+    YuvMatrix matrix = YuvMatrix::Bt601;
+    YuvRange range = YuvRange::Full;
+
+    bool isIdentity() const { return standardDecode() && toneIdentity(); }
+    bool standardDecode() const { return matrix == YuvMatrix::Bt601 && range == YuvRange::Full; }
+    bool toneIdentity() const { return brightness == 0 && contrast == 1.0f && gamma == 1.0f; }
+};
+
+/*
+ * 调节参数展开成的查找表, 约1.3KB, 常驻L1。参数不变时可以一直复用。
+ * 标准解码时仍走SIMD内核, 每转完一行趁它还在L1里过一遍色调表;
+ * 其它矩阵/范围用Y、UV的Q6表解码, 色调表在同一次写出时查, 整帧都只读写一遍。
+ */
+struct YuvTables {
+    int32_t y[256];
+    int32_t rv[256];
+    int32_t gu[256];
+    int32_t gv[256];
+    int32_t bu[256];
+    uint8_t tone[256];
+    bool standardDecode = true;
+    bool toneIdentity = true;
+    bool identity = true;       /*参数为默认值, 和不带调节的版本完全相同*/
+};
+
+void buildYuvTables(const YuvAdjust &adjust, YuvTables *tables);
+
+/*带调节的转换; tables为默认参数时等同于不带调节的版本(走SIMD内核)*/
+void yuyvToRgb888(const YuvTables &tables,
+                  const uint8_t *src, int srcStride,
+                  uint8_t *dst, int dstStride,
+                  int width, int height);
+void nvToRgb888(const YuvTables &tables,
+                const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride, int chromaShift,
+                uint8_t *dst, int dstStride, int width, int height);
+
+bool yuvKernelSupported(YuvKernel kernel);
+YuvKernel yuvActiveKernel();
+const char *yuvKernelName(YuvKernel kernel);
+
+#endif
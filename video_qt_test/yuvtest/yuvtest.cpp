@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "yuvconvert.h"
+
+/*
+ * YUV转换内核的一致性测试, 不依赖Qt
+ * 每个本机支持的内核(SSE2/AVX2/NEON和Auto选中的那个)都和标量实现逐字节比较,
+ * 覆盖奇数宽度、比SIMD一次处理的像素还少的宽度和带行尾填充的stride。
+ * 源缓冲区按实际需要的字节数分配, 配合 make SANITIZE=1 可以查出越界读;
+ * 目标行尾的填充字节预先填上标记, 转换后必须保持不变。
+ * 所有内核(包括标量)的YUYV结果还要和原来getFrame里的浮点循环比较, 逐字节差不超过1,
+ * 而且整体没有偏向, 防止各内核共用的定点系数出错时互相比较查不出来。
+ * 画面调节的查表路径另外和标量内核比较, 确认两边的舍入方式一致。
+ */
+
+static const uint8_t Guard = 0xa5;
+
+static unsigned int s_seed = 12345;
+static unsigned int s_failures = 0;
+static unsigned int s_cases = 0;
+
+static uint8_t nextByte()
+{
+    s_seed = s_seed * 1103515245u + 12345u;
+    return (uint8_t)(s_seed >> 16);
+}
+
+/*stride*(rows-1)再加最后一行的有效字节, 不多分配*/
+static std::vector<uint8_t> randomPlane(int stride, int rowBytes, int rows)
+{
+    std::vector<uint8_t> plane((size_t)stride * (rows - 1) + rowBytes);
+    for (uint8_t &b : plane)
+        b = nextByte();
+    return plane;
+}
+
+/*和参考实现比较时整体偏差的累计, 每个内核跑完后检查一次*/
+static long long s_refBias = 0;
+static long long s_refBytes = 0;
+
+/*原来 V4L2Camera::getFrame 里的逐像素浮点转换, 只是加上了stride*/
+static void referenceYuyvToRgb(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                               int width, int height)
+{
+    auto clamp = [](int val) { return (unsigned char)std::max(0, std::min(val, 255)); };
+    for (int row = 0; row < height; ++row) {
+        const uint8_t *yuyv = src + (size_t)row * srcStride;
+        uint8_t *rgb = dst + (size_t)row * dstStride;
+        for (int i = 0; i < width / 2; ++i) {
+            int y1 = yuyv[i*4 + 0];
+            int u  = yuyv[i*4 + 1] - 128;
+            int y2 = yuyv[i*4 + 2];
+            int v  = yuyv[i*4 + 3] - 128;
+            rgb[i*6 + 0] = clamp(y1 + 1.402 * v);
+            rgb[i*6 + 1] = clamp(y1 - 0.344 * u - 0.714 * v);
+            rgb[i*6 + 2] = clamp(y1 + 1.772 * u);
+            rgb[i*6 + 3] = clamp(y2 + 1.402 * v);
+            rgb[i*6 + 4] = clamp(y2 - 0.344 * u - 0.714 * v);
+            rgb[i*6 + 5] = clamp(y2 + 1.772 * u);
+        }
+    }
+}
+
+static void report(const char *what, YuvKernel kernel, int width, int height, int pad, const char *detail)
+{
+    ++s_failures;
+    fprintf(stderr, "失败: %s %s 宽%d 高%d 填充%d: %s\n",
+            what, yuvKernelName(kernel), width, height, pad, detail);
+}
+
+/*有效部分和标量结果一致, 行尾填充和奇数宽度的最后一个像素都没有被写*/
+static void compare(const char *what, YuvKernel kernel, int width, int height, int pad,
+                    const std::vector<uint8_t> &expect, const std::vector<uint8_t> &got, int dstStride)
+{
+    ++s_cases;
+    const int valid = (width & ~1) * 3;
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *e = expect.data() + (size_t)y * dstStride;
+        const uint8_t *g = got.data() + (size_t)y * dstStride;
+        for (int x = 0; x < valid; ++x) {
+            if (e[x] != g[x]) {
+                char detail[96];
+                snprintf(detail, sizeof(detail), "第%d行第%d字节 期望%u 实际%u", y, x, e[x], g[x]);
+                report(what, kernel, width, height, pad, detail);
+                return;
+            }
+        }
+        for (int x = valid; x < dstStride; ++x) {
+            if (g[x] != Guard) {
+                char detail[96];
+                snprintf(detail, sizeof(detail), "第%d行越界写到第%d字节", y, x);
+                report(what, kernel, width, height, pad, detail);
+                return;
+            }
+        }
+    }
+}
+
+/*有效部分和参考实现逐字节差不超过1, 差值累计进整体偏差*/
+static void compareReference(YuvKernel kernel, int width, int height, int pad,
+                             const std::vector<uint8_t> &expect, const std::vector<uint8_t> &got, int dstStride)
+{
+    ++s_cases;
+    const int valid = (width & ~1) * 3;
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *e = expect.data() + (size_t)y * dstStride;
+        const uint8_t *g = got.data() + (size_t)y * dstStride;
+        for (int x = 0; x < valid; ++x) {
+            int d = (int)g[x] - (int)e[x];
+            if (d > 1 || d < -1) {
+                char detail[96];
+                snprintf(detail, sizeof(detail), "第%d行第%d字节 参考%u 实际%u", y, x, e[x], g[x]);
+                report("YUYV参考", kernel, width, height, pad, detail);
+                return;
+            }
+            s_refBias += d;
+        }
+        s_refBytes += valid;
+    }
+}
+
+static void testYuyv(YuvKernel kernel, int width, int height, int pad)
+{
+    const int srcStride = width * 2 + pad;
+    const int dstStride = width * 3 + pad;
+    std::vector<uint8_t> src = randomPlane(srcStride, width * 2, height);
+    std::vector<uint8_t> expect((size_t)dstStride * height, Guard);
+    std::vector<uint8_t> got((size_t)dstStride * height, Guard);
+
+    yuyvToRgb888(YuvKernel::Scalar, src.data(), srcStride, expect.data(), dstStride, width, height);
+    yuyvToRgb888(kernel, src.data(), srcStride, got.data(), dstStride, width, height);
+    compare("YUYV", kernel, width, height, pad, expect, got, dstStride);
+
+    std::vector<uint8_t> reference((size_t)dstStride * height, Guard);
+    referenceYuyvToRgb(src.data(), srcStride, reference.data(), dstStride, width, height);
+    compareReference(kernel, width, height, pad, reference, got, dstStride);
+
+    /*不指定内核的版本用的是Auto选中的内核*/
+    if (kernel == YuvKernel::Auto) {
+        std::fill(got.begin(), got.end(), Guard);
+        yuyvToRgb888(src.data(), srcStride, got.data(), dstStride, width, height);
+        compare("YUYV默认", kernel, width, height, pad, expect, got, dstStride);
+
+        YuvTables tables;
+        buildYuvTables(YuvAdjust(), &tables);
+        std::fill(got.begin(), got.end(), Guard);
+        yuyvToRgb888(tables, src.data(), srcStride, got.data(), dstStride, width, height);
+        compare("YUYV默认参数查表", kernel, width, height, pad, expect, got, dstStride);
+    }
+}
+
+static void testNv(YuvKernel kernel, int chromaShift, int width, int height, int pad)
+{
+    const char *what = chromaShift ? "NV12" : "NV16";
+    const int yStride = width + pad;
+    /*UV平面的stride故意和Y平面不同*/
+    const int uvStride = (width & ~1) + pad * 2;
+    const int dstStride = width * 3 + pad;
+    const int uvRows = (height + (1 << chromaShift) - 1) >> chromaShift;
+    std::vector<uint8_t> srcY = randomPlane(yStride, width, height);
+    std::vector<uint8_t> srcUV = randomPlane(uvStride, width & ~1, uvRows);
+    std::vector<uint8_t> expect((size_t)dstStride * height, Guard);
+    std::vector<uint8_t> got((size_t)dstStride * height, Guard);
+
+    nvToRgb888(YuvKernel::Scalar, srcY.data(), yStride, srcUV.data(), uvStride, chromaShift,
+               expect.data(), dstStride, width, height);
+    nvToRgb888(kernel, srcY.data(), yStride, srcUV.data(), uvStride, chromaShift,
+               got.data(), dstStride, width, height);
+    compare(what, kernel, width, height, pad, expect, got, dstStride);
+
+    if (kernel == YuvKernel::Auto) {
+        std::fill(got.begin(), got.end(), Guard);
+        if (chromaShift)
+            nv12ToRgb888(srcY.data(), yStride, srcUV.data(), uvStride, got.data(), dstStride, width, height);
+        else
+            nv16ToRgb888(srcY.data(), yStride, srcUV.data(), uvStride, got.data(), dstStride, width, height);
+        compare(chromaShift ? "NV12默认" : "NV16默认", kernel, width, height, pad, expect, got, dstStride);
+    }
+}
+
+/*
+ * 强制走查表路径(标准解码参数), 和标量内核比较舍入方式:
+ * 两边的系数精度不同, 允许逐字节差1, 但不能有整体偏向(查表多加舍入会整体偏亮)
+ */
+static void testLutRounding()
+{
+    const int width = 256, height = 64;
+    std::vector<uint8_t> src((size_t)width * 2 * height);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x) {
+            uint8_t *p = src.data() + ((size_t)y * width + x) * 2;
+            p[0] = (uint8_t)x;                    /*所有亮度值*/
+            p[1] = nextByte();
+        }
+    std::vector<uint8_t> expect((size_t)width * 3 * height);
+    std::vector<uint8_t> got(expect.size());
+    yuyvToRgb888(YuvKernel::Scalar, src.data(), width * 2, expect.data(), width * 3, width, height);
+
+    YuvTables tables;
+    buildYuvTables(YuvAdjust(), &tables);
+    tables.identity = false;
+    tables.standardDecode = false;
+    yuyvToRgb888(tables, src.data(), width * 2, got.data(), width * 3, width, height);
+
+    ++s_cases;
+    long long bias = 0;
+    int worst = 0;
+    for (size_t i = 0; i < got.size(); ++i) {
+        int d = (int)got[i] - (int)expect[i];
+        bias += d;
+        if (d < 0) d = -d;
+        if (d > worst) worst = d;
+    }
+    const double mean = (double)bias / (double)got.size();
+    if (worst > 1 || mean > 0.1 || mean < -0.1) {
+        char detail[96];
+        snprintf(detail, sizeof(detail), "最大差%d 平均偏差%.3f", worst, mean);
+        report("查表舍入", YuvKernel::Scalar, width, height, 0, detail);
+    }
+}
+
+int main()
+{
+    /*最宽的AVX2一次处理32个像素, 在它和SSE2的16个像素前后各取几个宽度*/
+    const int widths[] = { 1, 2, 3, 4, 6, 7, 8, 14, 15, 16, 17, 18, 30, 31, 32, 33, 34,
+                           46, 48, 50, 62, 63, 64, 65, 66, 94, 96, 98, 127, 130, 641, 1282 };
+    const int heights[] = { 1, 2, 3, 5 };
+    const int pads[] = { 0, 2, 3, 64 };
+    const YuvKernel kernels[] = { YuvKernel::Scalar, YuvKernel::Auto, YuvKernel::Sse2, YuvKernel::Avx2,
+                                  YuvKernel::Neon };
+
+    printf("当前内核: %s\n", yuvKernelName(YuvKernel::Auto));
+    for (YuvKernel kernel : kernels) {
+        if (!yuvKernelSupported(kernel)) {
+            printf("跳过 %s: 本机不支持\n", kernel == YuvKernel::Sse2 ? "sse2" :
+                   kernel == YuvKernel::Avx2 ? "avx2" : "neon");
+            continue;
+        }
+        unsigned int before = s_failures;
+        s_refBias = 0;
+        s_refBytes = 0;
+        for (int width : widths)
+            for (int height : heights)
+                for (int pad : pads) {
+                    testYuyv(kernel, width, height, pad);
+                    testNv(kernel, 1, width, height, pad);
+                    testNv(kernel, 0, width, height, pad);
+                }
+        /*逐字节的±1允许, 但平均下来不能整体偏亮或偏暗*/
+        const double mean = s_refBytes ? (double)s_refBias / (double)s_refBytes : 0.0;
+        if (mean > 0.1 || mean < -0.1) {
+            char detail[96];
+            snprintf(detail, sizeof(detail), "和参考实现的平均偏差%.3f", mean);
+            report("YUYV参考", kernel, 0, 0, 0, detail);
+        }
+        printf("%-6s %s\n", kernel == YuvKernel::Auto ? "auto" : yuvKernelName(kernel),
+               s_failures == before ? "通过" : "失败");
+    }
+    testLutRounding();
+    printf("共%u项, 失败%u项\n", s_cases, s_failures);
+    return s_failures ? 1 : 0;
+}
@@ -23,6 +23,8 @@
 #include <pthread.h>
 #include <signal.h> // 为了处理信号
 
+#define MAX_BUFS 32 // 最多支持的缓冲区个数
+
 // 用来保存每个缓冲区的地址和长度
 struct buffer {
     void   *start;
@@ -122,14 +124,22 @@ int main(int argc, char **argv)
     char filename[32];
     int file_cnt = 0;
     int i;
-    struct buffer bufs[32]; // 最多支持32个缓冲区
+    struct buffer bufs[MAX_BUFS];
+    int req_cnt = 4; // 默认请求4个缓冲区, 可由第二个参数指定
 
     signal(SIGINT, handle_sigint);
 
-    if (argc != 2) {
-        fprintf(stderr, "用法: %s </dev/videox>\n", argv[0]);
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "用法: %s </dev/videox> [缓冲区个数1-%d]\n", argv[0], MAX_BUFS);
         return -1;
     }
+    if (argc == 3) {
+        req_cnt = atoi(argv[2]);
+        if (req_cnt < 1 || req_cnt > MAX_BUFS) {
+            fprintf(stderr, "缓冲区个数必须在 1-%d 之间\n", MAX_BUFS);
+            return -1;
+        }
+    }
 
     fd = open(argv[1], O_RDWR);
     if (fd < 0) {
@@ -152,7 +162,7 @@ int main(int argc, char **argv)
 
     //请求缓冲区
     memset(&rb, 0, sizeof(rb));
-    rb.count = 4; // 请求4个缓冲区
+    rb.count = req_cnt;
     rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     rb.memory = V4L2_MEMORY_MMAP;
     if (ioctl(fd, VIDIOC_REQBUFS, &rb) != 0) {
@@ -162,7 +172,13 @@ int main(int argc, char **argv)
     }
     //以它实际分配的为准
     buf_cnt = rb.count; 
-    printf("驱动实际分配了 %d 个缓冲区\n", buf_cnt);
+    printf("请求 %d 个缓冲区, 驱动实际分配了 %d 个\n", req_cnt, buf_cnt);
+    // 驱动可能多给, 超过bufs数组就无法保存
+    if (buf_cnt < 1 || buf_cnt > MAX_BUFS) {
+        fprintf(stderr, "驱动分配的缓冲区个数 %d 超出范围 1-%d\n", buf_cnt, MAX_BUFS);
+        close(fd);
+        return -1;
+    }
 
     //查询并映射所有缓冲区
      
@@ -247,6 +263,10 @@ int main(int argc, char **argv)
                 perror("将缓冲区出队失败");
                 break;
             }
+            if (buf.index >= (unsigned int)buf_cnt) {
+                fprintf(stderr, "驱动返回了非法的缓冲区下标 %u\n", buf.index);
+                break;
+            }
 
             printf("捕获到第 %d 帧数据，大小: %u\n", file_cnt, buf.bytesused);
             sprintf(filename, "video_frame_%04d.yuyv", file_cnt++);